@@ -321,6 +321,7 @@ struct boc {
 	enum boc_state_e	state;
 	uint8_t			*vary;
 	uint64_t		len_so_far;
+	ssize_t			len_estimate;	/* -1: unknown */
 };
 
 /* Object core structure ---------------------------------------------
@@ -489,6 +490,9 @@ struct req {
 
 	/* The busy objhead we sleep on */
 	struct objhead		*hash_objhead;
+	/* The object we were handed when woken, and when we went to sleep */
+	struct objcore		*hash_oc;
+	double			t_wait;
 
 	/* Built Vary string */
 	uint8_t			*vary_b;
@@ -771,6 +775,9 @@ struct mempool * MPL_New(const char *name, volatile struct poolparam *pp,
 void MPL_Destroy(struct mempool **mpp);
 void *MPL_Get(struct mempool *mpl, unsigned *size);
 void MPL_Free(struct mempool *mpl, void *item);
+struct magclass *MAG_New(const char *name, unsigned size, struct mempool *);
+void *MAG_Get(struct magclass *, unsigned *size);
+void MAG_Free(struct magclass *, void *item);
 
 /* cache_obj.c */
 struct objcore * ObjNew(const struct worker *);
@@ -519,6 +519,19 @@ ban_evaluate(struct worker *wrk, const uint8_t *bs, struct objcore *oc,
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Unlocked check if an object has seen all bans, which is what the
+ * first test in BAN_CheckObject() does.
+ */
+
+int
+BAN_Current(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	return (oc->ban == ban_start);
+}
+
 /*--------------------------------------------------------------------
  * Check an object against all applicable bans
  *
@@ -539,7 +552,7 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
-	Lck_AssertHeld(&oc->objhead->mtx);
+	Lck_AssertHeld(HSH_Mtx(oc->objhead));
 	assert(oc->refcnt > 0);
 
 	vsl = req->vsl;
@@ -35,6 +35,7 @@
 #include "cache_ban.h"
 #include "cache_objhead.h"
 
+#include "vatomic.h"
 #include "vtim.h"
 
 static struct objcore oc_mark_cnt = { .magic = OBJCORE_MAGIC, };
@@ -166,19 +167,19 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 
 		oh = oc->objhead;
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-		if (!Lck_Trylock(&oh->mtx)) {
+		if (!Lck_Trylock(HSH_Mtx(oh))) {
 			if (oc->refcnt == 0) {
-				Lck_Unlock(&oh->mtx);
+				Lck_Unlock(HSH_Mtx(oh));
 			} else {
 				/*
 				 * We got the lock, and the oc is not being
 				 * dismantled under our feet - grab a ref
 				 */
 				AZ(oc->flags & OC_F_BUSY);
-				oc->refcnt += 1;
+				(void)VATOMIC_INC(&oc->refcnt);
 				VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
 				VTAILQ_INSERT_TAIL(&bt->objcore, oc, ban_list);
-				Lck_Unlock(&oh->mtx);
+				Lck_Unlock(HSH_Mtx(oh));
 				break;
 			}
 		}
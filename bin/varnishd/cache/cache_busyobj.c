@@ -39,6 +39,7 @@
 #include "cache_objhead.h"
 
 static struct mempool		*vbopool;
+static struct magclass		*vbomag;
 
 /*--------------------------------------------------------------------
  */
@@ -50,6 +51,7 @@ VBO_Init(void)
 	vbopool = MPL_New("busyobj", &cache_param->vbo_pool,
 	    &cache_param->workspace_backend);
 	AN(vbopool);
+	vbomag = MAG_New("busyobj", 0, vbopool);
 }
 
 /*--------------------------------------------------------------------
@@ -62,7 +64,7 @@ vbo_New(void)
 	struct busyobj *bo;
 	unsigned sz;
 
-	bo = MPL_Get(vbopool, &sz);
+	bo = MAG_Get(vbomag, &sz);
 	XXXAN(bo);
 	bo->magic = BUSYOBJ_MAGIC;
 	bo->end = (char *)bo + sz;
@@ -76,7 +78,7 @@ vbo_Free(struct busyobj **bop)
 
 	TAKE_OBJ_NOTNULL(bo, bop, BUSYOBJ_MAGIC);
 	AZ(bo->htc);
-	MPL_Free(vbopool, bo);
+	MAG_Free(vbomag, bo);
 }
 
 struct busyobj *
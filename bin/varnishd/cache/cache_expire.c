@@ -28,18 +28,33 @@
  *
  * LRU and object timer handling.
  *
+ * The objects are split over expiry_threads shards on their digest,
+ * each with its own inbox, binheap and thread, so that neither the
+ * inbox lock nor a single thread expiring objects becomes the limit.
+ * An object stays in the same shard for its entire life.
+ *
+ * The timers are kept in a binheap, or with expiry_wheel set, in a
+ * timing wheel, which has O(1) insert, move and delete, at the cost of
+ * expiring objects up to one tick late.  Both use ->timer_idx, and
+ * zero for "not in there".
+ *
  */
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
 #include "cache_objhead.h"
 
 #include "binary_heap.h"
+#include "timer_wheel.h"
+#include "vend.h"
 #include "vtim.h"
 
+#include "VSC_exp.h"
+
 struct exp_priv {
 	unsigned			magic;
 #define EXP_PRIV_MAGIC			0x9db22482
@@ -47,14 +62,96 @@ struct exp_priv {
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	uint64_t			nmailed;
+	struct VSC_exp			*vsc;
 
 	/* owned by exp thread */
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct binheap			*heap;
+	struct twheel			*wheel;
+	char				name[16];
 };
 
-static struct exp_priv *exphdl;
+static struct exp_priv **exp_shards;
+static unsigned exp_nshard;
+
+static struct exp_priv *
+exp_shard(const struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (exp_nshard == 1)
+		return (exp_shards[0]);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	return (exp_shards[
+	    vbe16dec(oc->objhead->digest + DIGEST_LEN - 2) % exp_nshard]);
+}
+
+/*--------------------------------------------------------------------
+ * The timer structure, binheap or wheel
+ */
+
+static void
+exp_tmr_insert(const struct exp_priv *ep, struct objcore *oc)
+{
+
+	assert(oc->timer_idx == BINHEAP_NOIDX);
+	if (ep->wheel != NULL)
+		twheel_insert(ep->wheel, oc, oc->timer_when);
+	else
+		binheap_insert(ep->heap, oc);
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+}
+
+static void
+exp_tmr_reorder(const struct exp_priv *ep, const struct objcore *oc)
+{
+
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+	if (ep->wheel != NULL)
+		twheel_reorder(ep->wheel, oc->timer_idx, oc->timer_when);
+	else
+		binheap_reorder(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+}
+
+static void
+exp_tmr_delete(const struct exp_priv *ep, const struct objcore *oc)
+{
+
+	assert(oc->timer_idx != BINHEAP_NOIDX);
+	if (ep->wheel != NULL)
+		twheel_delete(ep->wheel, oc->timer_idx);
+	else
+		binheap_delete(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx == BINHEAP_NOIDX);
+}
+
+/*
+ * Return the object which is due first if it is due at 'now', else
+ * NULL and in '*tnext' when to look again.
+ */
+
+static struct objcore *
+exp_tmr_due(const struct exp_priv *ep, double now, double *tnext)
+{
+	struct objcore *oc;
+
+	*tnext = now + 355./113.;
+	if (ep->wheel != NULL) {
+		oc = twheel_due(ep->wheel, now);
+		if (oc == NULL && twheel_count(ep->wheel) > 0)
+			*tnext = twheel_next(ep->wheel);
+		return (oc);
+	}
+	oc = binheap_root(ep->heap);
+	if (oc != NULL && oc->timer_when > now) {
+		*tnext = oc->timer_when;
+		oc = NULL;
+	}
+	return (oc);
+}
 
 /*--------------------------------------------------------------------
  * Calculate an objects effective ttl time, taking req.ttl into account
@@ -81,25 +178,30 @@ EXP_Ttl(const struct req *req, const struct objcore *oc)
 static void
 exp_mail_it(struct objcore *oc, uint8_t cmds)
 {
+	struct exp_priv *ep;
+
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_shard(oc);
+	Lck_Lock(&ep->mtx);
 	if ((cmds | oc->exp_flags) & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
 			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
 			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
+			ep->vsc->inbox++;
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
 		AN(oc->exp_flags & OC_EF_REFD);
-		VSC_C_main->exp_mailed++;
-		AZ(pthread_cond_signal(&exphdl->condvar));
+		ep->nmailed++;
+		ep->vsc->mailed++;
+		AZ(pthread_cond_signal(&ep->condvar));
 	}
-	Lck_Unlock(&exphdl->mtx);
+	Lck_Unlock(&ep->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -185,8 +287,8 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 
 	if (flags & OC_EF_REMOVE) {
 		if (!(flags & OC_EF_INSERT)) {
-			assert(oc->timer_idx != BINHEAP_NOIDX);
-			binheap_delete(ep->heap, oc->timer_idx);
+			exp_tmr_delete(ep, oc);
+			ep->vsc->objects--;
 		}
 		assert(oc->timer_idx == BINHEAP_NOIDX);
 		assert(oc->refcnt > 0);
@@ -211,42 +313,38 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags)
 	 */
 
 	if (flags & OC_EF_INSERT) {
-		assert(oc->timer_idx == BINHEAP_NOIDX);
-		binheap_insert(exphdl->heap, oc);
-		assert(oc->timer_idx != BINHEAP_NOIDX);
+		exp_tmr_insert(ep, oc);
+		ep->vsc->objects++;
 	} else if (flags & OC_EF_MOVE) {
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_reorder(exphdl->heap, oc->timer_idx);
-		assert(oc->timer_idx != BINHEAP_NOIDX);
+		exp_tmr_reorder(ep, oc);
 	} else {
 		WRONG("Objcore state wrong in inbox");
 	}
 }
 
 /*--------------------------------------------------------------------
- * Expire stuff from the binheap
+ * Expire stuff from the binheap or wheel
  */
 
 static double
 exp_expire(struct exp_priv *ep, double now)
 {
 	struct objcore *oc;
+	double tnext;
 
 	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 
-	oc = binheap_root(ep->heap);
+	/* Ready ? */
+	oc = exp_tmr_due(ep, now, &tnext);
 	if (oc == NULL)
-		return (now + 355./113.);
-	VSLb(&ep->vsl, SLT_ExpKill, "EXP_expire p=%p e=%.9f f=0x%x", oc,
-	    oc->timer_when - now, oc->flags);
+		return (tnext);
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	VSLb(&ep->vsl, SLT_ExpKill, "EXP_expire p=%p e=%.9f f=0x%x", oc,
+	    oc->timer_when - now, oc->flags);
 
-	/* Ready ? */
-	if (oc->timer_when > now)
-		return (oc->timer_when);
-
-	VSC_C_main->n_expired++;
+	ep->wrk->stats->n_expired++;
+	ep->vsc->expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -260,10 +358,8 @@ exp_expire(struct exp_priv *ep, double now)
 		if (!(oc->flags & OC_F_DYING))
 			HSH_Kill(oc);
 
-		/* Remove from binheap */
-		assert(oc->timer_idx != BINHEAP_NOIDX);
-		binheap_delete(ep->heap, oc->timer_idx);
-		assert(oc->timer_idx == BINHEAP_NOIDX);
+		exp_tmr_delete(ep, oc);
+		ep->vsc->objects--;
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%u t=%.0f",
@@ -275,7 +371,7 @@ exp_expire(struct exp_priv *ep, double now)
 }
 
 /*--------------------------------------------------------------------
- * This thread monitors the root of the binary heap and whenever an
+ * These threads monitor the root of their binary heap and whenever an
  * object expires, accounting also for graceability, it is killed.
  */
 
@@ -311,8 +407,14 @@ exp_thread(struct worker *wrk, void *priv)
 	CAST_OBJ_NOTNULL(ep, priv, EXP_PRIV_MAGIC);
 	ep->wrk = wrk;
 	VSL_Setup(&ep->vsl, NULL, 0);
-	ep->heap = binheap_new(NULL, object_cmp, object_update);
-	AN(ep->heap);
+	if (cache_param->expiry_wheel > 0.) {
+		ep->wheel = twheel_new(NULL, object_update, VTIM_real(),
+		    cache_param->expiry_wheel);
+		AN(ep->wheel);
+	} else {
+		ep->heap = binheap_new(NULL, object_cmp, object_update);
+		AN(ep->heap);
+	}
 	while (1) {
 
 		Lck_Lock(&ep->mtx);
@@ -321,20 +423,29 @@ exp_thread(struct worker *wrk, void *priv)
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			ep->vsc->inbox--;
+			ep->vsc->received++;
+			wrk->stats->exp_received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
 				oc->exp_flags = 0;
 			else
 				oc->exp_flags &= OC_EF_REFD;
-		} else if (tnext > t) {
+		}
+		wrk->stats->exp_mailed += ep->nmailed;
+		ep->nmailed = 0;
+		if (oc == NULL && tnext > t) {
 			VSL_Flush(&ep->vsl, 0);
 			Pool_Sumstat(wrk);
 			(void)Lck_CondWait(&ep->condvar, &ep->mtx, tnext);
 		}
 		Lck_Unlock(&ep->mtx);
 
+		/* Do not sit on the stats while there is a backlog */
+		if (wrk->stats->exp_received >= 256)
+			(void)Pool_TrySumstat(wrk);
+
 		t = VTIM_real();
 
 		if (oc != NULL)
@@ -352,13 +463,32 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	AZ(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	exphdl = ep;
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
+	unsigned u;
+	char nm[8];
+
+	exp_nshard = cache_param->expiry_threads;
+	assert(exp_nshard > 0);
+	exp_shards = calloc(exp_nshard, sizeof *exp_shards);
+	AN(exp_shards);
+
+	for (u = 0; u < exp_nshard; u++) {
+		ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
+		AN(ep);
+
+		Lck_New(&ep->mtx, lck_exp);
+		AZ(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		bprintf(nm, "%u", u);
+		ep->vsc = VSC_exp_New(nm);
+		AN(ep->vsc);
+		exp_shards[u] = ep;
+	}
+	for (u = 0; u < exp_nshard; u++) {
+		ep = exp_shards[u];
+		if (exp_nshard == 1)
+			bprintf(ep->name, "%s", "cache-exp");
+		else
+			bprintf(ep->name, "cache-exp%u", u);
+		WRK_BgThread(&pt, ep->name, exp_thread, ep);
+	}
 }
@@ -584,6 +584,7 @@ vbf_stp_fetch(struct worker *wrk, struct busyobj *bo)
 		AN(bo->uncacheable);
 
 	bo->fetch_objcore->boc->len_so_far = 0;
+	bo->fetch_objcore->boc->len_estimate = bo->htc->content_length;
 
 	if (VFP_Open(bo->vfc)) {
 		(void)VFP_Error(bo->vfc, "Fetch pipeline failed to open");
@@ -710,6 +711,8 @@ vbf_stp_condfetch(struct worker *wrk, struct busyobj *bo)
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 
+	bo->fetch_objcore->boc->len_estimate =
+	    ObjGetLen(bo->wrk, bo->stale_oc);
 	AZ(vbf_beresp2obj(bo));
 
 	if (ObjHasAttr(bo->wrk, bo->stale_oc, OA_ESIDATA))
@@ -61,7 +61,10 @@
 #include "cache/cache_transport.h"
 
 #include "hash/hash_slinger.h"
+#include "storage/storage.h"
 
+#include "vatomic.h"
+#include "vmb.h"
 #include "vsha256.h"
 #include "vtim.h"
 
@@ -73,10 +76,23 @@ struct rush {
 
 static const struct hash_slinger *hash;
 static struct objhead *private_oh;
+static struct magclass *mag_objhead;
 
-static void hsh_rush1(const struct worker *, struct objhead *,
-    struct rush *, int);
+struct lock hsh_lck[1 << HSH_LCK_BITS];
+
+#define HSH_NOLOCK_MAXSCAN	16
+#define HSH_CLEAN_INTERVAL	1.0
+
+static struct VSC_lck *lck_hsh;
+static struct lock hsh_cool_mtx;
+static VTAILQ_HEAD(, objcore) hsh_cool = VTAILQ_HEAD_INITIALIZER(hsh_cool);
+static volatile unsigned hsh_cool_on;
+
+static void hsh_cool_start(void);
+static void hsh_rush1(struct worker *, struct objhead *,
+    struct objcore *, struct rush *, int);
 static void hsh_rush2(struct worker *, struct rush *);
+static void hsh_vidx_free(const struct worker *, struct objhead *);
 
 /*---------------------------------------------------------------------*/
 
@@ -85,15 +101,38 @@ hsh_newobjhead(void)
 {
 	struct objhead *oh;
 
-	ALLOC_OBJ(oh, OBJHEAD_MAGIC);
+	oh = MAG_Get(mag_objhead, NULL);
 	XXXAN(oh);
+	oh->magic = OBJHEAD_MAGIC;
 	oh->refcnt = 1;
 	VTAILQ_INIT(&oh->objcs);
 	VTAILQ_INIT(&oh->waitinglist);
-	Lck_New(&oh->mtx, lck_objhdr);
 	return (oh);
 }
 
+/*---------------------------------------------------------------------
+ * oh->objcs_gen is a sequence counter for lookups which scan oh->objcs
+ * without the lock.  It must be bumped around anything which moves or
+ * removes objcores on the list, appending does not disturb readers.
+ */
+
+static void
+hsh_objcs_begin(struct objhead *oh)
+{
+
+	Lck_AssertHeld(HSH_Mtx(oh));
+	oh->objcs_gen++;
+	VWMB();
+}
+
+static void
+hsh_objcs_end(struct objhead *oh)
+{
+
+	VWMB();
+	oh->objcs_gen++;
+}
+
 /*---------------------------------------------------------------------*/
 /* Precreate an objhead and object for later use */
 static void
@@ -109,6 +148,7 @@ hsh_prealloc(struct worker *wrk)
 	if (wrk->nobjhead == NULL) {
 		wrk->nobjhead = hsh_newobjhead();
 		wrk->stats->n_objecthead++;
+		wrk->stats->objmeta_bytes += sizeof(struct objhead);
 	}
 	CHECK_OBJ_NOTNULL(wrk->nobjhead, OBJHEAD_MAGIC);
 
@@ -130,10 +170,10 @@ HSH_Private(const struct worker *wrk)
 	oc->refcnt = 1;
 	oc->objhead = private_oh;
 	oc->flags |= OC_F_PRIVATE;
-	Lck_Lock(&private_oh->mtx);
+	Lck_Lock(HSH_Mtx(private_oh));
 	VTAILQ_INSERT_TAIL(&private_oh->objcs, oc, hsh_list);
 	private_oh->refcnt++;
-	Lck_Unlock(&private_oh->mtx);
+	Lck_Unlock(HSH_Mtx(private_oh));
 	return (oc);
 }
 
@@ -146,10 +186,10 @@ HSH_Cleanup(struct worker *wrk)
 		ObjDestroy(wrk, &wrk->nobjcore);
 
 	if (wrk->nobjhead != NULL) {
-		Lck_Delete(&wrk->nobjhead->mtx);
-		FREE_OBJ(wrk->nobjhead);
+		MAG_Free(mag_objhead, wrk->nobjhead);
 		wrk->nobjhead = NULL;
 		wrk->stats->n_objecthead--;
+		wrk->stats->objmeta_bytes -= sizeof(struct objhead);
 	}
 	if (wrk->nhashpriv != NULL) {
 		/* XXX: If needed, add slinger method for this */
@@ -165,9 +205,11 @@ HSH_DeleteObjHead(const struct worker *wrk, struct objhead *oh)
 	AZ(oh->refcnt);
 	assert(VTAILQ_EMPTY(&oh->objcs));
 	assert(VTAILQ_EMPTY(&oh->waitinglist));
-	Lck_Delete(&oh->mtx);
+	if (oh->vidx != NULL)
+		hsh_vidx_free(wrk, oh);
 	wrk->stats->n_objecthead--;
-	FREE_OBJ(oh);
+	wrk->stats->objmeta_bytes -= sizeof(struct objhead);
+	MAG_Free(mag_objhead, oh);
 }
 
 void
@@ -177,10 +219,10 @@ HSH_AddString(struct req *req, void *ctx, const char *str)
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	AN(ctx);
 	if (str != NULL) {
-		VSHA256_Update(ctx, str, strlen(str));
+		HSH_DigestUpdate(ctx, str, strlen(str));
 		VSLb(req->vsl, SLT_Hash, "%s", str);
 	} else
-		VSHA256_Update(ctx, &str, 1);
+		HSH_DigestUpdate(ctx, &str, 1);
 }
 
 /*---------------------------------------------------------------------
@@ -258,6 +300,259 @@ hsh_testmagic(void *result)
 	fprintf(stderr, ">\n");
 }
 
+/*---------------------------------------------------------------------
+ * Variant index
+ *
+ * Once an objhead has collected vary_index unbusied objects with a
+ * Vary header, these are moved off oh->objcs into buckets keyed by
+ * VRY_Key().  The buckets are shared by up to HSH_VIDX_NSPEC different
+ * sets of Vary headers ("specs"), and a lookup examines the bucket of
+ * the request under each spec, plus what is left on oh->objcs: busy
+ * objects, objects without a Vary header and objects whose spec did
+ * not fit in the index.
+ *
+ * The spec table is append-only, so an objcore is in the index if and
+ * only if it is not busy, has a Vary header and its spec is in the
+ * table, which lets us tell where to remove it from.
+ */
+
+#define HSH_VIDX_NSPEC		4
+#define HSH_VIDX_MINBUCKET	16
+
+struct hsh_vidx {
+	unsigned		magic;
+#define HSH_VIDX_MAGIC		0x7c3b9e51
+	unsigned		nobj;
+	unsigned		nbucket;
+	unsigned		nspec;
+	uint8_t			*spec[HSH_VIDX_NSPEC];
+	struct hsh_objcs	*bucket;
+};
+
+/*
+ * Objects on stevedores which page them in through sml_getobj() (the
+ * persistent one) are never indexed, so that we do not read them from
+ * disk with the objhead lock held.
+ */
+
+static const uint8_t *
+hsh_vary(struct worker *wrk, struct objcore *oc)
+{
+
+	if (oc->flags & OC_F_BUSY || oc->stobj->stevedore == NULL ||
+	    oc->stobj->stevedore->sml_getobj != NULL)
+		return (NULL);
+	if (!ObjHasAttr(wrk, oc, OA_VARY))
+		return (NULL);
+	return (ObjGetAttr(wrk, oc, OA_VARY, NULL));
+}
+
+static struct hsh_objcs *
+hsh_vidx_bucket(const struct hsh_vidx *vi, uint64_t key)
+{
+
+	key ^= key >> 32;
+	return (&vi->bucket[key & (vi->nbucket - 1)]);
+}
+
+static int
+hsh_vidx_spec(struct hsh_vidx *vi, const uint8_t *vary, int add)
+{
+	unsigned u;
+
+	for (u = 0; u < vi->nspec; u++)
+		if (VRY_SpecMatch(vary, vi->spec[u]))
+			return (u);
+	if (!add || vi->nspec == HSH_VIDX_NSPEC)
+		return (-1);
+	vi->spec[u] = malloc(VRY_SpecLen(vary));
+	AN(vi->spec[u]);
+	VRY_Spec(vary, vi->spec[u]);
+	vi->nspec++;
+	return (u);
+}
+
+static void
+hsh_vidx_resize(struct worker *wrk, struct hsh_vidx *vi, unsigned nbucket)
+{
+	struct hsh_objcs *ob;
+	struct objcore *oc;
+	unsigned u, onbucket;
+	const uint8_t *vary;
+
+	ob = vi->bucket;
+	onbucket = vi->nbucket;
+	vi->bucket = calloc(nbucket, sizeof *vi->bucket);
+	AN(vi->bucket);
+	vi->nbucket = nbucket;
+	for (u = 0; u < nbucket; u++)
+		VTAILQ_INIT(&vi->bucket[u]);
+	for (u = 0; u < onbucket; u++) {
+		/* Keep the newest-first order within each bucket */
+		while ((oc = VTAILQ_FIRST(&ob[u])) != NULL) {
+			VTAILQ_REMOVE(&ob[u], oc, hsh_list);
+			vary = hsh_vary(wrk, oc);
+			AN(vary);
+			VTAILQ_INSERT_TAIL(hsh_vidx_bucket(vi, VRY_Key(vary)),
+			    oc, hsh_list);
+		}
+	}
+	free(ob);
+}
+
+static int
+hsh_vidx_insert(struct worker *wrk, const struct objhead *oh,
+    struct objcore *oc, int head)
+{
+	struct hsh_vidx *vi;
+	struct hsh_objcs *b;
+	const uint8_t *vary;
+
+	vi = oh->vidx;
+	if (vi == NULL)
+		return (0);
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+	vary = hsh_vary(wrk, oc);
+	if (vary == NULL || hsh_vidx_spec(vi, vary, 1) < 0)
+		return (0);
+	b = hsh_vidx_bucket(vi, VRY_Key(vary));
+	if (head)
+		VTAILQ_INSERT_HEAD(b, oc, hsh_list);
+	else
+		VTAILQ_INSERT_TAIL(b, oc, hsh_list);
+	if (++vi->nobj > 2 * vi->nbucket)
+		hsh_vidx_resize(wrk, vi, 2 * vi->nbucket);
+	return (1);
+}
+
+static int
+hsh_vidx_remove(struct worker *wrk, const struct objhead *oh,
+    struct objcore *oc)
+{
+	struct hsh_vidx *vi;
+	const uint8_t *vary;
+
+	vi = oh->vidx;
+	if (vi == NULL)
+		return (0);
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+	vary = hsh_vary(wrk, oc);
+	if (vary == NULL || hsh_vidx_spec(vi, vary, 0) < 0)
+		return (0);
+	VTAILQ_REMOVE(hsh_vidx_bucket(vi, VRY_Key(vary)), oc, hsh_list);
+	assert(vi->nobj > 0);
+	vi->nobj--;
+	return (1);
+}
+
+/*
+ * Build the index when the objhead has collected enough variants.
+ * This is only called when an object with a Vary header is unbusied,
+ * so the counting stays bounded by vary_index.
+ */
+
+static void
+hsh_vidx_check(struct worker *wrk, struct objhead *oh)
+{
+	struct hsh_vidx *vi;
+	struct hsh_objcs keep;
+	struct objcore *oc;
+	unsigned n, u;
+
+	Lck_AssertHeld(HSH_Mtx(oh));
+	if (oh->vidx != NULL || oh == private_oh ||
+	    cache_param->vary_index == 0)
+		return;
+	n = 0;
+	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
+		if (hsh_vary(wrk, oc) != NULL)
+			n++;
+		if (n >= cache_param->vary_index)
+			break;
+	}
+	if (n < cache_param->vary_index)
+		return;
+
+	ALLOC_OBJ(vi, HSH_VIDX_MAGIC);
+	AN(vi);
+	for (u = HSH_VIDX_MINBUCKET; u < n; u <<= 1)
+		continue;
+	vi->nbucket = u;
+	vi->bucket = calloc(vi->nbucket, sizeof *vi->bucket);
+	AN(vi->bucket);
+	for (u = 0; u < vi->nbucket; u++)
+		VTAILQ_INIT(&vi->bucket[u]);
+	oh->vidx = vi;
+	VTAILQ_INIT(&keep);
+	while ((oc = VTAILQ_FIRST(&oh->objcs)) != NULL) {
+		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
+		if (!hsh_vidx_insert(wrk, oh, oc, 0))
+			VTAILQ_INSERT_TAIL(&keep, oc, hsh_list);
+	}
+	VTAILQ_CONCAT(&oh->objcs, &keep, hsh_list);
+	wrk->stats->n_vary_index++;
+}
+
+static void
+hsh_vidx_free(const struct worker *wrk, struct objhead *oh)
+{
+	struct hsh_vidx *vi;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(vi, &oh->vidx, HSH_VIDX_MAGIC);
+	AZ(vi->nobj);
+	for (u = 0; u < vi->nspec; u++)
+		free(vi->spec[u]);
+	free(vi->bucket);
+	FREE_OBJ(vi);
+	wrk->stats->n_vary_index--;
+}
+
+/*
+ * The lists a lookup has to examine, oh->objcs first.  Without an
+ * index, that is all there is.
+ */
+
+static unsigned
+hsh_vidx_lookup(const struct req *req, const struct objhead *oh,
+    struct hsh_objcs **lists)
+{
+	const struct hsh_vidx *vi;
+	struct hsh_objcs *b;
+	unsigned n, u, v;
+
+	n = 0;
+	lists[n++] = TRUST_ME(&oh->objcs);
+	vi = oh->vidx;
+	if (vi == NULL)
+		return (n);
+	CHECK_OBJ(vi, HSH_VIDX_MAGIC);
+	for (u = 0; u < vi->nspec; u++) {
+		b = hsh_vidx_bucket(vi, VRY_ReqKey(req->http, vi->spec[u]));
+		for (v = 1; v < n && lists[v] != b; v++)
+			continue;
+		if (v == n)
+			lists[n++] = b;
+	}
+	return (n);
+}
+
+/*
+ * Walk all the lists of an objhead: oh->objcs and then the buckets.
+ */
+
+static struct hsh_objcs *
+hsh_vidx_list(struct objhead *oh, unsigned n)
+{
+
+	if (n == 0)
+		return (&oh->objcs);
+	if (oh->vidx == NULL || n > oh->vidx->nbucket)
+		return (NULL);
+	CHECK_OBJ(oh->vidx, HSH_VIDX_MAGIC);
+	return (&oh->vidx->bucket[n - 1]);
+}
+
 /*---------------------------------------------------------------------
  * Insert an object which magically appears out of nowhere or, more likely,
  * comes off some persistent storage device.
@@ -285,15 +580,15 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 	AN(wrk->nobjhead);
 	oh = hash->lookup(wrk, digest, &wrk->nobjhead);
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_AssertHeld(&oh->mtx);
+	Lck_AssertHeld(HSH_Mtx(oh));
 	assert(oh->refcnt > 0);
 
 	/* Mark object busy and insert (precreated) objcore in
 	   objecthead. The new object inherits our objhead reference. */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, hsh_list);
-	oc->refcnt++;				// For EXP_Insert
-	Lck_Unlock(&oh->mtx);
+	(void)VATOMIC_INC(&oc->refcnt);		// For EXP_Insert
+	Lck_Unlock(HSH_Mtx(oh));
 
 	BAN_RefBan(oc, ban);
 	AN(oc->ban);
@@ -301,13 +596,15 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc,
 
 	/* Move the object first in the oh list, unbusy it and run the
 	   waitinglist if necessary */
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
+	hsh_objcs_begin(oh);
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
-	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
+	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	hsh_objcs_end(oh);
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
-	Lck_Unlock(&oh->mtx);
+		hsh_rush1(wrk, oh, oc, &rush, HSH_RUSH_POLICY);
+	Lck_Unlock(HSH_Mtx(oh));
 	hsh_rush2(wrk, &rush);
 }
 
@@ -320,7 +617,7 @@ hsh_insert_busyobj(struct worker *wrk, struct objhead *oh)
 	struct objcore *oc;
 
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_AssertHeld(&oh->mtx);
+	Lck_AssertHeld(HSH_Mtx(oh));
 
 	oc = wrk->nobjcore;
 	wrk->nobjcore = NULL;
@@ -333,6 +630,105 @@ hsh_insert_busyobj(struct worker *wrk, struct objhead *oh)
 	return (oc);
 }
 
+/*---------------------------------------------------------------------
+ * This req was handed an object when it was rushed off the waiting
+ * list.  Unless the object has gone stale or banned in the meantime,
+ * that is our hit, and we never need to look at the objhead list.
+ */
+
+static struct objcore *
+hsh_handoff(struct worker *wrk, struct req *req)
+{
+	struct objhead *oh;
+	struct objcore *oc;
+
+	TAKE_OBJ_NOTNULL(oc, &req->hash_oc, OBJCORE_MAGIC);
+	oh = req->hash_objhead;
+	assert(oc->objhead == oh);
+	if (oc->flags & OC_F_DYING || !BAN_Current(oc) ||
+	    EXP_Ttl(req, oc) < req->t_req) {
+		(void)HSH_DerefObjCore(wrk, &oc, 0);
+		return (NULL);
+	}
+	if (oc->hits < LONG_MAX)
+		(void)VATOMIC_INC(&oc->hits);
+	req->hash_objhead = NULL;
+	/* The objcore holds a reference on oh for us */
+	assert(HSH_DerefObjHead(wrk, &oh));
+	return (oc);
+}
+
+/*---------------------------------------------------------------------
+ * Look for a fresh hit without the objhead lock.
+ *
+ * The objhead is found with the ->peek method and oh->objcs is scanned
+ * inside an epoch read section, which keeps both the objhead and any
+ * objcore we may stumble upon in memory.  A reference is only taken on
+ * an objcore which is not on its way out, and everything which
+ * requires a decision under the lock, busy objects, stale or banned
+ * objects, hit-for-pass and misses, is left to HSH_Lookup().
+ */
+
+static struct objcore *
+hsh_lookup_nolock(struct worker *wrk, struct req *req)
+{
+	struct hsh_epoch *ep;
+	struct objhead *oh;
+	struct objcore *oc, *noc, *hit;
+	const uint8_t *vary;
+	unsigned idx, gen, n;
+	int r;
+
+	hit = NULL;
+	ep = HSH_EpochEnter(wrk, &idx);
+	oh = hash->peek(wrk, req->digest);
+	if (oh == NULL || oh->vidx != NULL) {
+		HSH_EpochExit(ep, idx);
+		return (NULL);
+	}
+	gen = oh->objcs_gen;
+	VRMB();
+	oc = (gen & 1) ? NULL : VTAILQ_FIRST(&oh->objcs);
+	for (n = 0; oc != NULL && n < HSH_NOLOCK_MAXSCAN; n++, oc = noc) {
+		noc = VTAILQ_NEXT(oc, hsh_list);
+		VRMB();
+		if (oh->objcs_gen != gen)
+			break;
+		if (oc->flags & (OC_F_BUSY | OC_F_DYING | OC_F_FAILED) ||
+		    oc->ttl <= 0.)
+			continue;
+
+		/* Gain a reference, unless it is already going away */
+		do
+			r = oc->refcnt;
+		while (r > 0 && !VATOMIC_CAS(&oc->refcnt, r, r + 1));
+		if (r == 0)
+			break;
+
+		hit = oc;
+		if (oh->objcs_gen != gen ||
+		    oc->flags & (OC_F_DYING | OC_F_HFP | OC_F_PASS)) {
+			(void)HSH_DerefObjCore(wrk, &hit, 0);
+			break;
+		}
+		if (ObjHasAttr(wrk, oc, OA_VARY)) {
+			vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+			AN(vary);
+			if (!VRY_Match(req, vary)) {
+				(void)HSH_DerefObjCore(wrk, &hit, 0);
+				continue;
+			}
+		}
+		if (!BAN_Current(oc) || EXP_Ttl(req, oc) < req->t_req)
+			(void)HSH_DerefObjCore(wrk, &hit, 0);
+		else if (oc->hits < LONG_MAX)
+			(void)VATOMIC_INC(&oc->hits);
+		break;
+	}
+	HSH_EpochExit(ep, idx);
+	return (hit);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -344,8 +740,11 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	struct objhead *oh;
 	struct objcore *oc;
 	struct objcore *exp_oc;
+	struct objcore *hit_oc;
+	struct hsh_objcs *lists[1 + HSH_VIDX_NSPEC];
 	double exp_t_origin;
 	int busy_found;
+	unsigned l, nlist;
 	enum lookup_e retval;
 	const uint8_t *vary;
 
@@ -364,6 +763,18 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	if (DO_DEBUG(DBG_HASHEDGE))
 		hsh_testmagic(req->digest);
 
+	if (!always_insert && req->hash_objhead == NULL &&
+	    hash->peek != NULL && cache_param->hash_nolock) {
+		if (!hsh_cool_on)
+			hsh_cool_start();
+		oc = hsh_lookup_nolock(wrk, req);
+		if (oc != NULL) {
+			wrk->stats->hsh_nolock++;
+			*ocp = oc;
+			return (HSH_HIT);
+		}
+	}
+
 	if (req->hash_objhead != NULL) {
 		/*
 		 * This req came off the waiting list, and brings an
@@ -371,7 +782,14 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		 */
 		CHECK_OBJ_NOTNULL(req->hash_objhead, OBJHEAD_MAGIC);
 		oh = req->hash_objhead;
-		Lck_Lock(&oh->mtx);
+		if (req->hash_oc != NULL) {
+			oc = hsh_handoff(wrk, req);
+			if (oc != NULL) {
+				*ocp = oc;
+				return (HSH_HIT);
+			}
+		}
+		Lck_Lock(HSH_Mtx(oh));
 		req->hash_objhead = NULL;
 	} else {
 		AN(wrk->nobjhead);
@@ -379,14 +797,14 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	}
 
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_AssertHeld(&oh->mtx);
+	Lck_AssertHeld(HSH_Mtx(oh));
 
 	if (always_insert) {
 		/* XXX: should we do predictive Vary in this case ? */
 		/* Insert new objcore in objecthead and release mutex */
 		*bocp = hsh_insert_busyobj(wrk, oh);
 		/* NB: no deref of objhead, new object inherits reference */
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 		return (HSH_MISS);
 	}
 
@@ -394,7 +812,10 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	busy_found = 0;
 	exp_oc = NULL;
 	exp_t_origin = 0.0;
-	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
+	hit_oc = NULL;
+	nlist = hsh_vidx_lookup(req, oh, lists);
+	for (l = 0; l < nlist; l++) {
+	    VTAILQ_FOREACH(oc, lists[l], hsh_list) {
 		/* Must be at least our own ref + the objcore we examine */
 		assert(oh->refcnt > 1);
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -437,31 +858,14 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		}
 
 		if (EXP_Ttl(req, oc) >= req->t_req) {
-			/* If still valid, use it */
-			assert(oh->refcnt > 1);
-			assert(oc->objhead == oh);
-			if (oc->flags & OC_F_HFP) {
-				wrk->stats->cache_hitpass++;
-				VSLb(req->vsl, SLT_HitPass, "%u %.6f",
-				    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
-				oc = NULL;
-			} else if (oc->flags & OC_F_PASS) {
-				wrk->stats->cache_hitmiss++;
-				VSLb(req->vsl, SLT_HitMiss, "%u %.6f",
-				    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
-				oc = NULL;
-				*bocp = hsh_insert_busyobj(wrk, oh);
-			} else {
-				oc->refcnt++;
-				if (oc->hits < LONG_MAX)
-					oc->hits++;
-			}
-			Lck_Unlock(&oh->mtx);
-			if (oc == NULL)
-				return (HSH_MISS);
-			assert(HSH_DerefObjHead(wrk, &oh));
-			*ocp = oc;
-			return (HSH_HIT);
+			/*
+			 * Each list is newest first, so the first valid
+			 * object is the one to use.  If the variant index
+			 * gave us more than one list, the newest wins.
+			 */
+			if (hit_oc == NULL || oc->t_origin > hit_oc->t_origin)
+				hit_oc = oc;
+			break;
 		}
 		if (EXP_Ttl(NULL, oc) < req->t_req && /* ignore req.ttl */
 		    oc->t_origin > exp_t_origin) {
@@ -469,6 +873,36 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 			exp_oc = oc;
 			exp_t_origin = oc->t_origin;
 		}
+	    }
+	}
+
+	if (hit_oc != NULL) {
+		oc = hit_oc;
+		/* If still valid, use it */
+		assert(oh->refcnt > 1);
+		assert(oc->objhead == oh);
+		if (oc->flags & OC_F_HFP) {
+			wrk->stats->cache_hitpass++;
+			VSLb(req->vsl, SLT_HitPass, "%u %.6f",
+			    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
+			oc = NULL;
+		} else if (oc->flags & OC_F_PASS) {
+			wrk->stats->cache_hitmiss++;
+			VSLb(req->vsl, SLT_HitMiss, "%u %.6f",
+			    ObjGetXID(wrk, oc), EXP_Dttl(req, oc));
+			oc = NULL;
+			*bocp = hsh_insert_busyobj(wrk, oh);
+		} else {
+			(void)VATOMIC_INC(&oc->refcnt);
+			if (oc->hits < LONG_MAX)
+				(void)VATOMIC_INC(&oc->hits);
+		}
+		Lck_Unlock(HSH_Mtx(oh));
+		if (oc == NULL)
+			return (HSH_MISS);
+		assert(HSH_DerefObjHead(wrk, &oh));
+		*ocp = oc;
+		return (HSH_HIT);
 	}
 
 	if (exp_oc != NULL && exp_oc->flags & OC_F_PASS) {
@@ -482,7 +916,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	if (exp_oc != NULL) {
 		assert(oh->refcnt > 1);
 		assert(exp_oc->objhead == oh);
-		exp_oc->refcnt++;
+		(void)VATOMIC_INC(&exp_oc->refcnt);
 
 		if (!busy_found) {
 			*bocp = hsh_insert_busyobj(wrk, oh);
@@ -492,8 +926,8 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 			retval = HSH_EXP;
 		}
 		if (exp_oc->hits < LONG_MAX)
-			exp_oc->hits++;
-		Lck_Unlock(&oh->mtx);
+			(void)VATOMIC_INC(&exp_oc->hits);
+		Lck_Unlock(HSH_Mtx(oh));
 		if (retval == HSH_EXP)
 			assert(HSH_DerefObjHead(wrk, &oh));
 		*ocp = exp_oc;
@@ -504,7 +938,7 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		/* Insert objcore in objecthead and release mutex */
 		*bocp = hsh_insert_busyobj(wrk, oh);
 		/* NB: no deref of objhead, new object inherits reference */
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 		return (HSH_MISS);
 	}
 
@@ -517,6 +951,18 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 		VSLb(req->vsl, SLT_Debug, "on waiting list <%p>", oh);
 
 	wrk->stats->busy_sleep++;
+	req->t_wait = W_TIM_real(wrk);
+	oh->nwaiting++;
+	if (oh->nwaiting <= 10)
+		wrk->stats->busy_depth_10++;
+	else if (oh->nwaiting <= 100)
+		wrk->stats->busy_depth_100++;
+	else if (oh->nwaiting <= 1000)
+		wrk->stats->busy_depth_1000++;
+	else if (oh->nwaiting <= 10000)
+		wrk->stats->busy_depth_10000++;
+	else
+		wrk->stats->busy_depth_more++;
 	/*
 	 * The objhead reference transfers to the sess, we get it
 	 * back when the sess comes off the waiting list and
@@ -525,31 +971,92 @@ HSH_Lookup(struct req *req, struct objcore **ocp, struct objcore **bocp,
 	req->hash_objhead = oh;
 	req->wrk = NULL;
 	req->waitinglist = 1;
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 	return (HSH_BUSY);
 }
 
+/*---------------------------------------------------------------------
+ * Adaptive rush: size the wakeup from the number of waiters and how
+ * long the oldest of them has waited.  Half of them go once that is
+ * rush_adaptive seconds, more the longer it has been, but never fewer
+ * than rush_exponent.
+ */
+
+static int
+hsh_rush_adaptive(const struct objhead *oh, double now)
+{
+	const struct req *req;
+	double age;
+	int max;
+
+	max = cache_param->rush_exponent;
+	req = VTAILQ_FIRST(&oh->waitinglist);
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	age = now - req->t_wait;
+	if (age <= 0.)
+		return (max);
+	age = oh->nwaiting * age / (age + cache_param->rush_adaptive);
+	if (age > max)
+		max = age > INT_MAX ? INT_MAX : (int)age;
+	return (max);
+}
+
+/*
+ * Can this waiter be handed the object which was just unbusied, rather
+ * than repeat the lookup ?
+ */
+
+static int
+hsh_rush_handoff(struct worker *wrk, struct objcore *oc, struct req *req)
+{
+	const uint8_t *vary;
+
+	if (oc->flags & (OC_F_PRIVATE | OC_F_HFP | OC_F_PASS | OC_F_FAILED |
+	    OC_F_DYING))
+		return (0);
+	if (oc->ttl <= 0. || req->hash_ignore_busy)
+		return (0);
+	if (ObjHasAttr(wrk, oc, OA_VARY)) {
+		vary = ObjGetAttr(wrk, oc, OA_VARY, NULL);
+		AN(vary);
+		if (!VRY_Match(req, vary))
+			return (0);
+	}
+	return (1);
+}
+
 /*---------------------------------------------------------------------
  * Pick the req's we are going to rush from the waiting list
  */
 
 static void
-hsh_rush1(const struct worker *wrk, struct objhead *oh, struct rush *r, int max)
+hsh_rush1(struct worker *wrk, struct objhead *oh, struct objcore *oc,
+    struct rush *r, int max)
 {
 	unsigned u;
 	struct req *req;
+	double now, w;
 
 	if (max == 0)
 		return;
-	if (max == HSH_RUSH_POLICY)
-		max = cache_param->rush_exponent;
-	assert(max > 0);
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(r, RUSH_MAGIC);
 	VTAILQ_INIT(&r->reqs);
-	Lck_AssertHeld(&oh->mtx);
+	Lck_AssertHeld(HSH_Mtx(oh));
+
+	now = VTIM_real();
+	if (cache_param->rush_adaptive == 0.)
+		oc = NULL;
+	if (max == HSH_RUSH_POLICY && cache_param->rush_adaptive > 0. &&
+	    !VTAILQ_EMPTY(&oh->waitinglist))
+		max = hsh_rush_adaptive(oh, now);
+	else if (max == HSH_RUSH_POLICY)
+		max = cache_param->rush_exponent;
+	assert(max > 0);
+
 	for (u = 0; u < max; u++) {
 		req = VTAILQ_FIRST(&oh->waitinglist);
 		if (req == NULL)
@@ -560,6 +1067,27 @@ hsh_rush1(const struct worker *wrk, struct objhead *oh, struct rush *r, int max)
 		VTAILQ_REMOVE(&oh->waitinglist, req, w_list);
 		VTAILQ_INSERT_TAIL(&r->reqs, req, w_list);
 		req->waitinglist = 0;
+		assert(oh->nwaiting > 0);
+		oh->nwaiting--;
+
+		w = now - req->t_wait;
+		if (w < 1e-3)
+			wrk->stats->busy_wait_1ms++;
+		else if (w < 1e-2)
+			wrk->stats->busy_wait_10ms++;
+		else if (w < 1e-1)
+			wrk->stats->busy_wait_100ms++;
+		else if (w < 1.)
+			wrk->stats->busy_wait_1s++;
+		else
+			wrk->stats->busy_wait_more++;
+
+		AZ(req->hash_oc);
+		if (oc != NULL && hsh_rush_handoff(wrk, oc, req)) {
+			(void)VATOMIC_INC(&oc->refcnt);
+			req->hash_oc = oc;
+			wrk->stats->busy_handoff++;
+		}
 	}
 }
 
@@ -594,7 +1122,8 @@ HSH_Purge(struct worker *wrk, struct objhead *oh, double ttl, double grace,
 double keep)
 {
 	struct objcore *oc, **ocp;
-	unsigned spc, ospc, nobj, n, n_tot = 0;
+	struct hsh_objcs *head;
+	unsigned spc, ospc, nobj, n, l, n_tot = 0;
 	int more = 0;
 	double now;
 
@@ -607,58 +1136,64 @@ double keep)
 	 * the OC_F_PURGED flag set. We do not want to let these slip through,
 	 * so we need to clear the flag before entering the do..while loop.
 	 */
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	assert(oh->refcnt > 0);
-	VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		assert(oc->objhead == oh);
-		oc->flags &= ~OC_F_PURGED;
+	for (l = 0; (head = hsh_vidx_list(oh, l)) != NULL; l++) {
+		VTAILQ_FOREACH(oc, head, hsh_list) {
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			assert(oc->objhead == oh);
+			oc->flags &= ~OC_F_PURGED;
+		}
 	}
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 
 	do {
 		more = 0;
 		spc = ospc;
 		nobj = 0;
 		ocp = (void*)wrk->aws->f;
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 		assert(oh->refcnt > 0);
 		now = VTIM_real();
-		VTAILQ_FOREACH(oc, &oh->objcs, hsh_list) {
-			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-			assert(oc->objhead == oh);
-			if (oc->flags & OC_F_BUSY) {
-				/*
-				 * We cannot purge busy objects here, because
-				 * their owners have special rights to them,
-				 * and may nuke them without concern for the
-				 * refcount, which by definition always must
-				 * be one, so they don't check.
-				 */
-				continue;
+		for (l = 0; !more &&
+		    (head = hsh_vidx_list(oh, l)) != NULL; l++) {
+			VTAILQ_FOREACH(oc, head, hsh_list) {
+				CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+				assert(oc->objhead == oh);
+				if (oc->flags & OC_F_BUSY) {
+					/*
+					 * We cannot purge busy objects here,
+					 * because their owners have special
+					 * rights to them, and may nuke them
+					 * without concern for the refcount,
+					 * which by definition always must be
+					 * one, so they don't check.
+					 */
+					continue;
+				}
+				if (oc->flags & OC_F_DYING)
+					continue;
+				if (oc->flags & OC_F_PURGED) {
+					/*
+					 * We have already called EXP_Rearm
+					 * on this object, and we do not want
+					 * to do it again. Plus the space in
+					 * the ocp array may be limited.
+					 */
+					continue;
+				}
+				if (spc < sizeof *ocp) {
+					/* Iterate if aws is not big enough */
+					more = 1;
+					break;
+				}
+				(void)VATOMIC_INC(&oc->refcnt);
+				spc -= sizeof *ocp;
+				ocp[nobj++] = oc;
+				oc->flags |= OC_F_PURGED;
 			}
-			if (oc->flags & OC_F_DYING)
-				continue;
-			if (oc->flags & OC_F_PURGED) {
-				/*
-				 * We have already called EXP_Rearm on this
-				 * object, and we do not want to do it
-				 * again. Plus the space in the ocp array may
-				 * be limited.
-				 */
-				continue;
-			}
-			if (spc < sizeof *ocp) {
-				/* Iterate if aws is not big enough */
-				more = 1;
-				break;
-			}
-			oc->refcnt++;
-			spc -= sizeof *ocp;
-			ocp[nobj++] = oc;
-			oc->flags |= OC_F_PURGED;
 		}
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 
 		for (n = 0; n < nobj; n++) {
 			oc = ocp[n];
@@ -693,9 +1228,9 @@ HSH_Fail(struct objcore *oc)
 	 */
 	assert((oc->flags & OC_F_BUSY) || (oc->stobj->stevedore != NULL));
 
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	oc->flags |= OC_F_FAILED;
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 }
 
 /*---------------------------------------------------------------------
@@ -711,9 +1246,9 @@ HSH_Abandon(struct objcore *oc)
 	oh = oc->objhead;
 	CHECK_OBJ(oh, OBJHEAD_MAGIC);
 
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	oc->flags |= OC_F_ABANDON;
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 }
 
 /*---------------------------------------------------------------------
@@ -743,18 +1278,23 @@ HSH_Unbusy(struct worker *wrk, struct objcore *oc)
 	}
 
 	/* XXX: pretouch neighbors on oh->objcs to prevent page-on under mtx */
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	assert(oh->refcnt > 0);
 	assert(oc->refcnt > 0);
 	if (!(oc->flags & OC_F_PRIVATE))
-		oc->refcnt++;			// For EXP_Insert
+		(void)VATOMIC_INC(&oc->refcnt);	// For EXP_Insert
 	/* XXX: strictly speaking, we should sort in Date: order. */
+	hsh_objcs_begin(oh);
 	VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
-	VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
 	oc->flags &= ~OC_F_BUSY;
+	if (!hsh_vidx_insert(wrk, oh, oc, 1))
+		VTAILQ_INSERT_HEAD(&oh->objcs, oc, hsh_list);
+	if (!(oc->flags & OC_F_PRIVATE))
+		hsh_vidx_check(wrk, oh);
+	hsh_objcs_end(oh);
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_POLICY);
-	Lck_Unlock(&oh->mtx);
+		hsh_rush1(wrk, oh, oc, &rush, HSH_RUSH_POLICY);
+	Lck_Unlock(HSH_Mtx(oh));
 	if (!(oc->flags & OC_F_PRIVATE))
 		EXP_Insert(wrk, oc);
 	hsh_rush2(wrk, &rush);
@@ -773,9 +1313,9 @@ HSH_Kill(struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 
-	Lck_Lock(&oc->objhead->mtx);
+	Lck_Lock(HSH_Mtx(oc->objhead));
 	oc->flags |= OC_F_DYING;
-	Lck_Unlock(&oc->objhead->mtx);
+	Lck_Unlock(HSH_Mtx(oc->objhead));
 	EXP_Remove(oc);
 }
 
@@ -794,19 +1334,84 @@ HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 
-	if (oc->refcnt == 1 && !Lck_Trylock(&oc->objhead->mtx)) {
-		if (oc->refcnt == 1 && !(oc->flags & OC_F_DYING)) {
+	if (oc->refcnt == 1 && !Lck_Trylock(HSH_Mtx(oc->objhead))) {
+		/*
+		 * Lockless lookups may gain a reference at any time, so
+		 * mark it dying before we check the refcount, they look
+		 * at the flags after they got their reference.
+		 */
+		if (!(oc->flags & OC_F_DYING)) {
 			oc->flags |= OC_F_DYING;
-			oc->refcnt++;
-			retval = 1;
+			if (VATOMIC_CAS(&oc->refcnt, 1, 2))
+				retval = 1;
+			else
+				oc->flags &= ~OC_F_DYING;
 		}
-		Lck_Unlock(&oc->objhead->mtx);
+		Lck_Unlock(HSH_Mtx(oc->objhead));
 	}
 	if (retval)
 		EXP_Remove(oc);
 	return (retval);
 }
 
+/*====================================================================
+ * HSH_Grab()
+ *
+ * If objcore is idle, gain a ref on it, but leave it alive.
+ */
+
+int
+HSH_Grab(const struct worker *wrk, struct objcore *oc)
+{
+	int retval = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+
+	if (oc->refcnt == 1 && oc->boc == NULL &&
+	    !Lck_Trylock(HSH_Mtx(oc->objhead))) {
+		if (!(oc->flags & (OC_F_BUSY | OC_F_DYING | OC_F_FAILED)) &&
+		    VATOMIC_CAS(&oc->refcnt, 1, 2))
+			retval = 1;
+		Lck_Unlock(HSH_Mtx(oc->objhead));
+	}
+	return (retval);
+}
+
+/*====================================================================
+ * HSH_Exclusive()
+ *
+ * Call func on an objcore we hold a ref on, provided ours and the one
+ * of the expiry are the only refs, so that nobody is looking at its
+ * storage.  The refcount is held at zero meanwhile, which keeps lockless
+ * lookups from gaining a ref, they fall back to the objhead lock, and
+ * we hold that.
+ */
+
+int
+HSH_Exclusive(struct objcore *oc, hsh_exclusive_f *func, void *priv)
+{
+	struct objhead *oh;
+	int retval = 0;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(func);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+	Lck_Lock(HSH_Mtx(oh));
+	if (!(oc->flags &
+	    (OC_F_BUSY | OC_F_DYING | OC_F_FAILED | OC_F_PRIVATE)) &&
+	    oc->boc == NULL && VATOMIC_CAS(&oc->refcnt, 2, 0)) {
+		func(oc, priv);
+		AN(VATOMIC_CAS(&oc->refcnt, 0, 2));
+		retval = 1;
+	}
+	Lck_Unlock(HSH_Mtx(oh));
+	return (retval);
+}
+
 
 /*---------------------------------------------------------------------
  * Gain a reference on an objcore
@@ -815,15 +1420,11 @@ HSH_Snipe(const struct worker *wrk, struct objcore *oc)
 void
 HSH_Ref(struct objcore *oc)
 {
-	struct objhead *oh;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-	oh = oc->objhead;
-	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_Lock(&oh->mtx);
-	assert(oc->refcnt > 0);
-	oc->refcnt++;
-	Lck_Unlock(&oh->mtx);
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	/* We already hold a reference, so it cannot be the last one */
+	assert(VATOMIC_INC(&oc->refcnt) > 1);
 }
 
 /*---------------------------------------------------------------------
@@ -841,7 +1442,7 @@ HSH_RefBoc(const struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	if (oc->boc == NULL)
 		return (NULL);
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	assert(oc->refcnt > 0);
 	boc = oc->boc;
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
@@ -852,7 +1453,7 @@ HSH_RefBoc(const struct objcore *oc)
 		else
 			boc = NULL;
 	}
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 	return (boc);
 }
 
@@ -866,13 +1467,13 @@ HSH_DerefBoc(struct worker *wrk, struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	boc = oc->boc;
 	CHECK_OBJ_NOTNULL(boc, BOC_MAGIC);
-	Lck_Lock(&oc->objhead->mtx);
+	Lck_Lock(HSH_Mtx(oc->objhead));
 	assert(oc->refcnt > 0);
 	assert(boc->refcount > 0);
 	r = --boc->refcount;
 	if (r == 0)
 		oc->boc = NULL;
-	Lck_Unlock(&oc->objhead->mtx);
+	Lck_Unlock(HSH_Mtx(oc->objhead));
 	if (r == 0)
 		ObjBocDone(wrk, oc, &boc);
 }
@@ -903,14 +1504,29 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 	oh = oc->objhead;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 
-	Lck_Lock(&oh->mtx);
+	/*
+	 * Unless this is the last reference, or there are requests to
+	 * rush, there is no need for the objhead lock.  A reference
+	 * never drops to zero without it.
+	 */
+	if (VTAILQ_EMPTY(&oh->waitinglist)) {
+		while ((r = oc->refcnt) > 1)
+			if (VATOMIC_CAS(&oc->refcnt, r, r - 1))
+				return (r - 1);
+	}
+
+	Lck_Lock(HSH_Mtx(oh));
 	assert(oh->refcnt > 0);
-	r = --oc->refcnt;
-	if (!r)
-		VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
+	r = VATOMIC_DEC(&oc->refcnt);
+	if (!r) {
+		hsh_objcs_begin(oh);
+		if (!hsh_vidx_remove(wrk, oh, oc))
+			VTAILQ_REMOVE(&oh->objcs, oc, hsh_list);
+		hsh_objcs_end(oh);
+	}
 	if (!VTAILQ_EMPTY(&oh->waitinglist))
-		hsh_rush1(wrk, oh, &rush, rushmax);
-	Lck_Unlock(&oh->mtx);
+		hsh_rush1(wrk, oh, NULL, &rush, rushmax);
+	Lck_Unlock(HSH_Mtx(oh));
 	hsh_rush2(wrk, &rush);
 	if (r != 0)
 		return (r);
@@ -922,7 +1538,15 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 
 	if (oc->stobj->stevedore != NULL)
 		ObjFreeObj(wrk, oc);
-	ObjDestroy(wrk, &oc);
+	/* Pairs with hsh_cool_start(), see there */
+	VMB();
+	if (hsh_cool_on && oh != private_oh) {
+		/* Lockless lookups may still be looking at it */
+		Lck_Lock(&hsh_cool_mtx);
+		VTAILQ_INSERT_TAIL(&hsh_cool, oc, hsh_list);
+		Lck_Unlock(&hsh_cool_mtx);
+	} else
+		ObjDestroy(wrk, &oc);
 
 	/* Drop our ref on the objhead */
 	assert(oh->refcnt > 0);
@@ -943,10 +1567,10 @@ HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 
 	if (oh == private_oh) {
 		assert(VTAILQ_EMPTY(&oh->waitinglist));
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 		assert(oh->refcnt > 1);
 		oh->refcnt--;
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 		return(1);
 	}
 
@@ -958,14 +1582,14 @@ HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 	 * just make the hold the same ref's as objcore, that would
 	 * confuse hashers.
 	 */
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	while (oh->refcnt == 1 && !VTAILQ_EMPTY(&oh->waitinglist)) {
-		hsh_rush1(wrk, oh, &rush, HSH_RUSH_ALL);
-		Lck_Unlock(&oh->mtx);
+		hsh_rush1(wrk, oh, NULL, &rush, HSH_RUSH_ALL);
+		Lck_Unlock(HSH_Mtx(oh));
 		hsh_rush2(wrk, &rush);
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 	}
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 
 	assert(oh->refcnt > 0);
 	r = hash->deref(oh);
@@ -974,14 +1598,73 @@ HSH_DerefObjHead(struct worker *wrk, struct objhead **poh)
 	return (r);
 }
 
+/*---------------------------------------------------------------------
+ * Free the objcores which lockless lookups could still have seen,
+ * once they are done.
+ *
+ * Until hash_nolock is first used, objcores are destroyed right away,
+ * and there is no point in the cleaner.  The first lockless lookup
+ * starts it, and from then on dead objcores go to the cleaner until
+ * the child is restarted.  Either HSH_DerefObjCore() sees
+ * hsh_cool_on after unlinking the objcore, or that lookup cannot
+ * have found it, hence the barriers on both sides.
+ */
+
+static void * __match_proto__(bgthread_t)
+hsh_cleaner(struct worker *wrk, void *priv)
+{
+	struct hsh_objcs dead;
+	struct objcore *oc;
+
+	(void)priv;
+	while (1) {
+		VTAILQ_INIT(&dead);
+		Lck_Lock(&hsh_cool_mtx);
+		VTAILQ_CONCAT(&dead, &hsh_cool, hsh_list);
+		Lck_Unlock(&hsh_cool_mtx);
+		if (!VTAILQ_EMPTY(&dead))
+			HSH_EpochSync();
+		while ((oc = VTAILQ_FIRST(&dead)) != NULL) {
+			VTAILQ_REMOVE(&dead, oc, hsh_list);
+			ObjDestroy(wrk, &oc);
+		}
+		Pool_Sumstat(wrk);
+		VTIM_sleep(HSH_CLEAN_INTERVAL);
+	}
+	NEEDLESS(return NULL);
+}
+
+static void
+hsh_cool_start(void)
+{
+	pthread_t tp;
+
+	Lck_Lock(&hsh_cool_mtx);
+	if (!hsh_cool_on) {
+		WRK_BgThread(&tp, "hsh-cleaner", hsh_cleaner, NULL);
+		hsh_cool_on = 1;
+	}
+	Lck_Unlock(&hsh_cool_mtx);
+	VMB();
+}
+
 void
 HSH_Init(const struct hash_slinger *slinger)
 {
+	unsigned u;
 
 	assert(DIGEST_LEN == VSHA256_LEN);	/* avoid #include pollution */
+	for (u = 0; u < 1U << HSH_LCK_BITS; u++)
+		Lck_New(&hsh_lck[u], lck_objhdr);
+	mag_objhead = MAG_New("objhead", sizeof(struct objhead), NULL);
 	hash = slinger;
+	HSH_EpochInit();
 	if (hash->start != NULL)
 		hash->start();
 	private_oh = hsh_newobjhead();
 	private_oh->refcnt = 1;
+	if (hash->peek != NULL) {
+		lck_hsh = Lck_CreateClass("hsh");
+		Lck_New(&hsh_cool_mtx, lck_hsh);
+	}
 }
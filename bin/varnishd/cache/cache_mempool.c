@@ -37,6 +37,7 @@
 
 #include "vtim.h"
 
+#include "VSC_mag.h"
 #include "VSC_mempool.h"
 
 struct memitem {
@@ -343,3 +344,330 @@ MPL_AssertSane(const void *item)
 	mi = (void*)((uintptr_t)item - sizeof(*mi));
 	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
 }
+
+/*---------------------------------------------------------------------
+ * Magazines
+ *
+ * Each thread keeps two magazines of free items per class, and gets
+ * and frees items from and to those without any locking.  Only when
+ * both are empty, or both are full, does it swap one with the depot of
+ * the class, under its lock.  Items are allocated when the depot has no
+ * full magazine, and released when it has enough of them, see Bonwick
+ * and Adams, "Magazines and Vmem", USENIX 2001.
+ *
+ * Classes of variable size get their items from a mempool, which also
+ * acts as their depot, and keep a single item per magazine, since those
+ * items are large and a thread rarely needs more than one or two.
+ *
+ * Classes are never destroyed.
+ */
+
+#define MAG_NCLASS		8
+#define MAG_ROUNDS		32
+#define MAG_DEPOT		64
+
+struct magazine {
+	unsigned			magic;
+#define MAGAZINE_MAGIC			0x4d9d0b2c
+	unsigned			n;
+	VTAILQ_ENTRY(magazine)		list;
+	void				*item[];
+};
+
+VTAILQ_HEAD(maghead_s, magazine);
+
+struct magclass {
+	unsigned			magic;
+#define MAGCLASS_MAGIC			0x7c0a54e1
+	unsigned			idx;
+	unsigned			size;		/* 0: from mpl */
+	unsigned			rounds;
+	unsigned			max_full;
+	struct mempool			*mpl;
+	struct lock			mtx;
+	struct maghead_s		full;
+	struct maghead_s		empty;
+	unsigned			nfull;
+	struct VSC_mag			*vsc;
+};
+
+struct magslot {
+	struct magazine			*cur;
+	struct magazine			*prev;
+	uint64_t			hits;
+};
+
+struct magthread {
+	unsigned			magic;
+#define MAGTHREAD_MAGIC			0x2f3b61d5
+	struct magslot			slot[MAG_NCLASS];
+};
+
+static pthread_key_t mag_key;
+static struct magclass *mag_class[MAG_NCLASS];
+static unsigned mag_nclass;
+
+static struct magazine *
+mag_new(const struct magclass *mc)
+{
+	struct magazine *m;
+
+	m = calloc(1, sizeof *m + mc->rounds * sizeof m->item[0]);
+	AN(m);
+	m->magic = MAGAZINE_MAGIC;
+	return (m);
+}
+
+static unsigned
+mag_size(const struct magclass *mc, const void *item)
+{
+	const struct memitem *mi;
+
+	if (mc->mpl == NULL)
+		return (mc->size);
+	mi = (const void*)((uintptr_t)item - sizeof(*mi));
+	CHECK_OBJ_NOTNULL(mi, MEMITEM_MAGIC);
+	return (mi->size - sizeof *mi);
+}
+
+static void
+mag_release(const struct magclass *mc, void *item)
+{
+
+	if (mc->mpl != NULL)
+		MPL_Free(mc->mpl, item);
+	else
+		free(item);
+}
+
+static void
+mag_empty(const struct magclass *mc, struct magazine *m)
+{
+
+	CHECK_OBJ_NOTNULL(m, MAGAZINE_MAGIC);
+	while (m->n > 0)
+		mag_release(mc, m->item[--m->n]);
+}
+
+/*
+ * Hand back everything when a thread goes away.
+ */
+
+static void
+mag_thread_fini(void *priv)
+{
+	struct magthread *mt;
+	struct magclass *mc;
+	struct magslot *ms;
+	uint64_t n;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(mt, priv, MAGTHREAD_MAGIC);
+	for (u = 0; u < mag_nclass; u++) {
+		mc = mag_class[u];
+		CHECK_OBJ_NOTNULL(mc, MAGCLASS_MAGIC);
+		ms = &mt->slot[u];
+		n = 0;
+		if (ms->cur != NULL) {
+			n += ms->cur->n;
+			mag_empty(mc, ms->cur);
+			FREE_OBJ(ms->cur);
+		}
+		if (ms->prev != NULL) {
+			n += ms->prev->n;
+			mag_empty(mc, ms->prev);
+			FREE_OBJ(ms->prev);
+		}
+		Lck_Lock(&mc->mtx);
+		mc->vsc->hits += ms->hits;
+		mc->vsc->releases += n;
+		Lck_Unlock(&mc->mtx);
+	}
+	FREE_OBJ(mt);
+}
+
+static struct magslot *
+mag_slot(const struct magclass *mc)
+{
+	struct magthread *mt;
+
+	mt = pthread_getspecific(mag_key);
+	if (mt == NULL) {
+		ALLOC_OBJ(mt, MAGTHREAD_MAGIC);
+		AN(mt);
+		AZ(pthread_setspecific(mag_key, mt));
+	}
+	CHECK_OBJ(mt, MAGTHREAD_MAGIC);
+	return (&mt->slot[mc->idx]);
+}
+
+/*---------------------------------------------------------------------
+ * Create a class of items of a given size, or of the size of the items
+ * of a mempool.
+ */
+
+struct magclass *
+MAG_New(const char *name, unsigned size, struct mempool *mpl)
+{
+	struct magclass *mc;
+
+	AN(name);
+	assert((size > 0) != (mpl != NULL));
+	assert(mag_nclass < MAG_NCLASS);
+	if (mag_nclass == 0)
+		AZ(pthread_key_create(&mag_key, mag_thread_fini));
+
+	ALLOC_OBJ(mc, MAGCLASS_MAGIC);
+	AN(mc);
+	mc->idx = mag_nclass;
+	mc->size = size;
+	mc->mpl = mpl;
+	if (mpl != NULL) {
+		CHECK_OBJ(mpl, MEMPOOL_MAGIC);
+		mc->rounds = 1;
+		mc->max_full = 0;
+	} else {
+		mc->rounds = MAG_ROUNDS;
+		mc->max_full = MAG_DEPOT;
+	}
+	VTAILQ_INIT(&mc->full);
+	VTAILQ_INIT(&mc->empty);
+	Lck_New(&mc->mtx, lck_mempool);
+	mc->vsc = VSC_mag_New(name);
+	AN(mc->vsc);
+	mag_class[mag_nclass++] = mc;
+	return (mc);
+}
+
+/*---------------------------------------------------------------------
+ * Get a zeroed item.
+ */
+
+static void *
+mag_pop(struct magclass *mc, struct magslot *ms)
+{
+	struct magazine *m;
+
+	if (ms->cur != NULL && ms->cur->n > 0) {
+		ms->hits++;
+		return (ms->cur->item[--ms->cur->n]);
+	}
+	if (ms->prev != NULL && ms->prev->n > 0) {
+		m = ms->prev;
+		ms->prev = ms->cur;
+		ms->cur = m;
+		ms->hits++;
+		return (ms->cur->item[--ms->cur->n]);
+	}
+
+	/* Both empty, trade one for a full one */
+	Lck_Lock(&mc->mtx);
+	mc->vsc->hits += ms->hits;
+	ms->hits = 0;
+	mc->vsc->misses++;
+	m = VTAILQ_FIRST(&mc->full);
+	if (m != NULL) {
+		VTAILQ_REMOVE(&mc->full, m, list);
+		mc->vsc->depot = --mc->nfull;
+		if (ms->prev != NULL)
+			VTAILQ_INSERT_HEAD(&mc->empty, ms->prev, list);
+		ms->prev = ms->cur;
+		ms->cur = m;
+	} else
+		mc->vsc->allocs++;
+	Lck_Unlock(&mc->mtx);
+	if (m == NULL)
+		return (NULL);
+	CHECK_OBJ(m, MAGAZINE_MAGIC);
+	assert(m->n == mc->rounds);
+	return (m->item[--m->n]);
+}
+
+void *
+MAG_Get(struct magclass *mc, unsigned *size)
+{
+	struct magslot *ms;
+	void *item;
+	unsigned sz;
+
+	CHECK_OBJ_NOTNULL(mc, MAGCLASS_MAGIC);
+	ms = mag_slot(mc);
+
+	while (1) {
+		item = mag_pop(mc, ms);
+		if (item == NULL || mc->mpl == NULL ||
+		    mag_size(mc, item) >= *mc->mpl->cur_size)
+			break;
+		/* workspace parameters grew */
+		mag_release(mc, item);
+	}
+	/* Fresh ones come zeroed, those from a magazine have been used */
+	if (item != NULL)
+		memset(item, 0, mag_size(mc, item));
+	else if (mc->mpl != NULL)
+		item = MPL_Get(mc->mpl, &sz);
+	else
+		item = calloc(1, mc->size);
+	AN(item);
+	if (size != NULL)
+		*size = mag_size(mc, item);
+	return (item);
+}
+
+/*---------------------------------------------------------------------
+ * Free an item.
+ */
+
+void
+MAG_Free(struct magclass *mc, void *item)
+{
+	struct magslot *ms;
+	struct magazine *m, *rel = NULL;
+
+	CHECK_OBJ_NOTNULL(mc, MAGCLASS_MAGIC);
+	AN(item);
+	ms = mag_slot(mc);
+
+	if (ms->cur != NULL && ms->cur->n < mc->rounds) {
+		ms->cur->item[ms->cur->n++] = item;
+		return;
+	}
+	if (ms->prev != NULL && ms->prev->n < mc->rounds) {
+		m = ms->prev;
+		ms->prev = ms->cur;
+		ms->cur = m;
+		ms->cur->item[ms->cur->n++] = item;
+		return;
+	}
+
+	/* Both full, trade one for an empty one */
+	Lck_Lock(&mc->mtx);
+	mc->vsc->hits += ms->hits;
+	ms->hits = 0;
+	m = VTAILQ_FIRST(&mc->empty);
+	if (m != NULL)
+		VTAILQ_REMOVE(&mc->empty, m, list);
+	if (ms->prev != NULL && mc->nfull < mc->max_full) {
+		VTAILQ_INSERT_HEAD(&mc->full, ms->prev, list);
+		mc->vsc->depot = ++mc->nfull;
+	} else if (ms->prev != NULL) {
+		rel = ms->prev;
+		mc->vsc->releases += rel->n;
+	}
+	Lck_Unlock(&mc->mtx);
+
+	ms->prev = ms->cur;
+	if (rel != NULL) {
+		mag_empty(mc, rel);
+		if (m == NULL)
+			m = rel;
+		else
+			FREE_OBJ(rel);
+	}
+	if (m == NULL)
+		m = mag_new(mc);
+	CHECK_OBJ(m, MAGAZINE_MAGIC);
+	AZ(m->n);
+	ms->cur = m;
+	ms->cur->item[ms->cur->n++] = item;
+}
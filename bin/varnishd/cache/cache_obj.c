@@ -76,7 +76,7 @@
  *
  * 4->5	ObjFreeObj()	disassociates stevedore
  *
- * 5->6 FREE_OBJ()	...in HSH_DerefObjCore()
+ * 5->6 ObjDestroy()	...in HSH_DerefObjCore()
  */
 
 #include "config.h"
@@ -88,6 +88,9 @@
 #include "vend.h"
 #include "storage/storage.h"
 
+static struct magclass *mag_objcore;
+static struct magclass *mag_boc;
+
 static const struct obj_methods *
 obj_getmethods(const struct objcore *oc)
 {
@@ -103,11 +106,13 @@ obj_newboc(void)
 {
 	struct boc *boc;
 
-	ALLOC_OBJ(boc, BOC_MAGIC);
+	boc = MAG_Get(mag_boc, NULL);
 	AN(boc);
+	boc->magic = BOC_MAGIC;
 	Lck_New(&boc->mtx, lck_busyobj);
 	AZ(pthread_cond_init(&boc->cond, NULL));
 	boc->refcount = 1;
+	boc->len_estimate = -1;
 	return (boc);
 }
 
@@ -123,7 +128,7 @@ obj_deleteboc(struct boc **p)
 	AZ(pthread_cond_destroy(&boc->cond));
 	if (boc->vary != NULL)
 		free(boc->vary);
-	FREE_OBJ(boc);
+	MAG_Free(mag_boc, boc);
 }
 
 /*====================================================================
@@ -138,9 +143,11 @@ ObjNew(const struct worker *wrk)
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
-	ALLOC_OBJ(oc, OBJCORE_MAGIC);
+	oc = MAG_Get(mag_objcore, NULL);
 	AN(oc);
+	oc->magic = OBJCORE_MAGIC;
 	wrk->stats->n_objectcore++;
+	wrk->stats->objmeta_bytes += sizeof *oc;
 	oc->last_lru = NAN;
 	oc->flags = OC_F_BUSY;
 
@@ -163,8 +170,9 @@ ObjDestroy(const struct worker *wrk, struct objcore **p)
 	TAKE_OBJ_NOTNULL(oc, p, OBJCORE_MAGIC);
 	if (oc->boc != NULL)
 		obj_deleteboc(&oc->boc);
-	FREE_OBJ(oc);
+	MAG_Free(mag_objcore, oc);
 	wrk->stats->n_objectcore--;
+	wrk->stats->objmeta_bytes -= sizeof *oc;
 }
 
 /*====================================================================
@@ -738,6 +746,8 @@ ObjSendEvent(struct worker *wrk, struct objcore *oc, unsigned event)
 void
 ObjInit(void)
 {
+	mag_objcore = MAG_New("objcore", sizeof(struct objcore), NULL);
+	mag_boc = MAG_New("boc", sizeof(struct boc), NULL);
 	VTAILQ_INIT(&oev_list);
 	AZ(pthread_rwlock_init(&oev_rwl, NULL));
 }
@@ -29,16 +29,19 @@
  */
 
 struct hash_slinger;
+struct hsh_vidx;
 
 struct objhead {
 	unsigned		magic;
 #define OBJHEAD_MAGIC		0x1b96615d
 
 	int			refcnt;
-	struct lock		mtx;
-	VTAILQ_HEAD(,objcore)	objcs;
+	VTAILQ_HEAD(hsh_objcs, objcore)	objcs;
+	volatile unsigned	objcs_gen;	/* odd while objcs changes */
+	unsigned		nwaiting;
 	uint8_t			digest[DIGEST_LEN];
 	VTAILQ_HEAD(, req)	waitinglist;
+	struct hsh_vidx		*vidx;
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
@@ -54,12 +57,34 @@ struct objhead {
 #define hoh_head _u.n.u_n_hoh_head
 };
 
+/*
+ * Objheads have no mutex of their own, they share the ones in hsh_lck[],
+ * picked by a hash of their address.  This saves a lock allocation per
+ * objhead, at the price that nobody may hold the mutexes of two objheads
+ * at the same time.
+ */
+
+#define HSH_LCK_BITS		13
+extern struct lock hsh_lck[1 << HSH_LCK_BITS];
+
+static inline struct lock *
+HSH_Mtx(const struct objhead *oh)
+{
+	uint64_t u;
+
+	u = (uintptr_t)oh;
+	return (&hsh_lck[(u * 0x9e3779b97f4a7c15ULL) >> (64 - HSH_LCK_BITS)]);
+}
+
 void HSH_Fail(struct objcore *);
 void HSH_Kill(struct objcore *);
 void HSH_Insert(struct worker *, const void *hash, struct objcore *,
     struct ban *);
 void HSH_Unbusy(struct worker *, struct objcore *);
 int HSH_Snipe(const struct worker *, struct objcore *);
+int HSH_Grab(const struct worker *, struct objcore *);
+typedef void hsh_exclusive_f(struct objcore *, void *priv);
+int HSH_Exclusive(struct objcore *, hsh_exclusive_f *, void *priv);
 struct boc *HSH_RefBoc(const struct objcore *);
 void HSH_DerefBoc(struct worker *wrk, struct objcore *);
 void HSH_DeleteObjHead(const struct worker *, struct objhead *);
@@ -73,6 +98,10 @@ enum lookup_e HSH_Lookup(struct req *, struct objcore **, struct objcore **,
     int always_insert);
 void HSH_Ref(struct objcore *o);
 void HSH_AddString(struct req *, void *ctx, const char *str);
+struct VSHA256Context;
+void HSH_DigestInit(struct VSHA256Context *);
+void HSH_DigestUpdate(struct VSHA256Context *, const void *, size_t);
+void HSH_DigestFinal(unsigned char *, struct VSHA256Context *);
 unsigned HSH_Purge(struct worker *, struct objhead *, double ttl, double grace,
     double keep);
 struct objcore *HSH_Private(const struct worker *wrk);
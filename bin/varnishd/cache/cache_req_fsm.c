@@ -102,6 +102,24 @@ cnt_transport(struct worker *wrk, struct req *req)
 	return (REQ_FSM_MORE);
 }
 
+/*--------------------------------------------------------------------
+ * Does the body need gunzip'ing for this client.  Bodies which the
+ * storage gzip'ed on its own (OF_STVGZIP) still have the headers of the
+ * plain body, so they are gunzip'ed unless we send the client gzip.
+ */
+
+static int
+cnt_gunzip(struct req *req)
+{
+
+	if (!ObjCheckFlag(req->wrk, req->objcore, OF_GZIPED))
+		return (0);
+	if (cache_param->http_gzip_support && RFC2616_Req_Gzip(req->http))
+		return (0);
+	return (cache_param->http_gzip_support ||
+	    ObjCheckFlag(req->wrk, req->objcore, OF_STVGZIP));
+}
+
 /*--------------------------------------------------------------------
  * Deliver an object to client
  */
@@ -150,10 +168,14 @@ cnt_deliver(struct worker *wrk, struct req *req)
 
 	http_SetHeader(req->resp, "Via: 1.1 varnish (Varnish/5.2)");
 
-	if (cache_param->http_gzip_support &&
-	    ObjCheckFlag(req->wrk, req->objcore, OF_GZIPED) &&
-	    !RFC2616_Req_Gzip(req->http))
+	if (!ObjCheckFlag(req->wrk, req->objcore, OF_STVGZIP)) {
+		if (cnt_gunzip(req))
+			RFC2616_Weaken_Etag(req->resp);
+	} else if (!cnt_gunzip(req)) {
+		http_SetHeader(req->resp, "Content-Encoding: gzip");
+		RFC2616_Vary_AE(req->resp);
 		RFC2616_Weaken_Etag(req->resp);
+	}
 
 	VCL_deliver_method(req->vcl, wrk, req, NULL, NULL);
 	VSLb_ts_req(req, "Process", W_TIM_real(wrk));
@@ -369,9 +391,7 @@ cnt_transmit(struct worker *wrk, struct req *req)
 		    ObjHasAttr(wrk, req->objcore, OA_ESIDATA))
 			VDP_push(req, &VDP_esi, NULL, 0);
 
-		if (cache_param->http_gzip_support &&
-		    ObjCheckFlag(req->wrk, req->objcore, OF_GZIPED) &&
-		    !RFC2616_Req_Gzip(req->http))
+		if (cnt_gunzip(req))
 			VDP_push(req, &VDP_gunzip, NULL, 1);
 
 		if (cache_param->http_range_support &&
@@ -853,13 +873,13 @@ cnt_recv(struct worker *wrk, struct req *req)
 		}
 	}
 
-	VSHA256_Init(&sha256ctx);
+	HSH_DigestInit(&sha256ctx);
 	VCL_hash_method(req->vcl, wrk, req, NULL, &sha256ctx);
 	if (wrk->handling == VCL_RET_FAIL)
 		recv_handling = wrk->handling;
 	else
 		assert(wrk->handling == VCL_RET_LOOKUP);
-	VSHA256_Final(req->digest, &sha256ctx);
+	HSH_DigestFinal(req->digest, &sha256ctx);
 
 	switch (recv_handling) {
 	case VCL_RET_VCL:
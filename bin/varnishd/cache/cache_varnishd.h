@@ -86,6 +86,7 @@ void BAN_Shutdown(void);
 /* From cache_hash.c */
 void BAN_NewObjCore(struct objcore *oc);
 void BAN_DestroyObj(struct objcore *oc);
+int BAN_Current(const struct objcore *);
 int BAN_CheckObject(struct worker *, struct objcore *, struct req *);
 
 /* cache_busyobj.c */
@@ -197,6 +198,11 @@ void VSL_End(struct vsl_log *vsl);
 /* cache_vary.c */
 int VRY_Create(struct busyobj *bo, struct vsb **psb);
 int VRY_Match(struct req *, const uint8_t *vary);
+unsigned VRY_SpecLen(const uint8_t *vary);
+void VRY_Spec(const uint8_t *vary, uint8_t *spec);
+int VRY_SpecMatch(const uint8_t *vary, const uint8_t *spec);
+uint64_t VRY_Key(const uint8_t *vary);
+uint64_t VRY_ReqKey(const struct http *, const uint8_t *spec);
 void VRY_Prep(struct req *);
 void VRY_Clear(struct req *);
 enum vry_finish_flag { KEEP, DISCARD };
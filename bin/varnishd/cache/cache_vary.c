@@ -367,6 +367,127 @@ VRY_Match(struct req *req, const uint8_t *vary)
 	}
 }
 
+/**********************************************************************
+ * Variant index support
+ *
+ * The "spec" of a vary matching string is the sequence of its header
+ * names, in the same <len+1><header>:\0 format, terminated by a zero
+ * length byte.  The key is a hash over the header names and their
+ * contents, which can be computed both from a vary matching string and
+ * from a request, given the spec.
+ *
+ * Accept-Encoding contents never go into the key, so objects which
+ * vry_cmp() may consider equal always get the same key, whatever the
+ * setting of http_gzip_support.  Same key does not mean match, only
+ * VRY_Match() can tell.
+ */
+
+#define VRY_FNV_INIT	0xcbf29ce484222325ULL
+
+static uint64_t
+vry_fnv(uint64_t h, const void *ptr, unsigned len)
+{
+	const uint8_t *p = ptr;
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return (h);
+}
+
+static uint64_t
+vry_key_hdr(uint64_t h, const uint8_t *name, const char *val, unsigned l)
+{
+	uint8_t b[2];
+
+	h = vry_fnv(h, name, name[0] + 2);
+	if (!strcasecmp(H_Accept_Encoding, (const char *)name))
+		return (h);
+	vbe16enc(b, (uint16_t)l);
+	h = vry_fnv(h, b, sizeof b);
+	if (val != NULL)
+		h = vry_fnv(h, val, l);
+	return (h);
+}
+
+unsigned
+VRY_SpecLen(const uint8_t *vary)
+{
+	unsigned l = 1;
+
+	AN(vary);
+	for (; vary[2]; vary += VRY_Len(vary))
+		l += vary[2] + 2;
+	return (l);
+}
+
+void
+VRY_Spec(const uint8_t *vary, uint8_t *spec)
+{
+
+	AN(vary);
+	AN(spec);
+	for (; vary[2]; vary += VRY_Len(vary)) {
+		memcpy(spec, vary + 2, vary[2] + 2);
+		spec += vary[2] + 2;
+	}
+	*spec = 0;
+}
+
+int
+VRY_SpecMatch(const uint8_t *vary, const uint8_t *spec)
+{
+
+	AN(vary);
+	AN(spec);
+	for (; vary[2]; vary += VRY_Len(vary)) {
+		if (memcmp(spec, vary + 2, vary[2] + 2))
+			return (0);
+		spec += vary[2] + 2;
+	}
+	return (*spec == 0);
+}
+
+uint64_t
+VRY_Key(const uint8_t *vary)
+{
+	uint64_t h = VRY_FNV_INIT;
+	unsigned l;
+
+	AN(vary);
+	for (; vary[2]; vary += VRY_Len(vary)) {
+		l = vbe16dec(vary);
+		if (l == 0xffff)
+			h = vry_key_hdr(h, vary + 2, NULL, l);
+		else
+			h = vry_key_hdr(h, vary + 2,
+			    (const char *)vary + 2 + vary[2] + 2, l);
+	}
+	return (h);
+}
+
+uint64_t
+VRY_ReqKey(const struct http *hp, const uint8_t *spec)
+{
+	uint64_t h = VRY_FNV_INIT;
+	const char *v, *e;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	AN(spec);
+	for (; *spec; spec += spec[0] + 2) {
+		if (http_GetHdr(hp, (const char *)spec, &v)) {
+			/* Trim trailing space, same as VRY_Match() */
+			e = strchr(v, '\0');
+			while (e > v && vct_issp(e[-1]))
+				e--;
+			h = vry_key_hdr(h, spec, v, e - v);
+		} else
+			h = vry_key_hdr(h, spec, NULL, 0xffff);
+	}
+	return (h);
+}
+
 /*
  * Check the validity of a Vary string and return its total length
  */
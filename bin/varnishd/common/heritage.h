@@ -76,6 +76,8 @@ struct heritage {
 
 	/* Hash method */
 	const struct hash_slinger	*hash;
+	unsigned			hash_digest;
+	uint64_t			hash_seed[4];
 
 	struct params			*param;
 
@@ -0,0 +1,422 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Multi-threaded benchmark for the hash slingers.
+ *
+ * The slingers are linked in as is, with just enough of the locking
+ * and worker infrastructure stubbed out underneath them to run them
+ * outside varnishd.
+ *
+ * A number of objheads are inserted from a single thread first, and
+ * then each thread performs lookups of random existing digests, with
+ * a configurable share of inserts of new digests, which are dropped
+ * again immediately so the delete path is exercised as well.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+#include "vav.h"
+#include "vtim.h"
+
+static const struct choice {
+	const char			*name;
+	const struct hash_slinger	*slinger;
+} bench_choice[] = {
+	{ "classic",		&hcl_slinger },
+	{ "simple_list",	&hsl_slinger },
+	{ "critbit",		&hcb_slinger },
+	{ "critbit_rcu",	&hcr_slinger },
+	{ "swiss",		&hsw_slinger },
+	{ NULL,			NULL }
+};
+
+static const struct hash_slinger *hash;
+
+static unsigned bench_nobj = 1000000;
+static unsigned bench_nthread = 4;
+static unsigned bench_nop = 1000000;
+static unsigned bench_insert = 10;		/* per mille */
+
+/*--------------------------------------------------------------------
+ * Stubs for what the slingers need from the rest of varnishd
+ */
+
+struct heritage			heritage;
+struct VSC_main			*VSC_C_main;
+volatile struct params		*cache_param;
+struct VSC_lck			*lck_hcb;
+struct VSC_lck			*lck_objhdr;
+struct lock			hsh_lck[1 << HSH_LCK_BITS];
+
+static struct params		bench_param;
+static struct VSC_main		bench_vsc;
+
+struct bench_lock {
+	pthread_mutex_t		mtx;
+	pthread_t		owner;
+	int			held;
+};
+
+void
+Lck__New(struct lock *lck, struct VSC_lck *vsc, const char *w)
+{
+	struct bench_lock *bl;
+
+	(void)vsc;
+	(void)w;
+	bl = calloc(1, sizeof *bl);
+	AN(bl);
+	AZ(pthread_mutex_init(&bl->mtx, NULL));
+	lck->priv = bl;
+}
+
+void
+Lck__Lock(struct lock *lck, const char *p, int l)
+{
+	struct bench_lock *bl = lck->priv;
+
+	(void)p;
+	(void)l;
+	AZ(pthread_mutex_lock(&bl->mtx));
+	bl->owner = pthread_self();
+	bl->held = 1;
+}
+
+void
+Lck__Unlock(struct lock *lck, const char *p, int l)
+{
+	struct bench_lock *bl = lck->priv;
+
+	(void)p;
+	(void)l;
+	bl->held = 0;
+	AZ(pthread_mutex_unlock(&bl->mtx));
+}
+
+int
+Lck__Trylock(struct lock *lck, const char *p, int l)
+{
+	struct bench_lock *bl = lck->priv;
+	int r;
+
+	(void)p;
+	(void)l;
+	r = pthread_mutex_trylock(&bl->mtx);
+	if (r == 0) {
+		bl->owner = pthread_self();
+		bl->held = 1;
+	}
+	return (r);
+}
+
+int
+Lck__Held(const struct lock *lck)
+{
+	const struct bench_lock *bl = lck->priv;
+
+	return (bl->held);
+}
+
+int
+Lck__Owned(const struct lock *lck)
+{
+	const struct bench_lock *bl = lck->priv;
+
+	return (pthread_equal(bl->owner, pthread_self()));
+}
+
+void
+Lck_Delete(struct lock *lck)
+{
+	struct bench_lock *bl = lck->priv;
+
+	AZ(pthread_mutex_destroy(&bl->mtx));
+	free(bl);
+	lck->priv = NULL;
+}
+
+struct VSC_lck *
+Lck_CreateClass(const char *name)
+{
+
+	(void)name;
+	return (NULL);
+}
+
+void
+Pool_Sumstat(const struct worker *wrk)
+{
+
+	(void)wrk;
+}
+
+static struct worker *
+bench_newworker(void)
+{
+	struct worker *wrk;
+
+	ALLOC_OBJ(wrk, WORKER_MAGIC);
+	AN(wrk);
+	wrk->stats = calloc(1, sizeof *wrk->stats);
+	AN(wrk->stats);
+	return (wrk);
+}
+
+struct bench_bgthread {
+	bgthread_t		*func;
+	void			*priv;
+};
+
+static void *
+bench_bgthread(void *arg)
+{
+	struct bench_bgthread *bt = arg;
+
+	return (bt->func(bench_newworker(), bt->priv));
+}
+
+void
+WRK_BgThread(pthread_t *thr, const char *name, bgthread_t *func, void *priv)
+{
+	struct bench_bgthread *bt;
+
+	(void)name;
+	bt = calloc(1, sizeof *bt);
+	AN(bt);
+	bt->func = func;
+	bt->priv = priv;
+	AZ(pthread_create(thr, NULL, bench_bgthread, bt));
+	AZ(pthread_detach(*thr));
+}
+
+void
+HSH_DeleteObjHead(const struct worker *wrk, struct objhead *oh)
+{
+
+	AZ(oh->refcnt);
+	wrk->stats->n_objecthead--;
+	FREE_OBJ(oh);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+bench_digest(uint64_t key, uint8_t *digest)
+{
+	uint64_t z;
+	unsigned u;
+
+	for (u = 0; u < DIGEST_LEN; u += sizeof z) {
+		/* splitmix64 */
+		key += 0x9e3779b97f4a7c15ULL;
+		z = key;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		z ^= z >> 31;
+		memcpy(digest + u, &z, sizeof z);
+	}
+}
+
+static struct objhead *
+bench_lookup(struct worker *wrk, const uint8_t *digest)
+{
+	struct objhead *oh;
+
+	if (wrk->nobjhead == NULL) {
+		ALLOC_OBJ(oh, OBJHEAD_MAGIC);
+		AN(oh);
+		oh->refcnt = 1;
+		VTAILQ_INIT(&oh->objcs);
+		VTAILQ_INIT(&oh->waitinglist);
+		wrk->stats->n_objecthead++;
+		wrk->nobjhead = oh;
+	}
+	if (hash->prep != NULL)
+		hash->prep(wrk);
+	oh = hash->lookup(wrk, digest, &wrk->nobjhead);
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	Lck_AssertHeld(HSH_Mtx(oh));
+	Lck_Unlock(HSH_Mtx(oh));
+	return (oh);
+}
+
+static void
+bench_deref(struct worker *wrk, struct objhead *oh)
+{
+
+	if (!hash->deref(oh))
+		HSH_DeleteObjHead(wrk, oh);
+}
+
+struct bench_thread {
+	unsigned		magic;
+#define BENCH_THREAD_MAGIC	0x1f4e9e36
+	unsigned		idx;
+	pthread_t		thr;
+	uint64_t		nlookup;
+	uint64_t		ninsert;
+};
+
+static void *
+bench_thread(void *priv)
+{
+	struct bench_thread *bt;
+	struct worker *wrk;
+	struct objhead *oh;
+	uint8_t digest[DIGEST_LEN];
+	uint64_t x, churn;
+	unsigned u;
+
+	CAST_OBJ_NOTNULL(bt, priv, BENCH_THREAD_MAGIC);
+	wrk = bench_newworker();
+	x = 0x2545f4914f6cdd1dULL * (bt->idx + 1);
+	churn = ((uint64_t)bt->idx + 1) << 40;
+	for (u = 0; u < bench_nop; u++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		if (x % 1000 < bench_insert) {
+			bench_digest(churn++, digest);
+			bt->ninsert++;
+		} else {
+			bench_digest((x >> 10) % bench_nobj, digest);
+			bt->nlookup++;
+		}
+		oh = bench_lookup(wrk, digest);
+		bench_deref(wrk, oh);
+	}
+	return (NULL);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "Usage: hash_bench [-h slinger[,args]] [-n objects]"
+	    " [-o ops] [-t threads] [-i inserts]\n"
+	    "\t-h\thash slinger to test (critbit_rcu)\n"
+	    "\t-n\tobjheads inserted before the run (%u)\n"
+	    "\t-o\tlookups per thread (%u)\n"
+	    "\t-t\tnumber of threads (%u)\n"
+	    "\t-i\tinserts per 1000 lookups (%u)\n",
+	    bench_nobj, bench_nop, bench_nthread, bench_insert);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *h_arg = "critbit_rcu";
+	const struct choice *cp;
+	struct bench_thread *bt;
+	struct worker *wrk;
+	uint8_t digest[DIGEST_LEN];
+	uint64_t nlookup = 0, ninsert = 0;
+	char **av;
+	double t0, t1;
+	unsigned u;
+	int ac, o;
+
+	while ((o = getopt(argc, argv, "h:i:n:o:t:")) != -1) {
+		switch (o) {
+		case 'h': h_arg = optarg; break;
+		case 'i': bench_insert = strtoul(optarg, NULL, 0); break;
+		case 'n': bench_nobj = strtoul(optarg, NULL, 0); break;
+		case 'o': bench_nop = strtoul(optarg, NULL, 0); break;
+		case 't': bench_nthread = strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if (argc != optind || bench_nobj == 0 || bench_nthread == 0 ||
+	    bench_insert > 1000)
+		usage();
+
+	heritage.mgt_pid = getpid();
+	bench_param.critbit_cooloff = 1.0;
+	cache_param = &bench_param;
+	VSC_C_main = &bench_vsc;
+	for (u = 0; u < 1U << HSH_LCK_BITS; u++)
+		Lck_New(&hsh_lck[u], lck_objhdr);
+
+	av = VAV_Parse(h_arg, NULL, ARGV_COMMA);
+	AN(av);
+	if (av[0] != NULL || av[1] == NULL)
+		usage();
+	for (cp = bench_choice; cp->name != NULL; cp++)
+		if (!strcmp(cp->name, av[1]))
+			break;
+	if (cp->name == NULL)
+		usage();
+	hash = cp->slinger;
+	for (ac = 0; av[ac + 2] != NULL; ac++)
+		continue;
+	if (hash->init != NULL)
+		hash->init(ac, av + 2);
+	HSH_EpochInit();
+	if (hash->start != NULL)
+		hash->start();
+
+	/* The initial reference on each objhead keeps it in the table */
+	wrk = bench_newworker();
+	t0 = VTIM_mono();
+	for (u = 0; u < bench_nobj; u++) {
+		bench_digest(u, digest);
+		(void)bench_lookup(wrk, digest);
+	}
+	t1 = VTIM_mono();
+	printf("%-12s insert  %10u objheads %8.3f s %8.3f Mops/s\n",
+	    hash->name, bench_nobj, t1 - t0, bench_nobj / (t1 - t0) * 1e-6);
+
+	bt = calloc(bench_nthread, sizeof *bt);
+	AN(bt);
+	t0 = VTIM_mono();
+	for (u = 0; u < bench_nthread; u++) {
+		bt[u].magic = BENCH_THREAD_MAGIC;
+		bt[u].idx = u;
+		AZ(pthread_create(&bt[u].thr, NULL, bench_thread, &bt[u]));
+	}
+	for (u = 0; u < bench_nthread; u++) {
+		AZ(pthread_join(bt[u].thr, NULL));
+		nlookup += bt[u].nlookup;
+		ninsert += bt[u].ninsert;
+	}
+	t1 = VTIM_mono();
+	printf("%-12s lookup  %10ju hits %10ju inserts %3u threads"
+	    " %8.3f s %8.3f Mops/s\n",
+	    hash->name, (uintmax_t)nlookup, (uintmax_t)ninsert,
+	    bench_nthread, t1 - t0, (nlookup + ninsert) / (t1 - t0) * 1e-6);
+	return (0);
+}
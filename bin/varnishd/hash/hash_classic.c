@@ -142,7 +142,7 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			break;
 		oh->refcnt++;
 		Lck_Unlock(&hp->mtx);
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 		return (oh);
 	}
 
@@ -163,7 +163,7 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	oh->hoh_head = hp;
 
 	Lck_Unlock(&hp->mtx);
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	return (oh);
 }
 
@@ -313,6 +313,9 @@ hcb_cleaner(struct worker *wrk, void *priv)
 
 	(void)priv;
 	while (1) {
+		/* hcb_peek() callers are not bound by the cooloff */
+		if (!VSTAILQ_EMPTY(&dead_y) || !VTAILQ_EMPTY(&dead_h))
+			HSH_EpochSync();
 		VSTAILQ_FOREACH_SAFE(y, &dead_y, list, y2) {
 			VSTAILQ_REMOVE_HEAD(&dead_y, list);
 			FREE_OBJ(y);
@@ -351,7 +354,7 @@ hcb_deref(struct objhead *oh)
 {
 
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	assert(oh->refcnt > 0);
 	oh->refcnt--;
 	if (oh->refcnt == 0) {
@@ -360,7 +363,7 @@ hcb_deref(struct objhead *oh)
 		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
 		Lck_Unlock(&hcb_mtx);
 	}
-	Lck_Unlock(&oh->mtx);
+	Lck_Unlock(HSH_Mtx(oh));
 #ifdef PHK
 	fprintf(stderr, "hcb_defef %d %d <%s>\n", __LINE__, r, oh->hash);
 #endif
@@ -386,7 +389,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	wrk->stats->hcb_nolock++;
 	oh = hcb_insert(wrk, &hcb_root, digest, NULL);
 	if (oh != NULL) {
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 		/*
 		 * A refcount of zero indicates that the tree changed
 		 * under us, so fall through and try with the lock held.
@@ -396,7 +399,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			oh->refcnt++;
 			return (oh);
 		}
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 	}
 
 	while (1) {
@@ -410,7 +413,7 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		if (oh == NULL)
 			return (NULL);
 
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 		if (noh != NULL && *noh == NULL) {
@@ -427,10 +430,25 @@ hcb_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			oh->refcnt++;
 			return (oh);
 		}
-		Lck_Unlock(&oh->mtx);
+		Lck_Unlock(HSH_Mtx(oh));
 	}
 }
 
+/*
+ * Unlike the unlocked walk in hcb_lookup(), which relies on the
+ * cooloff, this runs in an epoch read section, and the cleaner waits
+ * for those to drain before it frees anything.
+ */
+
+static struct objhead * __match_proto__(hash_peek_f)
+hcb_peek(struct worker *wrk, const void *digest)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	return (hcb_insert(wrk, &hcb_root, digest, NULL));
+}
+
 static void __match_proto__(hash_prep_f)
 hcb_prep(struct worker *wrk)
 {
@@ -450,4 +468,5 @@ const struct hash_slinger hcb_slinger = {
 	.lookup =	hcb_lookup,
 	.prep =		hcb_prep,
 	.deref  =	hcb_deref,
+	.peek   =	hcb_peek,
 };
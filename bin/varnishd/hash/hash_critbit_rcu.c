@@ -0,0 +1,548 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * A sharded Crit Bit tree with epoch based reclamation
+ *
+ * The digest space is split on the leading bits of the digest into a
+ * power-of-two number of shards, each with its own tree and lock, so
+ * inserts and deletes into unrelated parts of the tree do not contend.
+ *
+ * Lookups never take a tree lock.  Instead readers run in an epoch
+ * read section (see hash_epoch.c), and the cleaner thread only frees
+ * y-nodes and objheads which were unlinked before it has seen both
+ * epoch parities drain.  Compared to the fixed critbit_cooloff of the
+ * critbit hasher, this bounds the time dead objheads linger to a few
+ * milliseconds, and makes the read side safe by construction rather
+ * than by timing.
+ *
+ * Y-nodes are 32 bytes and 32 byte aligned, so that visiting a level
+ * of the tree never costs more than a single cache line.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+#include "vmb.h"
+#include "vtim.h"
+
+#define HCR_CACHELINE		64
+#define HCR_CLEAN_INTERVAL	1.0
+
+static unsigned			hcr_shardbits = 8;
+
+/*---------------------------------------------------------------------
+ * Table for finding out how many bits two bytes have in common,
+ * counting from the MSB towards the LSB.
+ */
+
+static unsigned char hcr_bittbl[256];
+
+static unsigned char
+hcr_bits(unsigned char x, unsigned char y)
+{
+	return (hcr_bittbl[x ^ y]);
+}
+
+static void
+hcr_build_bittbl(void)
+{
+	unsigned char x;
+	unsigned y;
+
+	y = 0;
+	for (x = 0; x < 8; x++)
+		for (; y < (1U << x); y++)
+			hcr_bittbl[y] = 8 - x;
+
+	assert(hcr_bits(0x34, 0x34) == 8);
+	AZ(hcr_bits(0xaa, 0x55));
+	assert(hcr_bits(0x01, 0x22) == 2);
+	assert(hcr_bits(0x10, 0x0b) == 3);
+}
+
+/*---------------------------------------------------------------------
+ * The leaf pointers are overloaded the same way as in hash_critbit.c,
+ * the low two bits tell objheads and y-nodes apart.
+ *
+ * The fields needed to descend the tree come first, the list linkage
+ * is only touched by writers and the cleaner.
+ */
+
+struct hcr_y {
+	volatile uintptr_t	leaf[2];
+	unsigned char		ptr;
+	unsigned char		bitmask;
+	unsigned short		critbit;
+	unsigned		magic;
+#define HCR_Y_MAGIC		0x2d1a80b7
+	VSTAILQ_ENTRY(hcr_y)	list;
+};
+
+#define HCR_BIT_NODE		(1<<0)
+#define HCR_BIT_Y		(1<<1)
+
+struct hcr_shard {
+	unsigned		magic;
+#define HCR_SHARD_MAGIC		0x6c3c1e74
+	struct lock		mtx;
+	volatile uintptr_t	origo;
+	VSTAILQ_HEAD(, hcr_y)	cool_y;
+	VTAILQ_HEAD(, objhead)	cool_h;
+};
+
+/* Keep each shard on its own cache line */
+union hcr_shard_u {
+	struct hcr_shard	sh;
+	char			pad[HCR_CACHELINE];
+};
+
+static union hcr_shard_u	*hcr_shards;
+
+/*---------------------------------------------------------------------
+ * Pointer accessor functions
+ */
+
+static int
+hcr_is_node(uintptr_t u)
+{
+
+	return (u & HCR_BIT_NODE);
+}
+
+static int
+hcr_is_y(uintptr_t u)
+{
+
+	return (u & HCR_BIT_Y);
+}
+
+static uintptr_t
+hcr_r_node(const struct objhead *n)
+{
+
+	AZ((uintptr_t)n & (HCR_BIT_NODE | HCR_BIT_Y));
+	return (HCR_BIT_NODE | (uintptr_t)n);
+}
+
+static struct objhead *
+hcr_l_node(uintptr_t u)
+{
+
+	assert(u & HCR_BIT_NODE);
+	AZ(u & HCR_BIT_Y);
+	return ((struct objhead *)(u & ~HCR_BIT_NODE));
+}
+
+static uintptr_t
+hcr_r_y(const struct hcr_y *y)
+{
+
+	CHECK_OBJ_NOTNULL(y, HCR_Y_MAGIC);
+	AZ((uintptr_t)y & (HCR_BIT_NODE | HCR_BIT_Y));
+	return (HCR_BIT_Y | (uintptr_t)y);
+}
+
+static struct hcr_y *
+hcr_l_y(uintptr_t u)
+{
+
+	AZ(u & HCR_BIT_NODE);
+	assert(u & HCR_BIT_Y);
+	return ((struct hcr_y *)(u & ~HCR_BIT_Y));
+}
+
+static struct hcr_y *
+hcr_new_y(void)
+{
+	struct hcr_y *y;
+	void *p;
+
+	AZ(posix_memalign(&p, sizeof *y, sizeof *y));
+	y = p;
+	INIT_OBJ(y, HCR_Y_MAGIC);
+	return (y);
+}
+
+static struct hcr_shard *
+hcr_shard(const uint8_t *digest)
+{
+	unsigned u;
+
+	u = ((unsigned)digest[0] << 8) | digest[1];
+	u >>= 16 - hcr_shardbits;
+	CHECK_OBJ_NOTNULL(&hcr_shards[u].sh, HCR_SHARD_MAGIC);
+	return (&hcr_shards[u].sh);
+}
+
+/*---------------------------------------------------------------------
+ * Find the "critical" bit that separates these two digests
+ */
+
+static void
+hcr_crit_bit(const uint8_t *digest, const struct objhead *oh2,
+    struct hcr_y *y)
+{
+	unsigned char u, r;
+
+	CHECK_OBJ_NOTNULL(y, HCR_Y_MAGIC);
+	for (u = 0; u < DIGEST_LEN && digest[u] == oh2->digest[u]; u++)
+		;
+	assert(u < DIGEST_LEN);
+	r = hcr_bits(digest[u], oh2->digest[u]);
+	y->ptr = u;
+	y->bitmask = 0x80 >> r;
+	y->critbit = u * 8 + r;
+}
+
+/*---------------------------------------------------------------------
+ * Walk the tree of a shard, and if noh is non-NULL, insert it.
+ *
+ * Without noh, this must be called inside a read section, with noh
+ * the shard lock must be held.
+ */
+
+static struct objhead *
+hcr_insert(struct worker *wrk, struct hcr_shard *sh, const uint8_t *digest,
+    struct objhead **noh)
+{
+	volatile uintptr_t *p;
+	uintptr_t pp;
+	struct hcr_y *y, *y2;
+	struct objhead *oh2;
+	unsigned s, s2;
+
+	p = &sh->origo;
+	pp = *p;
+	if (pp == 0) {
+		if (noh == NULL)
+			return (NULL);
+		oh2 = *noh;
+		*noh = NULL;
+		memcpy(oh2->digest, digest, sizeof oh2->digest);
+		VWMB();
+		*p = hcr_r_node(oh2);
+		return (oh2);
+	}
+
+	while (hcr_is_y(pp)) {
+		y = hcr_l_y(pp);
+		CHECK_OBJ_NOTNULL(y, HCR_Y_MAGIC);
+		assert(y->ptr < DIGEST_LEN);
+		s = (digest[y->ptr] & y->bitmask) != 0;
+		p = &y->leaf[s];
+		pp = *p;
+	}
+
+	if (pp == 0) {
+		/* We raced hcr_delete and got a NULL pointer */
+		assert(noh == NULL);
+		return (NULL);
+	}
+
+	assert(hcr_is_node(pp));
+
+	oh2 = hcr_l_node(pp);
+	CHECK_OBJ_NOTNULL(oh2, OBJHEAD_MAGIC);
+	if (!memcmp(oh2->digest, digest, DIGEST_LEN))
+		return (oh2);
+
+	if (noh == NULL)
+		return (NULL);
+
+	Lck_AssertHeld(&sh->mtx);
+	CAST_OBJ_NOTNULL(y2, wrk->nhashpriv, HCR_Y_MAGIC);
+	wrk->nhashpriv = NULL;
+	hcr_crit_bit(digest, oh2, y2);
+	s2 = (digest[y2->ptr] & y2->bitmask) != 0;
+	oh2 = *noh;
+	*noh = NULL;
+	memcpy(oh2->digest, digest, sizeof oh2->digest);
+	y2->leaf[s2] = hcr_r_node(oh2);
+	s2 = 1 - s2;
+
+	p = &sh->origo;
+	AN(*p);
+
+	while (hcr_is_y(*p)) {
+		y = hcr_l_y(*p);
+		CHECK_OBJ_NOTNULL(y, HCR_Y_MAGIC);
+		assert(y->critbit != y2->critbit);
+		if (y->critbit > y2->critbit)
+			break;
+		assert(y->ptr < DIGEST_LEN);
+		s = (digest[y->ptr] & y->bitmask) != 0;
+		p = &y->leaf[s];
+	}
+	y2->leaf[s2] = *p;
+	VWMB();
+	*p = hcr_r_y(y2);
+	return (oh2);
+}
+
+/*--------------------------------------------------------------------
+ * Unlink an objhead, the y-node which goes with it is put on the
+ * cooling list of the shard, and freed once no reader can see it.
+ */
+
+static void
+hcr_delete(struct hcr_shard *sh, const struct objhead *oh)
+{
+	struct hcr_y *y;
+	volatile uintptr_t *p;
+	unsigned s;
+
+	Lck_AssertHeld(&sh->mtx);
+	if (sh->origo == hcr_r_node(oh)) {
+		sh->origo = 0;
+		return;
+	}
+	p = &sh->origo;
+	while (1) {
+		assert(hcr_is_y(*p));
+		y = hcr_l_y(*p);
+		CHECK_OBJ_NOTNULL(y, HCR_Y_MAGIC);
+		assert(y->ptr < DIGEST_LEN);
+		s = (oh->digest[y->ptr] & y->bitmask) != 0;
+		if (y->leaf[s] == hcr_r_node(oh)) {
+			*p = y->leaf[1 - s];
+			VSTAILQ_INSERT_TAIL(&sh->cool_y, y, list);
+			return;
+		}
+		p = &y->leaf[s];
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+static void * __match_proto__(bgthread_t)
+hcr_cleaner(struct worker *wrk, void *priv)
+{
+	VSTAILQ_HEAD(, hcr_y) dead_y;
+	VTAILQ_HEAD(, objhead) dead_h;
+	struct hcr_shard *sh;
+	struct hcr_y *y, *y2;
+	struct objhead *oh, *oh2;
+	unsigned u;
+
+	(void)priv;
+	while (1) {
+		VSTAILQ_INIT(&dead_y);
+		VTAILQ_INIT(&dead_h);
+		for (u = 0; u < 1U << hcr_shardbits; u++) {
+			sh = &hcr_shards[u].sh;
+			Lck_Lock(&sh->mtx);
+			VSTAILQ_CONCAT(&dead_y, &sh->cool_y);
+			VTAILQ_CONCAT(&dead_h, &sh->cool_h, hoh_list);
+			Lck_Unlock(&sh->mtx);
+		}
+		if (!VSTAILQ_EMPTY(&dead_y) || !VTAILQ_EMPTY(&dead_h))
+			HSH_EpochSync();
+		VSTAILQ_FOREACH_SAFE(y, &dead_y, list, y2)
+			FREE_OBJ(y);
+		VTAILQ_FOREACH_SAFE(oh, &dead_h, hoh_list, oh2) {
+			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
+			HSH_DeleteObjHead(wrk, oh);
+		}
+		Pool_Sumstat(wrk);
+		VTIM_sleep(HCR_CLEAN_INTERVAL);
+	}
+	NEEDLESS(return NULL);
+}
+
+/*--------------------------------------------------------------------
+ * The ->init method allows the management process to pass arguments
+ */
+
+static void __match_proto__(hash_init_f)
+hcr_init(int ac, char * const *av)
+{
+	unsigned u;
+
+	if (ac == 0)
+		return;
+	if (ac > 1)
+		ARGV_ERR("(-hcritbit_rcu) too many arguments\n");
+	if (sscanf(av[0], "%u", &u) != 1 || u == 0 || u > 65536 ||
+	    (u & (u - 1)))
+		ARGV_ERR("(-hcritbit_rcu) shards must be a power of two"
+		    " between 1 and 65536\n");
+	for (hcr_shardbits = 0; (1U << hcr_shardbits) < u; hcr_shardbits++)
+		continue;
+}
+
+static void __match_proto__(hash_start_f)
+hcr_start(void)
+{
+	pthread_t tp;
+	unsigned u;
+	void *p;
+
+	assert(sizeof(struct hcr_y) == 32);
+	assert(sizeof(struct hcr_shard) <= HCR_CACHELINE);
+	assert(hcr_shardbits <= 16);
+	hcr_build_bittbl();
+
+	AZ(posix_memalign(&p, HCR_CACHELINE,
+	    sizeof *hcr_shards << hcr_shardbits));
+	hcr_shards = p;
+	for (u = 0; u < 1U << hcr_shardbits; u++) {
+		INIT_OBJ(&hcr_shards[u].sh, HCR_SHARD_MAGIC);
+		Lck_New(&hcr_shards[u].sh.mtx, lck_hcb);
+		VSTAILQ_INIT(&hcr_shards[u].sh.cool_y);
+		VTAILQ_INIT(&hcr_shards[u].sh.cool_h);
+	}
+
+	WRK_BgThread(&tp, "hcr-cleaner", hcr_cleaner, NULL);
+}
+
+static int __match_proto__(hash_deref_f)
+hcr_deref(struct objhead *oh)
+{
+	struct hcr_shard *sh;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	sh = hcr_shard(oh->digest);
+	Lck_Lock(HSH_Mtx(oh));
+	assert(oh->refcnt > 0);
+	if (--oh->refcnt == 0) {
+		Lck_Lock(&sh->mtx);
+		hcr_delete(sh, oh);
+		VTAILQ_INSERT_TAIL(&sh->cool_h, oh, hoh_list);
+		Lck_Unlock(&sh->mtx);
+	}
+	Lck_Unlock(HSH_Mtx(oh));
+	return (1);
+}
+
+static struct objhead * __match_proto__(hash_lookup_f)
+hcr_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
+{
+	struct hcr_shard *sh;
+	struct hsh_epoch *ep;
+	struct objhead *oh;
+	unsigned idx;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	if (noh != NULL) {
+		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
+		assert((*noh)->refcnt == 1);
+	}
+	sh = hcr_shard(digest);
+
+	/* First try without touching the shard lock */
+
+	wrk->stats->hcr_nolock++;
+	ep = HSH_EpochEnter(wrk, &idx);
+	oh = hcr_insert(wrk, sh, digest, NULL);
+	if (oh != NULL) {
+		Lck_Lock(HSH_Mtx(oh));
+		/*
+		 * A refcount of zero indicates that the objhead is on
+		 * its way out of the tree, retry with the lock held.
+		 */
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			HSH_EpochExit(ep, idx);
+			return (oh);
+		}
+		Lck_Unlock(HSH_Mtx(oh));
+	}
+	HSH_EpochExit(ep, idx);
+
+	while (1) {
+		/*
+		 * hcr_deref() takes the shard lock under the objhead
+		 * lock, so we must drop the former before taking the
+		 * latter, and stay in a read section to keep oh alive
+		 * in between.
+		 */
+		ep = HSH_EpochEnter(wrk, &idx);
+		Lck_Lock(&sh->mtx);
+		wrk->stats->hcr_lock++;
+		oh = hcr_insert(wrk, sh, digest, noh);
+		Lck_Unlock(&sh->mtx);
+
+		if (oh == NULL) {
+			HSH_EpochExit(ep, idx);
+			return (NULL);
+		}
+
+		/*
+		 * The objhead lock does not keep oh alive, so as above,
+		 * only leave the read section once we hold a reference.
+		 */
+		Lck_Lock(HSH_Mtx(oh));
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		if (noh != NULL && *noh == NULL) {
+			assert(oh->refcnt > 0);
+			HSH_EpochExit(ep, idx);
+			wrk->stats->hcr_insert++;
+			return (oh);
+		}
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			HSH_EpochExit(ep, idx);
+			return (oh);
+		}
+		Lck_Unlock(HSH_Mtx(oh));
+		HSH_EpochExit(ep, idx);
+	}
+}
+
+static struct objhead * __match_proto__(hash_peek_f)
+hcr_peek(struct worker *wrk, const void *digest)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	return (hcr_insert(wrk, hcr_shard(digest), digest, NULL));
+}
+
+static void __match_proto__(hash_prep_f)
+hcr_prep(struct worker *wrk)
+{
+
+	if (wrk->nhashpriv == NULL)
+		wrk->nhashpriv = hcr_new_y();
+}
+
+const struct hash_slinger hcr_slinger = {
+	.magic  =	SLINGER_MAGIC,
+	.name   =	"critbit_rcu",
+	.init   =	hcr_init,
+	.start  =	hcr_start,
+	.lookup =	hcr_lookup,
+	.prep =		hcr_prep,
+	.deref  =	hcr_deref,
+	.peek   =	hcr_peek,
+};
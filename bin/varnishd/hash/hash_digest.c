@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Computing the digest of hash_data()
+ *
+ * The default is SHA256.  Alternatively -h kind,digest=fast selects a
+ * seeded, non-cryptographic 256 bit hash which is several times cheaper
+ * on long hash inputs.  The seed is random per varnishd instance, so
+ * collisions cannot be precomputed, but unlike with SHA256 they are
+ * not beyond reach for somebody who can observe hit/miss behaviour
+ * for long enough, and a collision means delivering the wrong object.
+ * Digests are also not stable across restarts, which defeats the
+ * persistent storage.
+ *
+ * The fast hash runs four independent 64 bit lanes over 32 byte
+ * stripes, and reuses the VSHA256Context so that callers need not
+ * care which one is in use: the lanes live in ->state, ->count counts
+ * bytes and ->buf holds a partial stripe.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+#include "vend.h"
+#include "vsha256.h"
+
+#define HFD_STRIPE	32
+
+#define HFD_P1		0x9e3779b185ebca87ULL
+#define HFD_P2		0xc2b2ae3d27d4eb4fULL
+#define HFD_P3		0x165667b19e3779f9ULL
+#define HFD_P4		0x85ebca77c2b2ae63ULL
+#define HFD_P5		0x27d4eb2f165667c5ULL
+
+static inline uint64_t
+hfd_rotl(uint64_t x, unsigned r)
+{
+
+	return ((x << r) | (x >> (64 - r)));
+}
+
+static inline uint64_t
+hfd_round(uint64_t acc, uint64_t in)
+{
+
+	acc += in * HFD_P2;
+	acc = hfd_rotl(acc, 31);
+	return (acc * HFD_P1);
+}
+
+static inline uint64_t
+hfd_avalanche(uint64_t h)
+{
+
+	h ^= h >> 33;
+	h *= HFD_P2;
+	h ^= h >> 29;
+	h *= HFD_P3;
+	h ^= h >> 32;
+	return (h);
+}
+
+static void
+hfd_stripes(uint64_t *v, const unsigned char *p, size_t n)
+{
+	uint64_t v0, v1, v2, v3;
+
+	v0 = v[0];
+	v1 = v[1];
+	v2 = v[2];
+	v3 = v[3];
+	for (; n > 0; n--, p += HFD_STRIPE) {
+		v0 = hfd_round(v0, vle64dec(p));
+		v1 = hfd_round(v1, vle64dec(p + 8));
+		v2 = hfd_round(v2, vle64dec(p + 16));
+		v3 = hfd_round(v3, vle64dec(p + 24));
+	}
+	v[0] = v0;
+	v[1] = v1;
+	v[2] = v2;
+	v[3] = v3;
+}
+
+static void
+hfd_init(struct VSHA256Context *ctx)
+{
+	uint64_t v[4];
+	const uint64_t *s = heritage.hash_seed;
+
+	assert(sizeof ctx->state == sizeof v);
+	v[0] = s[0] + HFD_P1 + HFD_P2;
+	v[1] = s[1] + HFD_P2;
+	v[2] = s[2];
+	v[3] = s[3] - HFD_P1;
+	memcpy(ctx->state, v, sizeof v);
+	ctx->count = 0;
+}
+
+static void
+hfd_update(struct VSHA256Context *ctx, const void *ptr, size_t len)
+{
+	const unsigned char *p = ptr;
+	uint64_t v[4];
+	size_t r, l;
+
+	r = ctx->count % HFD_STRIPE;
+	ctx->count += len;
+	if (r + len < HFD_STRIPE) {
+		memcpy(ctx->buf + r, p, len);
+		return;
+	}
+	memcpy(v, ctx->state, sizeof v);
+	if (r > 0) {
+		l = HFD_STRIPE - r;
+		memcpy(ctx->buf + r, p, l);
+		hfd_stripes(v, ctx->buf, 1);
+		p += l;
+		len -= l;
+	}
+	hfd_stripes(v, p, len / HFD_STRIPE);
+	memcpy(ctx->state, v, sizeof v);
+	l = len % HFD_STRIPE;
+	memcpy(ctx->buf, p + len - l, l);
+}
+
+static void
+hfd_final(unsigned char *digest, struct VSHA256Context *ctx)
+{
+	uint64_t v[4], h[4];
+	size_t r;
+	int i, j;
+
+	memcpy(v, ctx->state, sizeof v);
+	r = ctx->count % HFD_STRIPE;
+	if (r > 0) {
+		memset(ctx->buf + r, 0, HFD_STRIPE - r);
+		hfd_stripes(v, ctx->buf, 1);
+	}
+
+	/* Make every output word depend on all lanes and the length */
+	for (i = 0; i < 4; i++)
+		h[i] = v[i] ^ (ctx->count * HFD_P5) ^ (i * HFD_P4);
+	for (j = 0; j < 2; j++)
+		for (i = 0; i < 4; i++)
+			h[i] = hfd_round(h[i],
+			    h[(i + 1) & 3] ^ hfd_rotl(h[(i + 2) & 3], 17));
+	for (i = 0; i < 4; i++)
+		vle64enc(digest + 8 * i, hfd_avalanche(h[i]));
+
+	memset(ctx, 0, sizeof *ctx);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+HSH_DigestInit(struct VSHA256Context *ctx)
+{
+
+	AN(ctx);
+	if (heritage.hash_digest == HSH_DIGEST_FAST)
+		hfd_init(ctx);
+	else
+		VSHA256_Init(ctx);
+}
+
+void
+HSH_DigestUpdate(struct VSHA256Context *ctx, const void *ptr, size_t len)
+{
+
+	AN(ctx);
+	if (heritage.hash_digest == HSH_DIGEST_FAST)
+		hfd_update(ctx, ptr, len);
+	else
+		VSHA256_Update(ctx, ptr, len);
+}
+
+void
+HSH_DigestFinal(unsigned char *digest, struct VSHA256Context *ctx)
+{
+
+	AN(digest);
+	AN(ctx);
+	if (heritage.hash_digest == HSH_DIGEST_FAST)
+		hfd_final(digest, ctx);
+	else
+		VSHA256_Final(digest, ctx);
+}
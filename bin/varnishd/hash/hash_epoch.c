@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Epoch based read sections for the hash code
+ *
+ * Readers announce themselves in one of a small number of cache-line
+ * sized slots, under the parity of the current epoch, and do nothing
+ * else: no locks and no shared cache lines beyond their own slot.
+ * Writers unlink things first, and only free them after HSH_EpochSync()
+ * has seen both epoch parities drain.
+ *
+ * The hash slingers use this to walk their index without locks, and
+ * cache_hash.c uses it to look for hits without the objhead lock.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "hash/hash_slinger.h"
+#include "vatomic.h"
+#include "vtim.h"
+
+#define HSH_EPOCH_CACHELINE	64
+#define HSH_EPOCH_NSLOT		64
+
+struct hsh_epoch {
+	volatile unsigned	nreader[2];
+	char			pad[HSH_EPOCH_CACHELINE - 2 * sizeof(unsigned)];
+};
+
+static struct hsh_epoch		*hsh_epochs;
+static volatile unsigned	hsh_epoch;
+static pthread_mutex_t		hsh_epoch_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+HSH_EpochInit(void)
+{
+	void *p;
+
+	if (hsh_epochs != NULL)
+		return;
+	assert(sizeof(struct hsh_epoch) == HSH_EPOCH_CACHELINE);
+	AZ(posix_memalign(&p, HSH_EPOCH_CACHELINE,
+	    sizeof *hsh_epochs * HSH_EPOCH_NSLOT));
+	memset(p, 0, sizeof *hsh_epochs * HSH_EPOCH_NSLOT);
+	hsh_epochs = p;
+}
+
+/*---------------------------------------------------------------------
+ * Readers are spread over the slots by their worker address.  Read
+ * sections nest, as long as they are left in the reverse order.
+ */
+
+struct hsh_epoch *
+HSH_EpochEnter(const struct worker *wrk, unsigned *idx)
+{
+	struct hsh_epoch *ep;
+	uint64_t u;
+
+	AN(hsh_epochs);
+	AN(idx);
+	u = (uint64_t)(uintptr_t)wrk * 0x9e3779b97f4a7c15ULL;
+	ep = &hsh_epochs[(u >> 32) % HSH_EPOCH_NSLOT];
+	*idx = hsh_epoch & 1;
+	(void)VATOMIC_INC(&ep->nreader[*idx]);
+	return (ep);
+}
+
+void
+HSH_EpochExit(struct hsh_epoch *ep, unsigned idx)
+{
+
+	AN(ep);
+	assert(idx < 2);
+	assert(ep->nreader[idx] > 0);
+	(void)VATOMIC_DEC(&ep->nreader[idx]);
+}
+
+/*---------------------------------------------------------------------
+ * Wait until no reader can hold a reference to anything unlinked
+ * before we were called.
+ *
+ * A reader may sample the epoch just before we flip it and announce
+ * itself just after we checked its slot, so one flip is not enough:
+ * it would then be counted under the parity we do not wait for on the
+ * next grace period.  Flipping twice covers that window.
+ *
+ * Concurrent callers are serialized, or they could flip the parity
+ * back under each other's feet.
+ *
+ * This sleeps, so only call it from a background thread.
+ */
+
+void
+HSH_EpochSync(void)
+{
+	unsigned n, u, idx;
+
+	AN(hsh_epochs);
+	AZ(pthread_mutex_lock(&hsh_epoch_mtx));
+	for (n = 0; n < 2; n++) {
+		idx = hsh_epoch & 1;
+		(void)VATOMIC_INC(&hsh_epoch);
+		for (u = 0; u < HSH_EPOCH_NSLOT; u++)
+			while (hsh_epochs[u].nreader[idx] != 0)
+				VTIM_sleep(0.001);
+	}
+	AZ(pthread_mutex_unlock(&hsh_epoch_mtx));
+}
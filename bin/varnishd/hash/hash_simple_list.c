@@ -83,7 +83,7 @@ hsl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 			break;
 		oh->refcnt++;
 		Lck_Unlock(&hsl_mtx);
-		Lck_Lock(&oh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
 		return (oh);
 	}
 
@@ -99,7 +99,7 @@ hsl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 	*noh = NULL;
 	memcpy(oh->digest, digest, sizeof oh->digest);
 	Lck_Unlock(&hsl_mtx);
-	Lck_Lock(&oh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
 	return (oh);
 }
 
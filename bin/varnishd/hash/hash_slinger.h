@@ -38,6 +38,14 @@ typedef struct objhead *hash_lookup_f(struct worker *, const void *digest,
     struct objhead **);
 typedef int hash_deref_f(struct objhead *);
 
+/*
+ * The optional ->peek method finds an objhead without locking it or
+ * taking a reference.  It is called inside an epoch read section, and
+ * the slinger must not free an objhead it has unlinked before every
+ * read section which could have found it is over.
+ */
+typedef struct objhead *hash_peek_f(struct worker *, const void *digest);
+
 struct hash_slinger {
 	unsigned		magic;
 #define SLINGER_MAGIC		0x1b720cba
@@ -47,6 +55,13 @@ struct hash_slinger {
 	hash_prep_f		*prep;
 	hash_lookup_f		*lookup;
 	hash_deref_f		*deref;
+	hash_peek_f		*peek;
+};
+
+/* Digest of hash_data(), see hash_digest.c */
+enum hsh_digest_e {
+	HSH_DIGEST_SHA256 = 0,
+	HSH_DIGEST_FAST,
 };
 
 enum lookup_e {
@@ -64,6 +79,15 @@ void HSH_config(const char *);
 void HSH_Init(const struct hash_slinger *);
 void HSH_Cleanup(struct worker *);
 
+/* hash_epoch.c */
+struct hsh_epoch;
+void HSH_EpochInit(void);
+struct hsh_epoch *HSH_EpochEnter(const struct worker *, unsigned *idx);
+void HSH_EpochExit(struct hsh_epoch *, unsigned idx);
+void HSH_EpochSync(void);
+
 extern const struct hash_slinger hsl_slinger;
 extern const struct hash_slinger hcl_slinger;
 extern const struct hash_slinger hcb_slinger;
+extern const struct hash_slinger hcr_slinger;
+extern const struct hash_slinger hsw_slinger;
@@ -0,0 +1,466 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * An open addressing hash table in the style of "Swiss tables"
+ *
+ * Every slot has a control byte, which is either EMPTY, DELETED or
+ * holds seven bits of the digest as a tag.  Slots are probed in groups
+ * of 16, the control bytes of a group are compared against the tag in
+ * one go (with SSE2 where available) and only the objheads with a
+ * matching tag are visited, so a lookup normally costs one cache line
+ * of control bytes and one objhead.
+ *
+ * The table is split into a power-of-two number of shards on the
+ * leading digest bits, each with its own lock.  When a shard fills
+ * up, a new table is allocated and the old one is migrated a few
+ * groups at a time by the following operations on the shard, so no
+ * single lookup pays for rehashing the whole shard.
+ *
+ * SHA256 digests are uniformly distributed, so different parts of the
+ * digest are used directly for the shard, the probe start and the tag.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "hash/hash_slinger.h"
+
+#define HSW_GROUP		16
+#define HSW_EMPTY		0x80
+#define HSW_DELETED		0xfe
+#define HSW_MIN_GROUPS		4
+#define HSW_MIGRATE_GROUPS	8
+
+static struct VSC_lck *lck_hsw;
+
+static unsigned			hsw_shardbits = 8;
+
+struct hsw_tbl {
+	unsigned		ngroup;		/* power of two */
+	unsigned		nused;
+	unsigned		ndeleted;
+	uint8_t			*ctrl;
+	struct objhead		**slot;
+};
+
+struct hsw_shard {
+	unsigned		magic;
+#define HSW_SHARD_MAGIC		0x5a1e7c0d
+	struct lock		mtx;
+	struct hsw_tbl		cur;
+	struct hsw_tbl		old;		/* being migrated to cur */
+	unsigned		migrate;	/* next group in old */
+};
+
+static struct hsw_shard		*hsw_shards;
+
+/*---------------------------------------------------------------------
+ * Group matching, returns a bitmap of slots in the group
+ */
+
+#if defined(__SSE2__)
+
+static inline unsigned
+hsw_match(const uint8_t *ctrl, uint8_t tag)
+{
+	__m128i c;
+
+	c = _mm_load_si128((const __m128i *)(const void *)ctrl);
+	return ((unsigned)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(c, _mm_set1_epi8((char)tag))));
+}
+
+/* EMPTY and DELETED are the only control bytes with the top bit set */
+static inline unsigned
+hsw_match_free(const uint8_t *ctrl)
+{
+	__m128i c;
+
+	c = _mm_load_si128((const __m128i *)(const void *)ctrl);
+	return ((unsigned)_mm_movemask_epi8(c));
+}
+
+#else
+
+static inline unsigned
+hsw_match(const uint8_t *ctrl, uint8_t tag)
+{
+	unsigned u, m = 0;
+
+	for (u = 0; u < HSW_GROUP; u++)
+		if (ctrl[u] == tag)
+			m |= 1U << u;
+	return (m);
+}
+
+static inline unsigned
+hsw_match_free(const uint8_t *ctrl)
+{
+	unsigned u, m = 0;
+
+	for (u = 0; u < HSW_GROUP; u++)
+		if (ctrl[u] & 0x80)
+			m |= 1U << u;
+	return (m);
+}
+
+#endif
+
+/*---------------------------------------------------------------------*/
+
+static struct hsw_shard *
+hsw_shard(const uint8_t *digest)
+{
+	unsigned u;
+
+	u = ((unsigned)digest[0] << 8) | digest[1];
+	u >>= 16 - hsw_shardbits;
+	CHECK_OBJ_NOTNULL(&hsw_shards[u], HSW_SHARD_MAGIC);
+	return (&hsw_shards[u]);
+}
+
+static inline unsigned
+hsw_h1(const uint8_t *digest)
+{
+	unsigned u;
+
+	memcpy(&u, digest + 8, sizeof u);
+	return (u);
+}
+
+static inline uint8_t
+hsw_h2(const uint8_t *digest)
+{
+
+	return (digest[16] & 0x7f);
+}
+
+static void
+hsw_tbl_init(struct hsw_tbl *t, unsigned ngroup)
+{
+	void *p;
+
+	assert(ngroup >= HSW_MIN_GROUPS);
+	AZ(ngroup & (ngroup - 1));
+	memset(t, 0, sizeof *t);
+	t->ngroup = ngroup;
+	AZ(posix_memalign(&p, HSW_GROUP, (size_t)ngroup * HSW_GROUP));
+	t->ctrl = p;
+	memset(t->ctrl, HSW_EMPTY, (size_t)ngroup * HSW_GROUP);
+	t->slot = calloc((size_t)ngroup * HSW_GROUP, sizeof *t->slot);
+	XXXAN(t->slot);
+}
+
+static void
+hsw_tbl_fini(struct hsw_tbl *t)
+{
+
+	AZ(t->nused);
+	free(t->ctrl);
+	free(t->slot);
+	memset(t, 0, sizeof *t);
+}
+
+/*---------------------------------------------------------------------
+ * Probe groups in triangular order, which visits every group once
+ * when the number of groups is a power of two.
+ */
+
+static int
+hsw_find(const struct hsw_tbl *t, const uint8_t *digest)
+{
+	unsigned g, i, m, mask;
+	const uint8_t *ctrl;
+	const struct objhead *oh;
+	uint8_t h2;
+	int b;
+
+	if (t->ngroup == 0)
+		return (-1);
+	mask = t->ngroup - 1;
+	h2 = hsw_h2(digest);
+	g = hsw_h1(digest) & mask;
+	for (i = 0; i <= mask; i++) {
+		ctrl = t->ctrl + g * HSW_GROUP;
+		m = hsw_match(ctrl, h2);
+		while (m != 0) {
+			b = ffs((int)m) - 1;
+			m &= m - 1;
+			oh = t->slot[g * HSW_GROUP + b];
+			CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+			if (!memcmp(oh->digest, digest, sizeof oh->digest))
+				return (g * HSW_GROUP + b);
+		}
+		if (hsw_match(ctrl, HSW_EMPTY) != 0)
+			return (-1);
+		g = (g + i + 1) & mask;
+	}
+	return (-1);
+}
+
+static void
+hsw_place(struct hsw_tbl *t, struct objhead *oh)
+{
+	unsigned g, i, m, mask, s;
+
+	mask = t->ngroup - 1;
+	g = hsw_h1(oh->digest) & mask;
+	for (i = 0; i <= mask; i++) {
+		m = hsw_match_free(t->ctrl + g * HSW_GROUP);
+		if (m != 0) {
+			s = g * HSW_GROUP + ffs((int)m) - 1;
+			if (t->ctrl[s] == HSW_DELETED)
+				t->ndeleted--;
+			t->ctrl[s] = hsw_h2(oh->digest);
+			t->slot[s] = oh;
+			t->nused++;
+			return;
+		}
+		g = (g + i + 1) & mask;
+	}
+	WRONG("hash_swiss table full");
+}
+
+/*---------------------------------------------------------------------
+ * A slot can go back to EMPTY if its group has an EMPTY slot already:
+ * a group only ever loses its last EMPTY slot by insertion, so no
+ * probe sequence can have continued past a group which still has one.
+ */
+
+static void
+hsw_remove(struct hsw_tbl *t, unsigned s)
+{
+	const uint8_t *ctrl;
+
+	assert(s < t->ngroup * HSW_GROUP);
+	AZ(t->ctrl[s] & 0x80);
+	ctrl = t->ctrl + (s & ~(HSW_GROUP - 1));
+	t->slot[s] = NULL;
+	if (hsw_match(ctrl, HSW_EMPTY) != 0) {
+		t->ctrl[s] = HSW_EMPTY;
+	} else {
+		t->ctrl[s] = HSW_DELETED;
+		t->ndeleted++;
+	}
+	assert(t->nused > 0);
+	t->nused--;
+}
+
+/*---------------------------------------------------------------------
+ * Move a bounded number of groups from the old to the current table
+ */
+
+static void
+hsw_migrate(struct hsw_shard *sh, unsigned ngroup)
+{
+	unsigned s, e;
+
+	Lck_AssertHeld(&sh->mtx);
+	while (ngroup-- > 0 && sh->migrate < sh->old.ngroup) {
+		s = sh->migrate++ * HSW_GROUP;
+		for (e = s + HSW_GROUP; s < e; s++) {
+			if (sh->old.ctrl[s] & 0x80)
+				continue;
+			hsw_place(&sh->cur, sh->old.slot[s]);
+			sh->old.nused--;
+		}
+	}
+	if (sh->old.ngroup > 0 && sh->migrate == sh->old.ngroup) {
+		hsw_tbl_fini(&sh->old);
+		sh->migrate = 0;
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Keep the current table at most 7/8 full, counting tombstones.
+ * If it is less than half full with live entries, tombstones are the
+ * problem, and a table of the same size will do.
+ */
+
+static void
+hsw_grow(struct hsw_shard *sh)
+{
+	unsigned cap;
+
+	Lck_AssertHeld(&sh->mtx);
+	cap = sh->cur.ngroup * HSW_GROUP;
+	if (sh->cur.nused + sh->cur.ndeleted + 1 <= cap - cap / 8)
+		return;
+	if (sh->old.ngroup > 0)
+		hsw_migrate(sh, UINT_MAX);
+	AZ(sh->old.ngroup);
+	sh->old = sh->cur;
+	sh->migrate = 0;
+	if (sh->old.nused + 1 > cap / 2)
+		hsw_tbl_init(&sh->cur, sh->old.ngroup * 2);
+	else
+		hsw_tbl_init(&sh->cur, sh->old.ngroup);
+}
+
+/*--------------------------------------------------------------------
+ * The ->init method allows the management process to pass arguments
+ */
+
+static void __match_proto__(hash_init_f)
+hsw_init(int ac, char * const *av)
+{
+	unsigned u;
+
+	if (ac == 0)
+		return;
+	if (ac > 1)
+		ARGV_ERR("(-hswiss) too many arguments\n");
+	if (sscanf(av[0], "%u", &u) != 1 || u == 0 || u > 65536 ||
+	    (u & (u - 1)))
+		ARGV_ERR("(-hswiss) shards must be a power of two"
+		    " between 1 and 65536\n");
+	for (hsw_shardbits = 0; (1U << hsw_shardbits) < u; hsw_shardbits++)
+		continue;
+}
+
+static void __match_proto__(hash_start_f)
+hsw_start(void)
+{
+	unsigned u;
+
+	assert(hsw_shardbits <= 16);
+	lck_hsw = Lck_CreateClass("hsw");
+	hsw_shards = calloc(1U << hsw_shardbits, sizeof *hsw_shards);
+	XXXAN(hsw_shards);
+	for (u = 0; u < 1U << hsw_shardbits; u++) {
+		hsw_shards[u].magic = HSW_SHARD_MAGIC;
+		Lck_New(&hsw_shards[u].mtx, lck_hsw);
+		hsw_tbl_init(&hsw_shards[u].cur, HSW_MIN_GROUPS);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Lookup and possibly insert element.
+ * If nobj != NULL and the lookup does not find key, nobj is inserted.
+ * If nobj == NULL and the lookup does not find key, NULL is returned.
+ * A reference to the returned object is held.
+ */
+
+static struct objhead * __match_proto__(hash_lookup_f)
+hsw_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
+{
+	struct hsw_shard *sh;
+	struct objhead *oh;
+	int s;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(digest);
+	if (noh != NULL)
+		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
+
+	sh = hsw_shard(digest);
+	Lck_Lock(&sh->mtx);
+	if (sh->old.ngroup > 0)
+		hsw_migrate(sh, HSW_MIGRATE_GROUPS);
+	oh = NULL;
+	s = hsw_find(&sh->cur, digest);
+	if (s >= 0)
+		oh = sh->cur.slot[s];
+	else if ((s = hsw_find(&sh->old, digest)) >= 0)
+		oh = sh->old.slot[s];
+	if (oh != NULL) {
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		assert(oh->refcnt > 0);
+		oh->refcnt++;
+		Lck_Unlock(&sh->mtx);
+		Lck_Lock(HSH_Mtx(oh));
+		return (oh);
+	}
+
+	if (noh == NULL) {
+		Lck_Unlock(&sh->mtx);
+		return (NULL);
+	}
+
+	oh = *noh;
+	*noh = NULL;
+	memcpy(oh->digest, digest, sizeof oh->digest);
+	hsw_grow(sh);
+	hsw_place(&sh->cur, oh);
+	Lck_Unlock(&sh->mtx);
+	Lck_Lock(HSH_Mtx(oh));
+	return (oh);
+}
+
+/*--------------------------------------------------------------------
+ * Dereference and if no references are left, free.
+ */
+
+static int __match_proto__(hash_deref_f)
+hsw_deref(struct objhead *oh)
+{
+	struct hsw_shard *sh;
+	int s, ret;
+
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+	sh = hsw_shard(oh->digest);
+	Lck_Lock(&sh->mtx);
+	assert(oh->refcnt > 0);
+	if (--oh->refcnt == 0) {
+		s = hsw_find(&sh->cur, oh->digest);
+		if (s >= 0) {
+			assert(sh->cur.slot[s] == oh);
+			hsw_remove(&sh->cur, s);
+		} else {
+			s = hsw_find(&sh->old, oh->digest);
+			assert(s >= 0);
+			assert(sh->old.slot[s] == oh);
+			hsw_remove(&sh->old, s);
+		}
+		ret = 0;
+	} else
+		ret = 1;
+	if (sh->old.ngroup > 0)
+		hsw_migrate(sh, HSW_MIGRATE_GROUPS);
+	Lck_Unlock(&sh->mtx);
+	return (ret);
+}
+
+/*--------------------------------------------------------------------*/
+
+const struct hash_slinger hsw_slinger = {
+	.magic	=	SLINGER_MAGIC,
+	.name	=	"swiss",
+	.init	=	hsw_init,
+	.start	=	hsw_start,
+	.lookup =	hsw_lookup,
+	.deref	=	hsw_deref,
+};
@@ -32,22 +32,65 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "mgt/mgt.h"
 #include "common/heritage.h"
 
 #include "hash/hash_slinger.h"
+#include "storage/storage.h"
 #include "vav.h"
+#include "vrnd.h"
 
 static const struct choice hsh_choice[] = {
 	{ "classic",		&hcl_slinger },
 	{ "simple",		&hsl_slinger },
 	{ "simple_list",	&hsl_slinger },	/* backwards compat */
 	{ "critbit",		&hcb_slinger },
+	{ "critbit_rcu",	&hcr_slinger },
+	{ "swiss",		&hsw_slinger },
 	{ NULL,			NULL }
 };
 
+/*--------------------------------------------------------------------
+ * The digest=... option applies to all hash methods, take it out of
+ * the argument list before the slinger gets to see it.
+ */
+
+static void
+hsh_config_digest(char **av)
+{
+	struct stevedore *stv;
+	char **ap;
+	const char *p;
+
+	for (ap = av; *ap != NULL; ap++)
+		if (!strncmp(*ap, "digest=", 7))
+			break;
+	if (*ap == NULL)
+		return;
+	p = *ap + 7;
+	if (!strcmp(p, "sha256"))
+		heritage.hash_digest = HSH_DIGEST_SHA256;
+	else if (!strcmp(p, "fast"))
+		heritage.hash_digest = HSH_DIGEST_FAST;
+	else
+		ARGV_ERR("Unknown hash digest \"%s\" (use sha256 or fast)\n",
+		    p);
+	for (; *ap != NULL; ap++)
+		ap[0] = ap[1];
+	if (heritage.hash_digest != HSH_DIGEST_FAST)
+		return;
+
+	/* Silos find their objects again by digest after a restart */
+	STV_Foreach(stv)
+		if (!strcmp(stv->name, smp_stevedore.name))
+			ARGV_ERR("digest=fast can not be used with"
+			    " persistent storage (-s %s)\n", stv->ident);
+	AZ(VRND_RandomCrypto(heritage.hash_seed, sizeof heritage.hash_seed));
+}
+
 /*--------------------------------------------------------------------*/
 
 void
@@ -67,6 +110,8 @@ HSH_config(const char *h_arg)
 	if (av[1] == NULL)
 		ARGV_ERR("-h argument is empty\n");
 
+	hsh_config_digest(av + 2);
+
 	for (ac = 0; av[ac + 2] != NULL; ac++)
 		continue;
 
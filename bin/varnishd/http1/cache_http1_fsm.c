@@ -194,6 +194,8 @@ http1_reembark(struct worker *wrk, struct req *req)
 	/* Couldn't schedule, ditch */
 	wrk->stats->busy_wakeup--;
 	wrk->stats->busy_killed++;
+	if (req->hash_oc != NULL)
+		(void)HSH_DerefObjCore(wrk, &req->hash_oc, 0);
 	AN (req->vcl);
 	VCL_Rel(&req->vcl);
 	Req_AcctLogCharge(wrk->stats, req);
@@ -480,6 +482,9 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 				AN(req->ws->r);
 				WS_Release(req->ws, 0);
 				AN(req->hash_objhead);
+				if (req->hash_oc != NULL)
+					(void)HSH_DerefObjCore(wrk,
+					    &req->hash_oc, 0);
 				(void)HSH_DerefObjHead(wrk, &req->hash_objhead);
 				AZ(req->hash_objhead);
 				SES_Close(sp, SC_REM_CLOSE);
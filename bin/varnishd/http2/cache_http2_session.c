@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 
+#include "cache/cache_objhead.h"
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
@@ -366,6 +367,8 @@ h2_reembark(struct worker *wrk, struct req *req)
 	/* Couldn't schedule, ditch */
 	wrk->stats->busy_wakeup--;
 	wrk->stats->busy_killed++;
+	if (req->hash_oc != NULL)
+		(void)HSH_DerefObjCore(wrk, &req->hash_oc, 0);
 	AN (req->vcl);
 	VCL_Rel(&req->vcl);
 	Req_AcctLogCharge(wrk->stats, req);
@@ -112,6 +112,69 @@ static const struct stevedore smp_fake_stevedore = {
 	.init = smp_fake_init,
 };
 
+/*--------------------------------------------------------------------
+ * Find and remove a keyword=value argument, which can appear anywhere
+ * after the strategy, and return the value.
+ */
+
+static const char *
+stv_config_kw(char **av, const char *kw)
+{
+	char **ap;
+	const char *p;
+	size_t l;
+
+	l = strlen(kw);
+	for (ap = av; *ap != NULL; ap++)
+		if (!strncmp(*ap, kw, l) && (*ap)[l] == '=')
+			break;
+	if (*ap == NULL)
+		return (NULL);
+	p = *ap + l + 1;
+	for (; *ap != NULL; ap++)
+		ap[0] = ap[1];
+	return (p);
+}
+
+static void
+stv_config_kws(struct stevedore *stv, char **av)
+{
+	const char *p;
+
+	p = stv_config_kw(av, "policy");
+	if (p == NULL || !strcmp(p, "lru"))
+		stv->lru_policy = LRU_POLICY_LRU;
+	else if (!strcmp(p, "slru"))
+		stv->lru_policy = LRU_POLICY_SLRU;
+	else if (!strcmp(p, "tinylfu"))
+		stv->lru_policy = LRU_POLICY_TINYLFU;
+	else
+		ARGV_ERR("Unknown LRU policy \"%s\""
+		    " (use lru, slru or tinylfu)\n", p);
+
+	p = stv_config_kw(av, "hugepages");
+	if (p == NULL || !strcmp(p, "off"))
+		stv->hugepages = STV_HUGEPAGES_OFF;
+	else if (!strcmp(p, "advise"))
+		stv->hugepages = STV_HUGEPAGES_ADVISE;
+	else if (!strcmp(p, "on"))
+		stv->hugepages = STV_HUGEPAGES_ON;
+	else
+		ARGV_ERR("Unknown hugepages \"%s\""
+		    " (use off, advise or on)\n", p);
+
+	p = stv_config_kw(av, "prefault");
+	if (p == NULL || !strcmp(p, "off"))
+		stv->prefault = STV_PREFAULT_OFF;
+	else if (!strcmp(p, "on"))
+		stv->prefault = STV_PREFAULT_ON;
+	else if (!strcmp(p, "lock"))
+		stv->prefault = STV_PREFAULT_LOCK;
+	else
+		ARGV_ERR("Unknown prefault \"%s\""
+		    " (use off, on or lock)\n", p);
+}
+
 /*--------------------------------------------------------------------
  * Parse a stevedore argument on the form:
  *	[ name '=' ] strategy [ ',' arg ] *
@@ -120,6 +183,10 @@ static const struct stevedore smp_fake_stevedore = {
 static const struct choice STV_choice[] = {
 	{ "file",			&smf_stevedore },
 	{ "malloc",			&sma_stevedore },
+	{ "slab",			&sms_stevedore },
+	{ "disk",			&smd_stevedore },
+	{ "tiered",			&smt_stevedore },
+	{ "sized",			&smz_stevedore },
 	{ "deprecated_persistent",	&smp_stevedore },
 	{ "persistent",			&smp_fake_stevedore },
 #if defined(HAVE_LIBUMEM)
@@ -167,9 +234,6 @@ STV_Config(const char *spec)
 	if (av[1] == NULL)
 		ARGV_ERR("-s argument lacks strategy {malloc, file, ...}\n");
 
-	for (ac = 0; av[ac + 2] != NULL; ac++)
-		continue;
-
 	stv2 = MGT_Pick(STV_choice, av[1], "storage");
 	AN(stv2);
 
@@ -184,6 +248,9 @@ STV_Config(const char *spec)
 
 	*stv = *stv2;
 	AN(stv->name);
+	stv_config_kws(stv, av);
+	for (ac = 0; av[ac] != NULL; ac++)
+		continue;
 
 	if (name == NULL) {
 		bprintf(buf, "s%u", seq++);
@@ -143,7 +143,10 @@ smp_mgt_init(struct stevedore *parent, int ac, char * const *av)
 	ASSERT_MGT();
 
 	AZ(av[ac]);
-
+	if (parent->hugepages != STV_HUGEPAGES_OFF ||
+	    parent->prefault != STV_PREFAULT_OFF)
+		ARGV_ERR("(-spersistent) hugepages and prefault"
+		    " are not supported\n");
 
 #ifdef HAVE_SYS_PERSONALITY_H
 	i = personality(0xffffffff); /* Fetch old personality. */
@@ -156,7 +159,7 @@ smp_mgt_init(struct stevedore *parent, int ac, char * const *av)
 	}
 #endif
 
-	/* Necessary alignment. See also smp_object::__filler__ */
+	/* Necessary alignment. See also smp_object::check */
 	assert(sizeof(struct smp_object) % 8 == 0);
 
 #define SIZOF(foo)       fprintf(stderr, \
@@ -35,8 +35,12 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <sys/mman.h>
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "storage/storage.h"
 #include "vrt_obj.h"
@@ -44,7 +48,19 @@
 
 static pthread_mutex_t stv_mtx;
 
+/* Memory areas which asked for huge pages, and where to report them */
+struct stv_huge {
+	uintptr_t		lo;
+	uintptr_t		hi;
+	uint64_t		*vsc;
+	uint64_t		bytes;
+};
+
+static struct stv_huge *stv_huge;
+static unsigned stv_nhuge;
+
 /*--------------------------------------------------------------------
+ * Tiers are only used through their tiered or sized stevedore.
  * XXX: trust pointer writes to be atomic
  */
 
@@ -52,16 +68,23 @@ const struct stevedore *
 STV_next()
 {
 	static struct stevedore *stv;
-	struct stevedore *r;
+	struct stevedore *r = NULL, *first = NULL;
 
 	AZ(pthread_mutex_lock(&stv_mtx));
-	if (!STV__iter(&stv))
-		AN(STV__iter(&stv));
-	if (stv == stv_transient) {
-		stv = NULL;
-		AN(STV__iter(&stv));
+	while (r == NULL) {
+		if (!STV__iter(&stv))
+			AN(STV__iter(&stv));
+		if (stv == first) {
+			/* A full lap and nothing but Transient or tiers */
+			r = stv_transient;
+			break;
+		}
+		if (first == NULL)
+			first = stv;
+		if (stv != stv_transient && stv->tiered == NULL &&
+		    stv->sized == NULL)
+			r = stv;
 	}
-	r = stv;
 	AZ(pthread_mutex_unlock(&stv_mtx));
 	AN(r);
 	return (r);
@@ -93,6 +116,132 @@ STV_NewObject(struct worker *wrk, struct objcore *oc,
 	return (1);
 }
 
+/*--------------------------------------------------------------------
+ * Ask for huge pages for a memory area, and have how much of it
+ * actually got them reported in a VSC gauge.  Several areas can report
+ * in the same gauge.  The kernel may ignore us, and only tells in
+ * /proc/self/smaps, so where there is no such file the gauge stays 0.
+ */
+
+void
+STV_Hugepages(const struct stevedore *stv, void *p, size_t len,
+    uint64_t *vsc)
+{
+	struct stv_huge *h;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(p);
+	AN(vsc);
+	ASSERT_CLI();
+	if (stv->hugepages == STV_HUGEPAGES_OFF)
+		return;
+#ifdef MADV_HUGEPAGE
+	(void)madvise(p, len, MADV_HUGEPAGE);
+#endif
+	h = realloc(stv_huge, (stv_nhuge + 1L) * sizeof *stv_huge);
+	AN(h);
+	stv_huge = h;
+	h = &stv_huge[stv_nhuge++];
+	h->lo = (uintptr_t)p;
+	h->hi = h->lo + len;
+	h->vsc = vsc;
+	h->bytes = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Fault in, and optionally lock, a memory area before we start serving.
+ * Anonymous memory is written to, file backed memory only read, so
+ * nothing gets written back to the file.
+ */
+
+void
+STV_Prefault(const struct stevedore *stv, void *p, size_t len, int anon)
+{
+	volatile unsigned char *q;
+	unsigned char c = 0;
+	size_t o, pg;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(p);
+	if (stv->prefault == STV_PREFAULT_OFF)
+		return;
+	if (stv->prefault == STV_PREFAULT_LOCK) {
+		if (mlock(p, len) == 0)
+			return;
+		printf("Storage %s: could not lock %zu bytes (%s),"
+		    " prefaulting only\n",
+		    stv->ident, len, strerror(errno));
+	}
+	pg = getpagesize();
+	q = p;
+	for (o = 0; o < len; o += pg) {
+		if (anon)
+			q[o] = 0;
+		else
+			c += q[o];
+	}
+	(void)c;
+}
+
+static void
+stv_huge_update(FILE *f)
+{
+	struct stv_huge *h = NULL;
+	char buf[256], *e;
+	uintmax_t lo, hi, kb;
+	unsigned u;
+
+	for (u = 0; u < stv_nhuge; u++)
+		stv_huge[u].bytes = 0;
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		e = strchr(buf, ' ');
+		if (e == NULL)
+			continue;
+		if (e[-1] != ':') {
+			/* A new mapping */
+			h = NULL;
+			if (sscanf(buf, "%jx-%jx", &lo, &hi) != 2)
+				continue;
+			for (u = 0; u < stv_nhuge && h == NULL; u++)
+				if (lo < stv_huge[u].hi && hi > stv_huge[u].lo)
+					h = &stv_huge[u];
+			continue;
+		}
+		if (h == NULL)
+			continue;
+		if (strncmp(buf, "AnonHugePages:", 14) &&
+		    strncmp(buf, "ShmemPmdMapped:", 15) &&
+		    strncmp(buf, "FilePmdMapped:", 14) &&
+		    strncmp(buf, "Shared_Hugetlb:", 15) &&
+		    strncmp(buf, "Private_Hugetlb:", 16))
+			continue;
+		kb = strtoull(e, NULL, 10);
+		h->bytes += kb * 1024;
+	}
+	for (u = 0; u < stv_nhuge; u++)
+		*stv_huge[u].vsc = 0;
+	for (u = 0; u < stv_nhuge; u++)
+		*stv_huge[u].vsc += stv_huge[u].bytes;
+}
+
+static void * __match_proto__(bgthread_t)
+stv_huge_thread(struct worker *wrk, void *priv)
+{
+	FILE *f;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+	while (1) {
+		f = fopen("/proc/self/smaps", "r");
+		if (f != NULL) {
+			stv_huge_update(f);
+			AZ(fclose(f));
+		}
+		(void)sleep(10);
+	}
+	NEEDLESS(return NULL);
+}
+
 /*-------------------------------------------------------------------*/
 
 void
@@ -100,6 +249,7 @@ STV_open(void)
 {
 	struct stevedore *stv;
 	char buf[1024];
+	pthread_t pt;
 
 	ASSERT_CLI();
 	AZ(pthread_mutex_init(&stv_mtx, NULL));
@@ -110,6 +260,10 @@ STV_open(void)
 		if (stv->open != NULL)
 			stv->open(stv);
 	}
+	SML_Init();
+	LRU_Init();
+	if (stv_nhuge > 0)
+		WRK_BgThread(&pt, "stv-hugepages", stv_huge_thread, NULL);
 }
 
 void
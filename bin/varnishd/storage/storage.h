@@ -77,6 +77,7 @@ typedef void storage_panic_f(struct vsb *vsb, const struct objcore *oc);
 typedef struct object *sml_getobj_f(struct worker *, struct objcore *);
 typedef struct storage *sml_alloc_f(const struct stevedore *, size_t size);
 typedef void sml_free_f(struct storage *);
+typedef void sml_readahead_f(struct storage *, int ahead);
 
 /* Prototypes for VCL variable responders */
 #define VRTSTVVAR(nm,vt,ct,def) \
@@ -85,6 +86,24 @@ typedef void sml_free_f(struct storage *);
 
 /*--------------------------------------------------------------------*/
 
+enum lru_policy_e {
+	LRU_POLICY_LRU = 0,
+	LRU_POLICY_SLRU,
+	LRU_POLICY_TINYLFU,
+};
+
+enum stv_hugepages_e {
+	STV_HUGEPAGES_OFF = 0,
+	STV_HUGEPAGES_ADVISE,
+	STV_HUGEPAGES_ON,
+};
+
+enum stv_prefault_e {
+	STV_PREFAULT_OFF = 0,
+	STV_PREFAULT_ON,
+	STV_PREFAULT_LOCK,
+};
+
 struct stevedore {
 	unsigned		magic;
 #define STEVEDORE_MAGIC		0x4baf43db
@@ -105,12 +124,24 @@ struct stevedore {
 	sml_alloc_f		*sml_alloc;
 	sml_free_f		*sml_free;
 	sml_getobj_f		*sml_getobj;
+	sml_readahead_f		*sml_readahead;	/* optional */
 
 	const struct obj_methods
 				*methods;
 
 	/* Only if LRU is used */
 	struct lru		*lru;
+	enum lru_policy_e	lru_policy;
+
+	/* Only if a tiered stevedore moves objects in and out of it */
+	const struct stevedore	*tiered;
+
+	/* Only if a sized stevedore puts objects of some sizes in it */
+	const struct stevedore	*sized;
+
+	/* Only if the stevedore maps its memory */
+	enum stv_hugepages_e	hugepages;
+	enum stv_prefault_e	prefault;
 
 #define VRTSTVVAR(nm, vtype, ctype, dval) stv_var_##nm *var_##nm;
 #include "tbl/vrt_stv_var.h"
@@ -135,17 +166,34 @@ int STV__iter(struct stevedore ** const );
 int STV_GetFile(const char *fn, int *fdp, const char **fnp, const char *ctx);
 uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
     const char *ctx);
+void STV_Hugepages(const struct stevedore *, void *p, size_t len,
+    uint64_t *vsc);
+void STV_Prefault(const struct stevedore *, void *p, size_t len, int anon);
+
+/*--------------------------------------------------------------------*/
+void SML_Init(void);
+ssize_t SML_Freeable(struct worker *, struct objcore *);
 
 /*--------------------------------------------------------------------*/
-struct lru *LRU_Alloc(void);
+void LRU_Init(void);
+struct lru *LRU_Alloc(const struct stevedore *);
 void LRU_Free(struct lru **);
 void LRU_Add(struct objcore *, double now);
 void LRU_Remove(struct objcore *);
+int LRU_Replace(struct objcore *, struct objcore *noc);
 int LRU_NukeOne(struct worker *, struct lru *);
+unsigned LRU_Nuke(struct worker *, struct lru *, ssize_t bytes);
+unsigned LRU_Borrow(struct worker *, struct lru *, ssize_t bytes,
+    struct objcore **, unsigned nmax);
+int LRU_Admit(struct worker *, struct lru *, const struct objcore *);
 void LRU_Touch(struct worker *, struct objcore *, double now);
 
 /*--------------------------------------------------------------------*/
 extern const struct stevedore smu_stevedore;
 extern const struct stevedore sma_stevedore;
 extern const struct stevedore smf_stevedore;
+extern const struct stevedore sms_stevedore;
+extern const struct stevedore smd_stevedore;
+extern const struct stevedore smt_stevedore;
+extern const struct stevedore smz_stevedore;
 extern const struct stevedore smp_stevedore;
@@ -0,0 +1,562 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage method which reads and writes a file, instead of mapping it
+ *
+ * Objects are fetched into RAM, and when the body is complete its
+ * segments are written to the file, with O_DIRECT so the page cache
+ * does not keep a second copy.  After that the RAM copy of a segment
+ * is only a cache, and the least recently used ones are dropped when
+ * the RAM in use goes over the limit.  When a body is delivered, the
+ * segments not in RAM are read back, and the next few are read ahead
+ * while the current one is sent, so delivery waits for the disk as
+ * little as possible, and never in a page fault.
+ *
+ * Object headers and auxiliary attributes always stay in RAM.  They
+ * also get space in the file, so that the file is what limits the
+ * storage, and nuking works the way it does for the other stevedores.
+ *
+ * Nothing is kept across restarts.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_obj.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vfil.h"
+#include "vnum.h"
+#include "vtree.h"
+
+#include "storage/storage_disk.h"
+
+#include "VSC_smd.h"
+
+struct smd_ext {
+	unsigned		magic;
+#define SMD_EXT_MAGIC		0x93d1a06b
+	int			free;
+	off_t			off;
+	off_t			size;
+	VTAILQ_ENTRY(smd_ext)	order;
+	VRB_ENTRY(smd_ext)	tree;
+};
+
+static struct VSC_lck *lck_smd;
+static struct obj_methods smd_methods;
+
+/*--------------------------------------------------------------------
+ * Space in the file.  As in the file stevedore, the free extents are
+ * kept in a tree by size and offset, and coalesced with the neighbours
+ * in the address ordered list.
+ */
+
+static inline int
+smd_ext_cmp(const struct smd_ext *a, const struct smd_ext *b)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	if (a->off != b->off)
+		return (a->off < b->off ? -1 : 1);
+	return (0);
+}
+
+VRB_PROTOTYPE_STATIC(smd_tree, smd_ext, tree, smd_ext_cmp)
+VRB_GENERATE_STATIC(smd_tree, smd_ext, tree, smd_ext_cmp)
+
+static struct smd_ext *
+smd_ext_alloc(struct smd_sc *sc, off_t size)
+{
+	struct smd_ext *e, *e2, key;
+
+	Lck_AssertHeld(&sc->mtx);
+	key.size = size;
+	key.off = 0;
+	e = VRB_NFIND(smd_tree, &sc->free, &key);
+	if (e == NULL)
+		return (NULL);
+	CHECK_OBJ(e, SMD_EXT_MAGIC);
+	AN(e->free);
+	AN(VRB_REMOVE(smd_tree, &sc->free, e));
+	if (e->size > size) {
+		ALLOC_OBJ(e2, SMD_EXT_MAGIC);
+		AN(e2);
+		e2->free = 1;
+		e2->off = e->off + size;
+		e2->size = e->size - size;
+		e->size = size;
+		VTAILQ_INSERT_AFTER(&sc->order, e, e2, order);
+		AZ(VRB_INSERT(smd_tree, &sc->free, e2));
+	}
+	e->free = 0;
+	return (e);
+}
+
+static void
+smd_ext_free(struct smd_sc *sc, struct smd_ext *e)
+{
+	struct smd_ext *e2;
+
+	Lck_AssertHeld(&sc->mtx);
+	CHECK_OBJ_NOTNULL(e, SMD_EXT_MAGIC);
+	AZ(e->free);
+	e->free = 1;
+	e2 = VTAILQ_NEXT(e, order);
+	if (e2 != NULL && e2->free) {
+		AN(VRB_REMOVE(smd_tree, &sc->free, e2));
+		e->size += e2->size;
+		VTAILQ_REMOVE(&sc->order, e2, order);
+		FREE_OBJ(e2);
+	}
+	e2 = VTAILQ_PREV(e, smd_exthead, order);
+	if (e2 != NULL && e2->free) {
+		AN(VRB_REMOVE(smd_tree, &sc->free, e2));
+		e2->size += e->size;
+		VTAILQ_REMOVE(&sc->order, e, order);
+		FREE_OBJ(e);
+		e = e2;
+	}
+	AZ(VRB_INSERT(smd_tree, &sc->free, e));
+}
+
+/*--------------------------------------------------------------------
+ * The RAM cache, must hold the lock.  Only segments with a good copy
+ * on disk, and nobody using them, are on the LRU.
+ */
+
+static void
+smd_lru_add(struct smd_sc *sc, struct smd_seg *seg)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	if (seg->refcnt > 0 || seg->s.ptr == NULL ||
+	    (seg->flags & (SMD_F_DISK | SMD_F_IO | SMD_F_LRU)) != SMD_F_DISK)
+		return;
+	VTAILQ_INSERT_TAIL(&sc->lru, seg, lru);
+	seg->flags |= SMD_F_LRU;
+}
+
+static void
+smd_lru_del(struct smd_sc *sc, struct smd_seg *seg)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	if (!(seg->flags & SMD_F_LRU))
+		return;
+	VTAILQ_REMOVE(&sc->lru, seg, lru);
+	seg->flags &= ~SMD_F_LRU;
+}
+
+static void
+smd_ram_trim(struct smd_sc *sc)
+{
+	struct smd_seg *seg, *seg2;
+
+	Lck_AssertHeld(&sc->mtx);
+	VTAILQ_FOREACH_SAFE(seg, &sc->lru, lru, seg2) {
+		if (sc->ram <= sc->ramsize)
+			break;
+		/*
+		 * Streaming readers use the RAM copy without asking us,
+		 * but they hold the boc, so segments only get here from
+		 * smd_bocdone() once they are done.
+		 */
+		smd_lru_del(sc, seg);
+		free(seg->s.ptr);
+		seg->s.ptr = NULL;
+		sc->ram -= seg->ramlen;
+		sc->stats->c_evict++;
+	}
+	sc->stats->g_ram = sc->ram;
+}
+
+/* Start reading a segment back, unless it is in RAM or on its way */
+
+static int
+smd_read(struct smd_sc *sc, struct smd_seg *seg)
+{
+	void *p;
+
+	Lck_AssertHeld(&sc->mtx);
+	if (seg->s.ptr != NULL || (seg->flags & SMD_F_IO) ||
+	    !(seg->flags & SMD_F_DISK))
+		return (0);
+	if (posix_memalign(&p, SMD_BLOCK, seg->ramlen))
+		return (0);
+	seg->s.ptr = p;
+	sc->ram += seg->ramlen;
+	seg->flags |= SMD_F_IO;
+	seg->flags &= ~SMD_F_RERR;
+	sc->io->submit(sc, seg);
+	return (1);
+}
+
+void
+smd_io_done(struct smd_sc *sc, struct smd_seg *seg, ssize_t res)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	CHECK_OBJ_NOTNULL(seg, SMD_SEG_MAGIC);
+	assert(seg->flags & SMD_F_IO);
+	if (seg->flags & SMD_F_WRITE) {
+		if (res == (ssize_t)seg->iolen) {
+			seg->flags |= SMD_F_DISK;
+			sc->stats->c_write++;
+			sc->stats->c_write_bytes += seg->iolen;
+		} else {
+			seg->flags |= SMD_F_WERR;
+			sc->stats->c_io_error++;
+		}
+	} else if (res == (ssize_t)seg->iolen) {
+		sc->stats->c_read++;
+		sc->stats->c_read_bytes += seg->iolen;
+	} else {
+		seg->flags |= SMD_F_RERR;
+		sc->stats->c_io_error++;
+		free(seg->s.ptr);
+		seg->s.ptr = NULL;
+		sc->ram -= seg->ramlen;
+	}
+	seg->flags &= ~(SMD_F_IO | SMD_F_WRITE);
+	smd_lru_add(sc, seg);
+	smd_ram_trim(sc);
+	AZ(pthread_cond_broadcast(&sc->cond));
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct storage * __match_proto__(sml_alloc_f)
+smd_alloc(const struct stevedore *stv, size_t size)
+{
+	struct smd_sc *sc;
+	struct smd_seg *seg;
+	struct smd_ext *e = NULL;
+	size_t ramlen;
+	void *p = NULL;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMD_SC_MAGIC);
+	assert(size > 0);
+	ramlen = RUP2(size, SMD_BLOCK);
+
+	ALLOC_OBJ(seg, SMD_SEG_MAGIC);
+	if (seg != NULL && posix_memalign(&p, SMD_BLOCK, ramlen))
+		p = NULL;
+
+	Lck_Lock(&sc->mtx);
+	sc->stats->c_req++;
+	if (p != NULL)
+		e = smd_ext_alloc(sc, ramlen);
+	if (e == NULL) {
+		sc->stats->c_fail++;
+		Lck_Unlock(&sc->mtx);
+		free(p);
+		if (seg != NULL)
+			FREE_OBJ(seg);
+		return (NULL);
+	}
+	seg->sc = sc;
+	seg->ext = e;
+	seg->off = e->off;
+	seg->ramlen = ramlen;
+	sc->ram += ramlen;
+	sc->stats->g_alloc++;
+	sc->stats->c_bytes += size;
+	sc->stats->g_bytes += size;
+	sc->stats->g_space -= ramlen;
+	smd_ram_trim(sc);
+	Lck_Unlock(&sc->mtx);
+
+	seg->s.magic = STORAGE_MAGIC;
+	seg->s.priv = seg;
+	seg->s.ptr = p;
+	seg->s.space = size;
+	seg->s.len = 0;
+	return (&seg->s);
+}
+
+static void __match_proto__(sml_free_f)
+smd_free(struct storage *st)
+{
+	struct smd_sc *sc;
+	struct smd_seg *seg;
+	void *p;
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(seg, st->priv, SMD_SEG_MAGIC);
+	sc = seg->sc;
+	Lck_Lock(&sc->mtx);
+	while (seg->flags & SMD_F_IO)
+		(void)Lck_CondWait(&sc->cond, &sc->mtx, 0);
+	AZ(seg->refcnt);
+	smd_lru_del(sc, seg);
+	p = seg->s.ptr;
+	if (p != NULL)
+		sc->ram -= seg->ramlen;
+	smd_ext_free(sc, seg->ext);
+	sc->stats->g_alloc--;
+	sc->stats->c_freed += seg->s.space;
+	sc->stats->g_bytes -= seg->s.space;
+	sc->stats->g_space += seg->ramlen;
+	sc->stats->g_ram = sc->ram;
+	Lck_Unlock(&sc->mtx);
+	free(p);
+	FREE_OBJ(seg);
+}
+
+/*--------------------------------------------------------------------
+ * When the body is complete, write it out
+ */
+
+static void __match_proto__(objbocdone_f)
+smd_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
+{
+	struct smd_sc *sc;
+	struct object *o;
+	struct storage *st;
+	struct smd_seg *seg;
+
+	SML_methods.objbocdone(wrk, oc, boc);
+	if (boc->state == BOS_FAILED)
+		return;
+	CAST_OBJ_NOTNULL(sc, oc->stobj->stevedore->priv, SMD_SC_MAGIC);
+	CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+	Lck_Lock(&sc->mtx);
+	VTAILQ_FOREACH(st, &o->list, list) {
+		CAST_OBJ_NOTNULL(seg, st->priv, SMD_SEG_MAGIC);
+		AZ(seg->flags);
+		if (st->len == 0) {
+			seg->flags |= SMD_F_DISK;
+			smd_lru_add(sc, seg);
+			continue;
+		}
+		seg->iolen = RUP2(st->len, SMD_BLOCK);
+		assert(seg->iolen <= seg->ramlen);
+		seg->flags |= SMD_F_IO | SMD_F_WRITE;
+		sc->io->submit(sc, seg);
+	}
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Deliver, reading back what is not in RAM
+ */
+
+static int __match_proto__(objiterator_f)
+smd_iterator(struct worker *wrk, struct objcore *oc,
+    void *priv, objiterate_f *func, int final)
+{
+	const struct stevedore *stv;
+	struct smd_sc *sc;
+	struct object *o;
+	struct storage *st, *stn, *st2;
+	struct smd_seg *seg, *seg2;
+	struct boc *boc;
+	unsigned n;
+	void *p;
+	int ret = 0;
+
+	boc = HSH_RefBoc(oc);
+	if (boc != NULL) {
+		/* Still being fetched, all of it is in RAM */
+		ret = SML_methods.objiterator(wrk, oc, priv, func, final);
+		HSH_DerefBoc(wrk, oc);
+		return (ret);
+	}
+
+	stv = oc->stobj->stevedore;
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMD_SC_MAGIC);
+	CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+	VTAILQ_FOREACH_SAFE(st, &o->list, list, stn) {
+		if (ret == 0 && st->len > 0) {
+			CAST_OBJ_NOTNULL(seg, st->priv, SMD_SEG_MAGIC);
+			Lck_Lock(&sc->mtx);
+			seg->refcnt++;
+			smd_lru_del(sc, seg);
+			(void)smd_read(sc, seg);
+			for (n = 0, st2 = stn;
+			    st2 != NULL && n < cache_param->readahead;
+			    st2 = VTAILQ_NEXT(st2, list), n++) {
+				CAST_OBJ_NOTNULL(seg2, st2->priv,
+				    SMD_SEG_MAGIC);
+				sc->stats->c_readahead += smd_read(sc, seg2);
+			}
+			if ((seg->flags & (SMD_F_IO | SMD_F_WRITE)) ==
+			    SMD_F_IO) {
+				sc->stats->c_wait++;
+				do
+					(void)Lck_CondWait(&sc->cond,
+					    &sc->mtx, 0);
+				while (seg->flags & SMD_F_IO);
+			}
+			p = seg->s.ptr;
+			Lck_Unlock(&sc->mtx);
+
+			ret = p == NULL ? -1 : func(priv, 1, p, st->len);
+
+			Lck_Lock(&sc->mtx);
+			assert(seg->refcnt > 0);
+			seg->refcnt--;
+			smd_lru_add(sc, seg);
+			smd_ram_trim(sc);
+			Lck_Unlock(&sc->mtx);
+		}
+		if (final) {
+			VTAILQ_REMOVE(&o->list, st, list);
+			stv->sml_free(st);
+		} else if (ret)
+			break;
+	}
+	return (ret);
+}
+
+/*--------------------------------------------------------------------*/
+
+static VCL_BYTES __match_proto__(stv_var_used_space)
+smd_used_space(const struct stevedore *stv)
+{
+	struct smd_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMD_SC_MAGIC);
+	return (sc->filesize - sc->stats->g_space);
+}
+
+static VCL_BYTES __match_proto__(stv_var_free_space)
+smd_free_space(const struct stevedore *stv)
+{
+	struct smd_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMD_SC_MAGIC);
+	return (sc->stats->g_space);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+smd_init(struct stevedore *parent, int ac, char * const *av)
+{
+	const char *size = NULL, *e;
+	struct smd_sc *sc;
+	unsigned granularity = SMD_BLOCK;
+	uintmax_t u;
+
+	ASSERT_MGT();
+	AZ(av[ac]);
+	if (ac > 3)
+		ARGV_ERR("(-sdisk) too many arguments\n");
+	if (ac < 1 || *av[0] == '\0')
+		ARGV_ERR("(-sdisk) path is mandatory\n");
+	if (ac > 1 && *av[1] != '\0')
+		size = av[1];
+
+	ALLOC_OBJ(sc, SMD_SC_MAGIC);
+	AN(sc);
+	parent->priv = sc;
+
+	(void)STV_GetFile(av[0], &sc->fd, &sc->filename, "-sdisk");
+	MCH_Fd_Inherit(sc->fd, "storage_disk");
+	sc->filesize = STV_FileSize(sc->fd, size, &granularity, "-sdisk");
+	sc->filesize -= sc->filesize % SMD_BLOCK;
+	if (VFIL_allocate(sc->fd, (off_t)sc->filesize, 0))
+		ARGV_ERR("(-sdisk) allocation error: %s\n", strerror(errno));
+
+	sc->ramsize = sc->filesize / 8;
+	if (ac > 2 && *av[2] != '\0') {
+		e = VNUM_2bytes(av[2], &u, 0);
+		if (e != NULL)
+			ARGV_ERR("(-sdisk) ramsize \"%s\": %s\n", av[2], e);
+		sc->ramsize = u;
+	}
+}
+
+static void __match_proto__(storage_open_f)
+smd_open(struct stevedore *st)
+{
+	struct smd_sc *sc;
+	struct smd_ext *e;
+	int fl;
+
+	ASSERT_CLI();
+	st->lru = LRU_Alloc(st);
+	if (lck_smd == NULL)
+		lck_smd = Lck_CreateClass("smd");
+	CAST_OBJ_NOTNULL(sc, st->priv, SMD_SC_MAGIC);
+	sc->ident = st->ident;
+	Lck_New(&sc->mtx, lck_smd);
+	AZ(pthread_cond_init(&sc->cond, NULL));
+	sc->stats = VSC_smd_New(st->ident);
+	VTAILQ_INIT(&sc->lru);
+
+#ifdef O_DIRECT
+	fl = fcntl(sc->fd, F_GETFL);
+	assert(fl != -1);
+	if (fcntl(sc->fd, F_SETFL, fl | O_DIRECT))
+		printf("SMD.%s no O_DIRECT (%s),"
+		    " going through the page cache\n",
+		    st->ident, strerror(errno));
+#else
+	(void)fl;
+#endif
+
+	VTAILQ_INIT(&sc->order);
+	VRB_INIT(&sc->free);
+	ALLOC_OBJ(e, SMD_EXT_MAGIC);
+	AN(e);
+	e->free = 1;
+	e->size = sc->filesize;
+	VTAILQ_INSERT_HEAD(&sc->order, e, order);
+	AZ(VRB_INSERT(smd_tree, &sc->free, e));
+	sc->stats->g_space = sc->filesize;
+
+	smd_methods = SML_methods;
+	smd_methods.objiterator = smd_iterator;
+	smd_methods.objbocdone = smd_bocdone;
+
+	SMD_IoInit(sc);
+}
+
+const struct stevedore smd_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"disk",
+	.init		=	smd_init,
+	.open		=	smd_open,
+	.sml_alloc	=	smd_alloc,
+	.sml_free	=	smd_free,
+	.allocobj	=	SML_allocobj,
+	.panic		=	SML_panic,
+	.methods	=	&smd_methods,
+	.var_free_space	=	smd_free_space,
+	.var_used_space	=	smd_used_space,
+};
@@ -0,0 +1,95 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Disk stevedore, shared between the stevedore and its I/O engines
+ */
+
+#define SMD_BLOCK		4096	/* O_DIRECT alignment */
+
+struct smd_ext;
+
+struct smd_seg {
+	unsigned		magic;
+#define SMD_SEG_MAGIC		0x6a1f0c5d
+	unsigned		flags;
+#define SMD_F_DISK		(1U<<0)	/* Good copy on disk */
+#define SMD_F_IO		(1U<<1)	/* I/O in flight */
+#define SMD_F_WRITE		(1U<<2)	/* ... and it is a write */
+#define SMD_F_LRU		(1U<<3)	/* On the RAM LRU */
+#define SMD_F_WERR		(1U<<4)	/* Write failed, keep in RAM */
+#define SMD_F_RERR		(1U<<5)	/* Read failed */
+	unsigned		refcnt;
+	struct storage		s;
+	struct smd_sc		*sc;
+	struct smd_ext		*ext;
+	off_t			off;	/* On disk */
+	size_t			ramlen;
+	size_t			iolen;
+	VTAILQ_ENTRY(smd_seg)	lru;
+	VTAILQ_ENTRY(smd_seg)	ioq;
+};
+
+VTAILQ_HEAD(smd_seghead, smd_seg);
+
+struct smd_ioengine;
+
+struct smd_sc {
+	unsigned		magic;
+#define SMD_SC_MAGIC		0x2e7b4a91
+	struct lock		mtx;
+	pthread_cond_t		cond;	/* I/O completions */
+	struct VSC_smd		*stats;
+	const char		*ident;
+
+	const char		*filename;
+	int			fd;
+	uintmax_t		filesize;
+	size_t			ramsize;
+	size_t			ram;
+
+	VTAILQ_HEAD(smd_exthead, smd_ext) order;
+	VRB_HEAD(smd_tree, smd_ext) free;
+
+	struct smd_seghead	lru;
+
+	const struct smd_ioengine *io;
+	void			*io_priv;
+	struct smd_seghead	ioq;	/* Not yet submitted */
+};
+
+/* storage_disk.c */
+void smd_io_done(struct smd_sc *, struct smd_seg *, ssize_t res);
+
+/* storage_disk_io.c */
+typedef int smd_io_init_f(struct smd_sc *);
+typedef void smd_io_submit_f(struct smd_sc *, struct smd_seg *);
+
+struct smd_ioengine {
+	const char		*name;
+	smd_io_init_f		*init;
+	smd_io_submit_f		*submit;	/* Called with the lock held */
+};
+
+void SMD_IoInit(struct smd_sc *);
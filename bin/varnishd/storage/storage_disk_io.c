@@ -0,0 +1,365 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * I/O engines for the disk stevedore
+ *
+ * An engine takes segments with SMD_F_IO set, reads or writes iolen
+ * bytes between the buffer and the file, and calls smd_io_done() with
+ * the lock held.  Submissions come in with the lock held too.
+ *
+ * Where the kernel has it, io_uring is used, with one thread reaping
+ * the completions.  Otherwise a few threads do pread(2) and pwrite(2).
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "storage/storage.h"
+#include "vtree.h"
+
+#include "storage/storage_disk.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  include "vmb.h"
+#endif
+
+/*--------------------------------------------------------------------
+ * Threads
+ */
+
+#define SMD_NTHREAD		4
+
+struct smd_threads {
+	unsigned		magic;
+#define SMD_THREADS_MAGIC	0x51c8d2e6
+	pthread_cond_t		cond;
+	struct smd_sc		*sc;
+};
+
+static void * __match_proto__(bgthread_t)
+smd_thread(struct worker *wrk, void *priv)
+{
+	struct smd_threads *t;
+	struct smd_sc *sc;
+	struct smd_seg *seg;
+	ssize_t res;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(t, priv, SMD_THREADS_MAGIC);
+	sc = t->sc;
+	Lck_Lock(&sc->mtx);
+	while (1) {
+		seg = VTAILQ_FIRST(&sc->ioq);
+		if (seg == NULL) {
+			(void)Lck_CondWait(&t->cond, &sc->mtx, 0);
+			continue;
+		}
+		VTAILQ_REMOVE(&sc->ioq, seg, ioq);
+		Lck_Unlock(&sc->mtx);
+		if (seg->flags & SMD_F_WRITE)
+			res = pwrite(sc->fd, seg->s.ptr, seg->iolen, seg->off);
+		else
+			res = pread(sc->fd, seg->s.ptr, seg->iolen, seg->off);
+		if (res < 0)
+			res = -errno;
+		Lck_Lock(&sc->mtx);
+		smd_io_done(sc, seg, res);
+	}
+	NEEDLESS(return (NULL));
+}
+
+static int __match_proto__(smd_io_init_f)
+smd_threads_init(struct smd_sc *sc)
+{
+	struct smd_threads *t;
+	pthread_t pt;
+	unsigned u;
+
+	ALLOC_OBJ(t, SMD_THREADS_MAGIC);
+	AN(t);
+	AZ(pthread_cond_init(&t->cond, NULL));
+	t->sc = sc;
+	sc->io_priv = t;
+	for (u = 0; u < SMD_NTHREAD; u++)
+		WRK_BgThread(&pt, "smd-io", smd_thread, t);
+	return (0);
+}
+
+static void __match_proto__(smd_io_submit_f)
+smd_threads_submit(struct smd_sc *sc, struct smd_seg *seg)
+{
+	struct smd_threads *t;
+
+	Lck_AssertHeld(&sc->mtx);
+	CAST_OBJ_NOTNULL(t, sc->io_priv, SMD_THREADS_MAGIC);
+	VTAILQ_INSERT_TAIL(&sc->ioq, seg, ioq);
+	AZ(pthread_cond_signal(&t->cond));
+}
+
+static const struct smd_ioengine smd_threads_engine = {
+	.name =		"threads",
+	.init =		smd_threads_init,
+	.submit =	smd_threads_submit,
+};
+
+/*--------------------------------------------------------------------
+ * io_uring, by way of the raw system calls, so no library is needed
+ */
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#define SMD_URING_ENTRIES	256
+
+struct smd_uring {
+	unsigned		magic;
+#define SMD_URING_MAGIC		0x0be1d7a4
+	int			fd;
+	unsigned		inflight;
+	unsigned		maxinflight;
+
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	unsigned		*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+/* Returns non-zero if there was no room */
+
+static int
+smd_uring_push(struct smd_uring *u, const struct smd_sc *sc,
+    struct smd_seg *seg)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head, tail, idx;
+
+	if (u->inflight >= u->maxinflight)
+		return (1);
+	head = *(volatile unsigned *)u->sq_head;
+	VRMB();
+	tail = *u->sq_tail;
+	if (tail - head >= u->sq_entries)
+		return (1);
+	idx = tail & u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = (seg->flags & SMD_F_WRITE) ?
+	    IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = sc->fd;
+	sqe->addr = (uintptr_t)seg->s.ptr;
+	sqe->len = seg->iolen;
+	sqe->off = seg->off;
+	sqe->user_data = (uintptr_t)seg;
+	u->sq_array[idx] = idx;
+	VWMB();
+	*(volatile unsigned *)u->sq_tail = tail + 1;
+	VWMB();
+	u->inflight++;
+	return (0);
+}
+
+static void
+smd_uring_enter(const struct smd_uring *u, unsigned n)
+{
+	int i;
+
+	do
+		i = syscall(__NR_io_uring_enter, u->fd, n, 0, 0, NULL, 0);
+	while (i < 0 && (errno == EINTR || errno == EAGAIN));
+	assert(i >= 0);
+}
+
+static void * __match_proto__(bgthread_t)
+smd_uring_thread(struct worker *wrk, void *priv)
+{
+	struct smd_sc *sc;
+	struct smd_uring *u;
+	struct io_uring_cqe *cqe;
+	struct smd_seg *seg;
+	unsigned head, tail, n;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sc, priv, SMD_SC_MAGIC);
+	CAST_OBJ_NOTNULL(u, sc->io_priv, SMD_URING_MAGIC);
+	while (1) {
+		i = syscall(__NR_io_uring_enter, u->fd, 0, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+		assert(i >= 0 || errno == EINTR);
+		Lck_Lock(&sc->mtx);
+		head = *u->cq_head;
+		tail = *(volatile unsigned *)u->cq_tail;
+		VRMB();
+		while (head != tail) {
+			cqe = &u->cqes[head & u->cq_mask];
+			seg = (void *)(uintptr_t)cqe->user_data;
+			CHECK_OBJ_NOTNULL(seg, SMD_SEG_MAGIC);
+			assert(u->inflight > 0);
+			u->inflight--;
+			smd_io_done(sc, seg, cqe->res);
+			head++;
+		}
+		VWMB();
+		*(volatile unsigned *)u->cq_head = head;
+
+		/* Now there is room for what had to wait */
+		n = 0;
+		while ((seg = VTAILQ_FIRST(&sc->ioq)) != NULL) {
+			if (smd_uring_push(u, sc, seg))
+				break;
+			VTAILQ_REMOVE(&sc->ioq, seg, ioq);
+			n++;
+		}
+		if (n > 0)
+			smd_uring_enter(u, n);
+		Lck_Unlock(&sc->mtx);
+	}
+	NEEDLESS(return (NULL));
+}
+
+static int __match_proto__(smd_io_init_f)
+smd_uring_init(struct smd_sc *sc)
+{
+	struct io_uring_params p;
+	struct smd_uring *u;
+	size_t sqsz, cqsz;
+	uint8_t *sq, *cq;
+	pthread_t pt;
+	int fd;
+
+	memset(&p, 0, sizeof p);
+	fd = syscall(__NR_io_uring_setup, SMD_URING_ENTRIES, &p);
+	if (fd < 0)
+		return (-1);
+	/* IORING_OP_READ and _WRITE came with this */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		closefd(&fd);
+		return (-1);
+	}
+
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sqsz = cqsz = (sqsz > cqsz ? sqsz : cqsz);
+	sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) {
+		closefd(&fd);
+		return (-1);
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		cq = sq;
+	else
+		cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	AN(cq != MAP_FAILED);
+
+	ALLOC_OBJ(u, SMD_URING_MAGIC);
+	AN(u);
+	u->fd = fd;
+	u->sq_head = (void *)(sq + p.sq_off.head);
+	u->sq_tail = (void *)(sq + p.sq_off.tail);
+	u->sq_mask = *(unsigned *)(void *)(sq + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_array = (void *)(sq + p.sq_off.array);
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	    IORING_OFF_SQES);
+	AN(u->sqes != MAP_FAILED);
+	u->cq_head = (void *)(cq + p.cq_off.head);
+	u->cq_tail = (void *)(cq + p.cq_off.tail);
+	u->cq_mask = *(unsigned *)(void *)(cq + p.cq_off.ring_mask);
+	u->cqes = (void *)(cq + p.cq_off.cqes);
+	/* Never more in flight than the completion ring holds */
+	u->maxinflight = p.cq_entries;
+
+	sc->io_priv = u;
+	WRK_BgThread(&pt, "smd-uring", smd_uring_thread, sc);
+	return (0);
+}
+
+static void __match_proto__(smd_io_submit_f)
+smd_uring_submit(struct smd_sc *sc, struct smd_seg *seg)
+{
+	struct smd_uring *u;
+
+	Lck_AssertHeld(&sc->mtx);
+	CAST_OBJ_NOTNULL(u, sc->io_priv, SMD_URING_MAGIC);
+	if (!VTAILQ_EMPTY(&sc->ioq) || smd_uring_push(u, sc, seg)) {
+		VTAILQ_INSERT_TAIL(&sc->ioq, seg, ioq);
+		return;
+	}
+	smd_uring_enter(u, 1);
+}
+
+static const struct smd_ioengine smd_uring_engine = {
+	.name =		"io_uring",
+	.init =		smd_uring_init,
+	.submit =	smd_uring_submit,
+};
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/*--------------------------------------------------------------------*/
+
+static const struct smd_ioengine * const smd_engines[] = {
+#ifdef HAVE_LINUX_IO_URING_H
+	&smd_uring_engine,
+#endif
+	&smd_threads_engine,
+	NULL
+};
+
+void
+SMD_IoInit(struct smd_sc *sc)
+{
+	const struct smd_ioengine * const *e;
+
+	CHECK_OBJ_NOTNULL(sc, SMD_SC_MAGIC);
+	VTAILQ_INIT(&sc->ioq);
+	for (e = smd_engines; *e != NULL; e++) {
+		if ((*e)->init(sc) == 0) {
+			sc->io = *e;
+			printf("SMD.%s using %s\n", sc->ident, (*e)->name);
+			return;
+		}
+	}
+	WRONG("No I/O engine");
+}
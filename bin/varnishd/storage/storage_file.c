@@ -43,8 +43,10 @@
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
 
+#include "vatomic.h"
 #include "vnum.h"
 #include "vfil.h"
+#include "vtree.h"
 
 #include "VSC_smf.h"
 
@@ -59,13 +61,17 @@
 #define MINPAGES		128
 
 /*
- * Number of buckets on free-list.
- *
- * Last bucket is "larger than" so choose number so that the second
- * to last bucket matches the 128k CHUNKSIZE in cache_fetch.c when
- * using the a 4K minimal page size
+ * Free ranges of this many pages or more count as large in the stats.
+ * Chosen to match the 128k CHUNKSIZE in cache_fetch.c when using a 4K
+ * minimal page size.
  */
-#define NBUCKET			(128 / 4 + 1)
+#define SMF_LARGE		(128 / 4 + 1)
+
+/* Buckets of the free range histogram, by powers of four pages */
+#define SMF_NHIST		8
+
+/* Most we ask the kernel to read in at once for delivery */
+#define SMF_RA_MAX		(1024 * 1024)
 
 static struct VSC_lck *lck_smf;
 
@@ -80,16 +86,20 @@ struct smf {
 	struct smf_sc		*sc;
 
 	int			alloc;
+	int			ra;		/* read ahead */
+	int			seq;		/* MADV_SEQUENTIAL */
 
 	off_t			size;
 	off_t			offset;
 	unsigned char		*ptr;
 
 	VTAILQ_ENTRY(smf)	order;
-	VTAILQ_ENTRY(smf)	status;
-	struct smfhead		*flist;
+	VTAILQ_ENTRY(smf)	status;		/* when alloc */
+	VRB_ENTRY(smf)		tree;		/* when free */
 };
 
+VRB_HEAD(smf_tree, smf);
+
 struct smf_sc {
 	unsigned		magic;
 #define SMF_SC_MAGIC		0x52962ee7
@@ -102,10 +112,32 @@ struct smf_sc {
 	uintmax_t		filesize;
 	int			advice;
 	struct smfhead		order;
-	struct smfhead		free[NBUCKET];
+	struct smf_tree		free;
 	struct smfhead		used;
+	uint64_t		*hist[SMF_NHIST];
 };
 
+/*--------------------------------------------------------------------
+ * The free ranges are kept in a tree by size, and by offset within the
+ * same size, so the best fit is found in O(log n) time, and it is the
+ * lowest one in the file among those.  Neighbours for coalescing are
+ * found in the address ordered list, in constant time.
+ */
+
+static inline int
+smf_cmp(const struct smf *a, const struct smf *b)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? -1 : 1);
+	if (a->offset != b->offset)
+		return (a->offset < b->offset ? -1 : 1);
+	return (0);
+}
+
+VRB_PROTOTYPE_STATIC(smf_tree, smf, tree, smf_cmp)
+VRB_GENERATE_STATIC(smf_tree, smf, tree, smf_cmp)
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -113,7 +145,6 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 {
 	const char *size, *fn, *r;
 	struct smf_sc *sc;
-	unsigned u;
 	uintmax_t page_size;
 	int advice = MADV_RANDOM;
 
@@ -151,8 +182,7 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 	ALLOC_OBJ(sc, SMF_SC_MAGIC);
 	XXXAN(sc);
 	VTAILQ_INIT(&sc->order);
-	for (u = 0; u < NBUCKET; u++)
-		VTAILQ_INIT(&sc->free[u]);
+	VRB_INIT(&sc->free);
 	VTAILQ_INIT(&sc->used);
 	sc->pagesize = page_size;
 	sc->advice = advice;
@@ -166,86 +196,68 @@ smf_init(struct stevedore *parent, int ac, char * const *av)
 }
 
 /*--------------------------------------------------------------------
- * Insert/Remove from correct freelist
+ * Insert/Remove from the free tree
  */
 
+static void
+smf_stats(const struct smf_sc *sc, const struct smf *sp, int n)
+{
+	size_t p;
+	unsigned b;
+
+	p = sp->size / sc->pagesize;
+	if (p >= SMF_LARGE)
+		sc->stats->g_smf_large += n;
+	else
+		sc->stats->g_smf_frag += n;
+	for (b = 0; b < SMF_NHIST - 1 && p >= 4; b++)
+		p >>= 2;
+	*sc->hist[b] += n;
+}
+
+static void
+smf_largest(struct smf_sc *sc)
+{
+	struct smf *sp;
+
+	sp = VRB_MAX(smf_tree, &sc->free);
+	sc->stats->g_free_largest = sp == NULL ? 0 : sp->size;
+}
+
 static void
 insfree(struct smf_sc *sc, struct smf *sp)
 {
-	size_t b;
-	struct smf *sp2;
-	size_t ns;
 
 	AZ(sp->alloc);
-	assert(sp->flist == NULL);
 	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
-		sc->stats->g_smf_large++;
-	} else {
-		sc->stats->g_smf_frag++;
-	}
-	sp->flist = &sc->free[b];
-	ns = b * sc->pagesize;
-	VTAILQ_FOREACH(sp2, sp->flist, status) {
-		assert(sp2->size >= ns);
-		AZ(sp2->alloc);
-		assert(sp2->flist == sp->flist);
-		if (sp->offset < sp2->offset)
-			break;
-	}
-	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(sp->flist, sp, status);
-	else
-		VTAILQ_INSERT_BEFORE(sp2, sp, status);
+	AZ(VRB_INSERT(smf_tree, &sc->free, sp));
+	smf_stats(sc, sp, 1);
 }
 
 static void
-remfree(const struct smf_sc *sc, struct smf *sp)
+remfree(struct smf_sc *sc, struct smf *sp)
 {
-	size_t b;
 
 	AZ(sp->alloc);
-	assert(sp->flist != NULL);
 	Lck_AssertHeld(&sc->mtx);
-	b = sp->size / sc->pagesize;
-	if (b >= NBUCKET) {
-		b = NBUCKET - 1;
-		sc->stats->g_smf_large--;
-	} else {
-		sc->stats->g_smf_frag--;
-	}
-	assert(sp->flist == &sc->free[b]);
-	VTAILQ_REMOVE(sp->flist, sp, status);
-	sp->flist = NULL;
+	AN(VRB_REMOVE(smf_tree, &sc->free, sp));
+	smf_stats(sc, sp, -1);
 }
 
 /*--------------------------------------------------------------------
- * Allocate a range from the first free range that is large enough.
+ * Allocate a range from the smallest free range that is large enough.
  */
 
 static struct smf *
 alloc_smf(struct smf_sc *sc, size_t bytes)
 {
 	struct smf *sp, *sp2;
-	size_t b;
+	struct smf key;
 
 	AZ(bytes % sc->pagesize);
-	b = bytes / sc->pagesize;
-	if (b >= NBUCKET)
-		b = NBUCKET - 1;
-	sp = NULL;
-	for (; b < NBUCKET - 1; b++) {
-		sp = VTAILQ_FIRST(&sc->free[b]);
-		if (sp != NULL)
-			break;
-	}
-	if (sp == NULL) {
-		VTAILQ_FOREACH(sp, &sc->free[NBUCKET -1], status)
-			if (sp->size >= bytes)
-				break;
-	}
+	key.size = bytes;
+	key.offset = 0;
+	sp = VRB_NFIND(smf_tree, &sc->free, &key);
 	if (sp == NULL)
 		return (sp);
 
@@ -255,6 +267,7 @@ alloc_smf(struct smf_sc *sc, size_t bytes)
 	if (sp->size == bytes) {
 		sp->alloc = 1;
 		VTAILQ_INSERT_TAIL(&sc->used, sp, status);
+		smf_largest(sc);
 		return (sp);
 	}
 
@@ -273,12 +286,13 @@ alloc_smf(struct smf_sc *sc, size_t bytes)
 	VTAILQ_INSERT_BEFORE(sp, sp2, order);
 	VTAILQ_INSERT_TAIL(&sc->used, sp2, status);
 	insfree(sc, sp);
+	smf_largest(sc);
 	return (sp2);
 }
 
 /*--------------------------------------------------------------------
- * Free a range.  Attempt merge forward and backward, then sort into
- * free list according to age.
+ * Free a range.  Attempt merge forward and backward, then put it in
+ * the free tree.
  */
 
 static void
@@ -320,6 +334,7 @@ free_smf(struct smf *sp)
 	}
 
 	insfree(sc, sp);
+	smf_largest(sc);
 }
 
 /*--------------------------------------------------------------------
@@ -343,14 +358,15 @@ new_smf(struct smf_sc *sc, unsigned char *ptr, off_t off, size_t len)
 	sp->offset = off;
 	sp->alloc = 1;
 
-	VTAILQ_FOREACH(sp2, &sc->order, order) {
-		if (sp->ptr < sp2->ptr) {
-			VTAILQ_INSERT_BEFORE(sp2, sp, order);
+	/* Ranges mostly come in address order, look from the end */
+	VTAILQ_FOREACH_REVERSE(sp2, &sc->order, smfhead, order) {
+		if (sp2->ptr < sp->ptr) {
+			VTAILQ_INSERT_AFTER(&sc->order, sp2, sp, order);
 			break;
 		}
 	}
 	if (sp2 == NULL)
-		VTAILQ_INSERT_TAIL(&sc->order, sp, order);
+		VTAILQ_INSERT_HEAD(&sc->order, sp, order);
 
 	VTAILQ_INSERT_HEAD(&sc->used, sp, status);
 
@@ -367,7 +383,8 @@ new_smf(struct smf_sc *sc, unsigned char *ptr, off_t off, size_t len)
  */
 
 static void
-smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
+smf_open_chunk(struct stevedore *st, struct smf_sc *sc, off_t sz, off_t off,
+    off_t *fail, off_t *sum)
 {
 	void *p;
 	off_t h;
@@ -383,6 +400,8 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 		    MAP_NOCORE | MAP_NOSYNC | MAP_SHARED, sc->fd, off);
 		if (p != MAP_FAILED) {
 			(void)madvise(p, sz, sc->advice);
+			STV_Hugepages(st, p, sz, &sc->stats->g_huge);
+			STV_Prefault(st, p, sz, 0);
 			(*sum) += sz;
 			new_smf(sc, p, off, sz);
 			return;
@@ -397,8 +416,22 @@ smf_open_chunk(struct smf_sc *sc, off_t sz, off_t off, off_t *fail, off_t *sum)
 		h = SSIZE_MAX;
 	h -= (h % sc->pagesize);
 
-	smf_open_chunk(sc, h, off, fail, sum);
-	smf_open_chunk(sc, sz - h, off + h, fail, sum);
+	smf_open_chunk(st, sc, h, off, fail, sum);
+	smf_open_chunk(st, sc, sz - h, off + h, fail, sum);
+}
+
+static void
+smf_hist(struct smf_sc *sc)
+{
+
+	sc->hist[0] = &sc->stats->g_free_1p;
+	sc->hist[1] = &sc->stats->g_free_4p;
+	sc->hist[2] = &sc->stats->g_free_16p;
+	sc->hist[3] = &sc->stats->g_free_64p;
+	sc->hist[4] = &sc->stats->g_free_256p;
+	sc->hist[5] = &sc->stats->g_free_1kp;
+	sc->hist[6] = &sc->stats->g_free_4kp;
+	sc->hist[7] = &sc->stats->g_free_16kp;
 }
 
 static void __match_proto__(storage_open_f)
@@ -409,14 +442,15 @@ smf_open(struct stevedore *st)
 	off_t sum = 0;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_smf == NULL)
 		lck_smf = Lck_CreateClass("smf");
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
 	sc->stats = VSC_smf_New(st->ident);
+	smf_hist(sc);
 	Lck_New(&sc->mtx, lck_smf);
 	Lck_Lock(&sc->mtx);
-	smf_open_chunk(sc, sc->filesize, 0, &fail, &sum);
+	smf_open_chunk(st, sc, sc->filesize, 0, &fail, &sum);
 	Lck_Unlock(&sc->mtx);
 	printf("SMF.%s mmap'ed %ju bytes of %ju\n",
 	    st->ident, (uintmax_t)sum, sc->filesize);
@@ -480,10 +514,76 @@ smf_free(struct storage *s)
 	sc->stats->c_freed += smf->size;
 	sc->stats->g_bytes -= smf->size;
 	sc->stats->g_space += smf->size;
+	if (smf->seq)
+		(void)madvise(smf->ptr, smf->size, sc->advice);
+	smf->ra = 0;
+	smf->seq = 0;
 	free_smf(smf);
 	Lck_Unlock(&sc->mtx);
 }
 
+/*--------------------------------------------------------------------
+ * Delivery tells us which segments it is about to get to, so we can
+ * have the kernel page them in ahead of time, rather than a fault at
+ * a time in the middle of writing to the client.  Large segments are
+ * also switched to sequential access, so the kernel keeps reading
+ * ahead through them.
+ */
+
+static void __match_proto__(sml_readahead_f)
+smf_readahead(struct storage *s, int ahead)
+{
+	struct smf *smf;
+	struct smf_sc *sc;
+	size_t len;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
+	sc = smf->sc;
+	if (!ahead && smf->ra) {
+		/* Racy with concurrent deliveries, good enough for stats */
+		smf->ra = 0;
+		(void)VATOMIC_INC(&sc->stats->c_readahead_used);
+		return;
+	}
+	len = RUP2(s->len, sc->pagesize);
+	if (!ahead && len <= sc->pagesize)
+		return;
+	if (len > SMF_RA_MAX) {
+		if (!smf->seq && sc->advice != MADV_SEQUENTIAL) {
+			smf->seq = 1;
+			(void)madvise(smf->ptr, smf->size, MADV_SEQUENTIAL);
+		}
+		len = SMF_RA_MAX;
+	}
+	(void)madvise(smf->ptr, len, MADV_WILLNEED);
+	if (ahead) {
+		smf->ra = 1;
+		(void)VATOMIC_INC(&sc->stats->c_readahead);
+		(void)VATOMIC_ADD(&sc->stats->c_readahead_bytes, len);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+static VCL_BYTES __match_proto__(stv_var_used_space)
+smf_used_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_bytes);
+}
+
+static VCL_BYTES __match_proto__(stv_var_free_space)
+smf_free_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_space);
+}
+
 /*--------------------------------------------------------------------*/
 
 const struct stevedore smf_stevedore = {
@@ -493,69 +593,208 @@ const struct stevedore smf_stevedore = {
 	.open		=	smf_open,
 	.sml_alloc	=	smf_alloc,
 	.sml_free	=	smf_free,
+	.sml_readahead	=	smf_readahead,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
 	.methods	=	&SML_methods,
+	.var_free_space	=	smf_free_space,
+	.var_used_space	=	smf_used_space,
 };
 
 #ifdef INCLUDE_TEST_DRIVER
 
-void vca_flush(struct sess *sp) {}
+/*--------------------------------------------------------------------
+ * Allocator benchmark
+ *
+ * The file is not mapped, the ranges are just numbers.  A number of
+ * slots are filled with allocations of random sizes, and then a
+ * random slot is freed or filled again for each iteration, which
+ * fragments the free space the way long running caches do.
+ */
 
-#define N	100
-#define M	(128*1024)
+#include <unistd.h>
 
-struct storage *s[N];
+#include "cache/cache_obj.h"
+#include "vtim.h"
 
-static void
-dumpit(void)
+/* Stubs for what the file stevedore needs from the rest of varnishd */
+
+struct heritage heritage;
+pthread_t cli_thread;
+static struct VSC_smf bench_vsc;
+const struct obj_methods SML_methods;
+
+struct VSC_lck *
+Lck_CreateClass(const char *name)
 {
-	struct smf_sc *sc = smf_stevedore.priv;
-	struct smf *s;
+	(void)name;
+	return (NULL);
+}
 
-	return (0);
-	printf("----------------\n");
-	printf("Order:\n");
-	VTAILQ_FOREACH(s, &sc->order, order) {
-		printf("%10p %12ju %12ju %12ju\n",
-		    s, s->offset, s->size, s->offset + s->size);
-	}
-	printf("Used:\n");
-	VTAILQ_FOREACH(s, &sc->used, status) {
-		printf("%10p %12ju %12ju %12ju\n",
-		    s, s->offset, s->size, s->offset + s->size);
-	}
-	printf("Free:\n");
-	VTAILQ_FOREACH(s, &sc->free, status) {
-		printf("%10p %12ju %12ju %12ju\n",
-		    s, s->offset, s->size, s->offset + s->size);
+void Lck__New(struct lock *lck, struct VSC_lck *v, const char *w)
+{ (void)lck; (void)v; (void)w; }
+void Lck__Lock(struct lock *lck, const char *p, int l)
+{ (void)lck; (void)p; (void)l; }
+void Lck__Unlock(struct lock *lck, const char *p, int l)
+{ (void)lck; (void)p; (void)l; }
+int Lck__Held(const struct lock *lck) { (void)lck; return (1); }
+int Lck__Owned(const struct lock *lck) { (void)lck; return (1); }
+
+struct VSC_smf *
+VSC_smf_New(const char *fmt, ...)
+{
+	(void)fmt;
+	return (&bench_vsc);
+}
+
+struct lru *LRU_Alloc(const struct stevedore *stv)
+{ (void)stv; return (NULL); }
+int STV_GetFile(const char *fn, int *fdp, const char **fnp, const char *ctx)
+{ (void)fn; (void)fdp; (void)fnp; (void)ctx; INCOMPL(); }
+uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
+    const char *ctx)
+{ (void)fd; (void)size; (void)granularity; (void)ctx; INCOMPL(); }
+void MCH_Fd_Inherit(int fd, const char *what)
+{ (void)fd; (void)what; }
+void STV_Hugepages(const struct stevedore *stv, void *p, size_t len,
+    uint64_t *vsc)
+{ (void)stv; (void)p; (void)len; (void)vsc; }
+void STV_Prefault(const struct stevedore *stv, void *p, size_t len, int anon)
+{ (void)stv; (void)p; (void)len; (void)anon; }
+int SML_allocobj(struct worker *wrk, const struct stevedore *stv,
+    struct objcore *oc, unsigned wsl)
+{ (void)wrk; (void)stv; (void)oc; (void)wsl; INCOMPL(); }
+void SML_panic(struct vsb *vsb, const struct objcore *oc)
+{ (void)vsb; (void)oc; }
+
+/* Check that the ranges tile the file, and all free ones are merged */
+
+static void
+bench_check(const struct smf_sc *sc)
+{
+	struct smf *sp, *sp2 = NULL;
+	uintmax_t sum = 0, nfree = 0;
+
+	VTAILQ_FOREACH(sp, &sc->order, order) {
+		assert(sp->offset == (off_t)sum);
+		AZ(sp->size % sc->pagesize);
+		if (sp2 != NULL)
+			assert(sp->alloc || sp2->alloc);
+		if (!sp->alloc)
+			nfree++;
+		sum += sp->size;
+		sp2 = sp;
 	}
-	printf("================\n");
+	assert(sum == sc->filesize);
+	assert(nfree == sc->stats->g_smf_frag + sc->stats->g_smf_large);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: smf_bench [-c] [-i iterations] "
+	    "[-m maxsize] [-n slots] [-s filesize]\n");
+	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-	int i, j;
-
-	setbuf(stdout, NULL);
-	smf_init(&smf_stevedore, "");
-	smf_open(&smf_stevedore);
-	while (1) {
-		dumpit();
-		i = random() % N;
-		do
-			j = random() % M;
-		while (j == 0);
-		if (s[i] == NULL) {
-			s[i] = smf_alloc(&smf_stevedore, j);
-			printf("A %10p %12d\n", s[i], j);
-		} else {
-			smf_free(s[i]);
-			printf("D %10p\n", s[i]);
-			s[i] = NULL;
+	struct smf_sc *sc;
+	struct smf **slot;
+	uintmax_t filesize = (uintmax_t)1 << 40;
+	uintmax_t maxsize = 1024 * 1024;
+	unsigned nslot = 100000, niter = 10000000;
+	unsigned i, j, u, nalloc = 0, nfail = 0, check = 0;
+	size_t sz;
+	double t0, t1;
+	const char *e;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "ci:m:n:s:")) != -1) {
+		switch (ch) {
+		case 'c':
+			check = 1;
+			break;
+		case 'i':
+			niter = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			e = VNUM_2bytes(optarg, &maxsize, 0);
+			if (e != NULL)
+				usage();
+			break;
+		case 'n':
+			nslot = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			e = VNUM_2bytes(optarg, &filesize, 0);
+			if (e != NULL)
+				usage();
+			break;
+		default:
+			usage();
 		}
 	}
+	if (nslot == 0 || maxsize == 0)
+		usage();
+
+	ALLOC_OBJ(sc, SMF_SC_MAGIC);
+	AN(sc);
+	VTAILQ_INIT(&sc->order);
+	VRB_INIT(&sc->free);
+	VTAILQ_INIT(&sc->used);
+	sc->pagesize = 4096;
+	sc->filesize = filesize - filesize % sc->pagesize;
+	sc->stats = VSC_smf_New("bench");
+	smf_hist(sc);
+	Lck_New(&sc->mtx, lck_smf);
+	new_smf(sc, (unsigned char *)(uintptr_t)sc->pagesize, 0,
+	    sc->filesize);
+
+	slot = calloc(nslot, sizeof *slot);
+	AN(slot);
+	srandom(1);
+
+	t0 = VTIM_mono();
+	for (i = 0; i < niter + nslot; i++) {
+		/* Fill all the slots first, then pick at random */
+		j = i < nslot ? i : random() % nslot;
+		if (slot[j] != NULL) {
+			free_smf(slot[j]);
+			slot[j] = NULL;
+			continue;
+		}
+		/* Mostly fetch chunk sized, some much larger */
+		if (random() % 10)
+			sz = 1 + random() % (128 * 1024);
+		else
+			sz = 1 + random() % maxsize;
+		sz = RUP2(sz, sc->pagesize);
+		slot[j] = alloc_smf(sc, sz);
+		if (slot[j] == NULL)
+			nfail++;
+		else
+			nalloc++;
+		if (check && (i & 0xffff) == 0)
+			bench_check(sc);
+	}
+	t1 = VTIM_mono();
+	bench_check(sc);
+
+	printf("%u ops in %.3f s, %.1f ns/op, %u allocs, %u failed\n",
+	    niter + nslot, t1 - t0, 1e9 * (t1 - t0) / (niter + nslot),
+	    nalloc, nfail);
+	printf("ranges %ju, free small %ju large %ju, largest %ju\n",
+	    (uintmax_t)sc->stats->g_smf,
+	    (uintmax_t)sc->stats->g_smf_frag,
+	    (uintmax_t)sc->stats->g_smf_large,
+	    (uintmax_t)sc->stats->g_free_largest);
+	printf("free ranges by pages:");
+	for (u = 0; u < SMF_NHIST; u++)
+		printf(" %ju", (uintmax_t)*sc->hist[u]);
+	printf("\n");
+	return (0);
 }
 
 #endif /* INCLUDE_TEST_DRIVER */
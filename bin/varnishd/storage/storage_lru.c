@@ -37,11 +37,88 @@
 
 #include "storage/storage.h"
 
+#include "vatomic.h"
+#include "vend.h"
+#include "vtim.h"
+
+#include "VSC_lru.h"
+
+/*
+ * With lru_clock on, a hit does not move the object, it only marks it
+ * as referenced, and LRU_NukeOne() gives referenced objects a second
+ * chance by moving them to the tail as it sweeps past them.
+ *
+ * The reference bit is the sign of oc->last_lru:  LRU_Add() and the
+ * sweep store minus the time, LRU_Touch() stores the time when it
+ * finds the bit clear and lru_interval has passed, so the delivery
+ * of a miss does not count.  NAN still means "not on the list".  All
+ * of them hold the list lock, lest a hit bring back a removed object.
+ *
+ * oc->last_lru is a float, too coarse for seconds since the epoch,
+ * so it is kept relative to lru_t0, a little before the first LRU was
+ * allocated.  That way it is also never zero, which has no sign.
+ *
+ * The list is split in lru_shards shards on the objcore address, each
+ * with its own lock, so that inserts and removals do not all serialize
+ * on one lock either.
+ *
+ * The slru and tinylfu policies (-s ...,policy=slru) keep a segmented
+ * LRU instead:  New objects go on the probation list, a hit moves them
+ * to the protected list, and when that holds more than
+ * LRU_PROTECTED_PCT of the objects, its oldest ones go back to the tail
+ * of probation.  Nuking takes from probation first.  lru_clock does
+ * not apply, the sign of oc->last_lru tells which list the object is
+ * on instead, minus for probation.
+ *
+ * tinylfu also counts the deliveries of each digest in a count-min
+ * sketch, and only lets an object in, when that means nuking, if its
+ * digest has been seen more often than that of the first victim.  The
+ * fetch then falls back to Transient, see vbf_allocobj().  The sketch
+ * is updated without locking, and racing updates may be lost.
+ *
+ * The gauges are shared by all shards, so they are updated atomically.
+ * The counters are not, and may lose a count now and then.
+ */
+
+#define LRU_PROTECTED_PCT	80
+#define LRU_NUKE_BATCH		64
+
+#define LRU_SKETCH_ROWS		4
+#define LRU_SKETCH_BITS		18
+#define LRU_SKETCH_WIDTH	(1U << LRU_SKETCH_BITS)
+#define LRU_SKETCH_MAX		15
+#define LRU_SKETCH_SAMPLE	(10U * LRU_SKETCH_WIDTH)
+
+struct lru_sketch {
+	unsigned		n;
+	uint8_t			cnt[LRU_SKETCH_ROWS][LRU_SKETCH_WIDTH];
+};
+
+VTAILQ_HEAD(lru_head, objcore);
+
+struct lru_list {
+	struct lru_head		lru_head;
+	struct lru_head		prot_head;
+	unsigned		n_oc;
+	unsigned		n_prot;
+	struct lock		mtx;
+};
+
+static double lru_t0;
+
+static struct lock lru_reserve_mtx;
+static pthread_cond_t lru_reserve_cond;
+static const struct worker *lru_reserve_wrk;
+
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
-	VTAILQ_HEAD(,objcore)	lru_head;
-	struct lock		mtx;
+	enum lru_policy_e	policy;
+	unsigned		nlist;
+	unsigned		nuke_next;
+	struct lru_list		*list;
+	struct lru_sketch	*sketch;
+	struct VSC_lru		*vsc;
 };
 
 static struct lru *
@@ -53,15 +130,92 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+static struct lru_list *
+lru_list(const struct lru *lru, const struct objcore *oc)
+{
+	uint64_t u;
+
+	if (lru->nlist == 1)
+		return (lru->list);
+	u = (uintptr_t)oc;
+	u *= 0x9e3779b97f4a7c15ULL;
+	return (&lru->list[(u >> 32) % lru->nlist]);
+}
+
+/*--------------------------------------------------------------------
+ * Count-min sketch of the digests, the digest is uniform enough to
+ * index the rows directly.
+ */
+
+static void
+lru_sketch_add(struct lru_sketch *sk, const struct objcore *oc)
+{
+	const uint8_t *d;
+	uint8_t *c;
+	unsigned r, u;
+
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	d = oc->objhead->digest;
+	for (r = 0; r < LRU_SKETCH_ROWS; r++) {
+		c = &sk->cnt[r][vbe32dec(d + 4 * r) & (LRU_SKETCH_WIDTH - 1)];
+		if (*c < LRU_SKETCH_MAX)
+			(*c)++;
+	}
+	if (++sk->n < LRU_SKETCH_SAMPLE)
+		return;
+
+	/* Age, so the counts follow what is popular now */
+	sk->n = 0;
+	for (r = 0; r < LRU_SKETCH_ROWS; r++)
+		for (u = 0; u < LRU_SKETCH_WIDTH; u++)
+			sk->cnt[r][u] >>= 1;
+}
+
+static unsigned
+lru_sketch_get(const struct lru_sketch *sk, const struct objcore *oc)
+{
+	const uint8_t *d;
+	unsigned r, c, n = LRU_SKETCH_MAX;
+
+	CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+	d = oc->objhead->digest;
+	for (r = 0; r < LRU_SKETCH_ROWS; r++) {
+		c = sk->cnt[r][vbe32dec(d + 4 * r) & (LRU_SKETCH_WIDTH - 1)];
+		if (c < n)
+			n = c;
+	}
+	return (n);
+}
+
+/*--------------------------------------------------------------------*/
+
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(const struct stevedore *stv)
 {
 	struct lru *lru;
+	unsigned u;
 
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	if (lru_t0 == 0.)
+		lru_t0 = VTIM_real() - 60.;
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->policy = stv->lru_policy;
+	lru->nlist = cache_param->lru_shards;
+	assert(lru->nlist > 0);
+	lru->list = calloc(lru->nlist, sizeof *lru->list);
+	AN(lru->list);
+	for (u = 0; u < lru->nlist; u++) {
+		VTAILQ_INIT(&lru->list[u].lru_head);
+		VTAILQ_INIT(&lru->list[u].prot_head);
+		Lck_New(&lru->list[u].mtx, lck_lru);
+	}
+	if (lru->policy == LRU_POLICY_TINYLFU) {
+		lru->sketch = calloc(1, sizeof *lru->sketch);
+		AN(lru->sketch);
+	}
+	lru->vsc = VSC_lru_New(stv->ident);
+	AN(lru->vsc);
 	return (lru);
 }
 
@@ -69,19 +223,82 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nlist; u++) {
+		Lck_Lock(&lru->list[u].mtx);
+		AN(VTAILQ_EMPTY(&lru->list[u].lru_head));
+		AN(VTAILQ_EMPTY(&lru->list[u].prot_head));
+		Lck_Unlock(&lru->list[u].mtx);
+		Lck_Delete(&lru->list[u].mtx);
+	}
+	free(lru->list);
+	free(lru->sketch);
+	VSC_lru_Destroy(&lru->vsc);
 	FREE_OBJ(lru);
 }
 
+/*--------------------------------------------------------------------
+ * 'now' is relative to lru_t0, like last_lru.
+ */
+
+static void
+lru_add(struct objcore *oc, double now)
+{
+	struct lru *lru;
+	struct lru_list *ll;
+
+	AN(isnan(oc->last_lru));
+	assert(now > 0.);
+	lru = lru_get(oc);
+	ll = lru_list(lru, oc);
+	Lck_Lock(&ll->mtx);
+	VTAILQ_INSERT_TAIL(&ll->lru_head, oc, lru_list);
+	ll->n_oc++;
+	if (lru->policy != LRU_POLICY_LRU || cache_param->lru_clock)
+		oc->last_lru = -now;
+	else
+		oc->last_lru = now;
+	AZ(isnan(oc->last_lru));
+	VATOMIC_INC(&lru->vsc->g_objects);
+	Lck_Unlock(&ll->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Returns: when the object was last moved on its list, as for lru_add()
+ */
+
+static double
+lru_remove(struct objcore *oc)
+{
+	struct lru *lru;
+	struct lru_list *ll;
+	double t;
+
+	lru = lru_get(oc);
+	ll = lru_list(lru, oc);
+	Lck_Lock(&ll->mtx);
+	AZ(isnan(oc->last_lru));
+	if (lru->policy != LRU_POLICY_LRU && oc->last_lru > 0) {
+		VTAILQ_REMOVE(&ll->prot_head, oc, lru_list);
+		assert(ll->n_prot > 0);
+		ll->n_prot--;
+		VATOMIC_DEC(&lru->vsc->g_protected);
+	} else
+		VTAILQ_REMOVE(&ll->lru_head, oc, lru_list);
+	assert(ll->n_oc > 0);
+	ll->n_oc--;
+	VATOMIC_DEC(&lru->vsc->g_objects);
+	t = fabs(oc->last_lru);
+	oc->last_lru = NAN;
+	Lck_Unlock(&ll->mtx);
+	return (t);
+}
+
 void
 LRU_Add(struct objcore *oc, double now)
 {
-	struct lru *lru;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -89,21 +306,13 @@ LRU_Add(struct objcore *oc, double now)
 		return;
 
 	AZ(oc->boc);
-	AN(isnan(oc->last_lru));
 	AZ(isnan(now));
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-	oc->last_lru = now;
-	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	lru_add(oc, now - lru_t0);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
-	struct lru *lru;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -111,26 +320,119 @@ LRU_Remove(struct objcore *oc)
 		return;
 
 	AZ(oc->boc);
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	(void)lru_remove(oc);
+}
+
+/*--------------------------------------------------------------------
+ * Swap the storage of an objcore we hold a reference on with that of
+ * the private 'noc', under the conditions of HSH_Exclusive().  The
+ * objcore moves to the LRU of its new stevedore, where it starts out
+ * unprotected, but keeps its time.
+ * Returns: 1: swapped, 0: didn't
+ */
+
+static void __match_proto__(hsh_exclusive_f)
+lru_swap(struct objcore *oc, void *priv)
+{
+	struct objcore *noc;
+	struct storeobj stobj;
+	double t;
+
+	CAST_OBJ_NOTNULL(noc, priv, OBJCORE_MAGIC);
+	t = lru_remove(oc);
+	stobj = *oc->stobj;
+	*oc->stobj = *noc->stobj;
+	*noc->stobj = stobj;
+	lru_add(oc, t);
+}
+
+int
+LRU_Replace(struct objcore *oc, struct objcore *noc)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(noc, OBJCORE_MAGIC);
+	AN(noc->flags & OC_F_PRIVATE);
+	AZ(noc->objhead);
+	return (HSH_Exclusive(oc, lru_swap, noc));
+}
+
+/*--------------------------------------------------------------------
+ * Move a hit object to the protected list, and the oldest protected
+ * objects back to probation if there are too many.
+ */
+
+static void
+lru_promote(struct lru *lru, struct lru_list *ll, struct objcore *oc,
+    double now)
+{
+
+	if (oc->last_lru < 0) {
+		VTAILQ_REMOVE(&ll->lru_head, oc, lru_list);
+		ll->n_prot++;
+		VATOMIC_INC(&lru->vsc->g_protected);
+		lru->vsc->promoted++;
+	} else
+		VTAILQ_REMOVE(&ll->prot_head, oc, lru_list);
+	VTAILQ_INSERT_TAIL(&ll->prot_head, oc, lru_list);
+	oc->last_lru = now;
+
+	while (ll->n_prot * 100ULL > ll->n_oc * (uint64_t)LRU_PROTECTED_PCT) {
+		oc = VTAILQ_FIRST(&ll->prot_head);
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		assert(oc->last_lru > 0);
+		VTAILQ_REMOVE(&ll->prot_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&ll->lru_head, oc, lru_list);
+		oc->last_lru = -oc->last_lru;
+		ll->n_prot--;
+		VATOMIC_DEC(&lru->vsc->g_protected);
+		lru->vsc->demoted++;
+	}
 }
 
 void __match_proto__(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 {
 	struct lru *lru;
+	struct lru_list *ll;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
-	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
+	if (oc->flags & OC_F_PRIVATE)
 		return;
 
+	/*
+	 * The request which fetched the object also ends up here, and
+	 * depending on who drops the boc last, that can be before or
+	 * after LRU_Add(), so count it regardless.
+	 */
+	lru = lru_get(oc);
+	if (lru->sketch != NULL)
+		lru_sketch_add(lru->sketch, oc);
+	if (isnan(oc->last_lru))
+		return;
+
+	now -= lru_t0;
+	lru->vsc->hit++;
+
+	if (lru->policy == LRU_POLICY_LRU && cache_param->lru_clock) {
+		/*
+		 * Only dirty the cache line if the bit is clear, and then
+		 * under the lock, lest we resurrect a removed object.
+		 */
+		if (!(oc->last_lru < 0) ||
+		    now + oc->last_lru < cache_param->lru_interval)
+			return;
+		ll = lru_list(lru, oc);
+		if (Lck_Trylock(&ll->mtx))
+			return;
+		if (oc->last_lru < 0)
+			oc->last_lru = now;
+		Lck_Unlock(&ll->mtx);
+		return;
+	}
+
 	/*
 	 * To avoid the exphdl->mtx becoming a hotspot, we only
 	 * attempt to move objects if they have not been moved
@@ -138,22 +440,168 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 	 * obviously leaves the LRU list imperfectly sorted.
 	 */
 
-	if (now - oc->last_lru < cache_param->lru_interval)
+	if (now - fabs(oc->last_lru) < cache_param->lru_interval)
 		return;
 
-	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	ll = lru_list(lru, oc);
 
-	if (Lck_Trylock(&lru->mtx))
+	if (Lck_Trylock(&ll->mtx))
 		return;
 
-	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	if (isnan(oc->last_lru)) {
+		/* Removed while we waited */
+	} else if (lru->policy != LRU_POLICY_LRU) {
+		lru_promote(lru, ll, oc, now);
+		VSC_C_main->n_lru_moved++;
+	} else {
+		VTAILQ_REMOVE(&ll->lru_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&ll->lru_head, oc, lru_list);
 		VSC_C_main->n_lru_moved++;
 		oc->last_lru = now;
 	}
-	Lck_Unlock(&lru->mtx);
+	Lck_Unlock(&ll->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Snipe currently unused objects from the front of one list, until
+ * 'bytes' is used up or 'nmax' are found, giving referenced objects a
+ * second chance on the way.  At most one lap is made, plus one more
+ * for the objects which got a second chance.  If 'borrow' is set, the
+ * objects are only referenced, not killed.
+ */
+
+static unsigned
+lru_nuke_list(struct worker *wrk, struct lru *lru, struct lru_list *ll,
+    struct lru_head *head, struct objcore **ocp, unsigned nmax,
+    ssize_t *bytes, int borrow)
+{
+	struct objcore *oc, *oc2;
+	unsigned chances = 0, visits, n = 0;
+
+	AN(nmax);
+	Lck_Lock(&ll->mtx);
+	if (head == &ll->prot_head)
+		visits = ll->n_prot;
+	else
+		visits = ll->n_oc - ll->n_prot;
+	/* Hits keep setting bits while we sweep, so limit to one lap */
+	if (lru->policy == LRU_POLICY_LRU && cache_param->lru_clock)
+		chances = visits;
+	visits += chances;
+	VTAILQ_FOREACH_SAFE(oc, head, lru_list, oc2) {
+		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+		AZ(isnan(oc->last_lru));
+
+		if (visits-- == 0)
+			break;
+
+		if (oc->last_lru > 0 && chances > 0) {
+			chances--;
+			oc->last_lru = -oc->last_lru;
+			VTAILQ_REMOVE(head, oc, lru_list);
+			VTAILQ_INSERT_TAIL(head, oc, lru_list);
+			VSC_C_main->n_lru_moved++;
+			/* We may meet it again, now without the bit */
+			if (oc2 == NULL)
+				oc2 = oc;
+			continue;
+		}
+
+		if (borrow) {
+			if (!HSH_Grab(wrk, oc))
+				continue;
+		} else {
+			VSLb(wrk->vsl, SLT_ExpKill,
+			    "LRU_Cand p=%p f=0x%x r=%d",
+			    oc, oc->flags, oc->refcnt);
+			if (!HSH_Snipe(wrk, oc))
+				continue;
+			VSC_C_main->n_lru_nuked++;
+			lru->vsc->nuked++;
+		}
+		VTAILQ_REMOVE(head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(head, oc, lru_list);
+		ocp[n++] = oc;
+		*bytes -= SML_Freeable(wrk, oc);
+		if (n == nmax || *bytes <= 0)
+			break;
+	}
+	Lck_Unlock(&ll->mtx);
+	return (n);
+}
+
+/*--------------------------------------------------------------------
+ * Sweep the lists, probation first, starting on the next shard.
+ * Racing on nuke_next does not matter.
+ */
+
+static unsigned
+lru_sweep(struct worker *wrk, struct lru *lru, struct objcore **ocp,
+    unsigned nmax, ssize_t bytes, int borrow)
+{
+	struct lru_list *ll;
+	unsigned u, n, found = 0;
+
+	n = lru->nuke_next++;
+	for (u = 0; found < nmax && bytes > 0 && u < lru->nlist; u++) {
+		ll = &lru->list[(n + u) % lru->nlist];
+		found += lru_nuke_list(wrk, lru, ll, &ll->lru_head,
+		    ocp + found, nmax - found, &bytes, borrow);
+	}
+	for (u = 0; found < nmax && bytes > 0 && u < lru->nlist; u++) {
+		if (lru->policy == LRU_POLICY_LRU)
+			break;
+		ll = &lru->list[(n + u) % lru->nlist];
+		found += lru_nuke_list(wrk, lru, ll, &ll->prot_head,
+		    ocp + found, nmax - found, &bytes, borrow);
+	}
+	return (found);
+}
+
+/*--------------------------------------------------------------------
+ * Nuke up to 'nmax' of the oldest objects which aren't in use, until
+ * about 'bytes' of object bodies have been freed.  Each list is locked
+ * once for the whole batch, and the objects are slimmed after.
+ */
+
+static unsigned
+lru_nuke(struct worker *wrk, struct lru *lru, ssize_t bytes, unsigned nmax)
+{
+	struct objcore *ocs[LRU_NUKE_BATCH];
+	unsigned u, nuked;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	assert(nmax > 0 && nmax <= LRU_NUKE_BATCH);
+
+	if (wrk->strangelove <= 0) {
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU reached nuke_limit");
+		return (0);
+	}
+	if (nmax > (unsigned)wrk->strangelove)
+		nmax = wrk->strangelove;
+
+	nuked = lru_sweep(wrk, lru, ocs, nmax, bytes, 0);
+	wrk->strangelove -= nuked;
+
+	if (nuked == 0) {
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
+		return (0);
+	}
+
+	for (u = 0; u < nuked; u++) {
+		/* XXX: We could grab and return storage to our caller */
+		ObjSlim(wrk, ocs[u]);
+
+		VSLb(wrk->vsl, SLT_ExpKill, "LRU x=%u",
+		    ObjGetXID(wrk, ocs[u]));
+		(void)HSH_DerefObjCore(wrk, &ocs[u], 0); // Ref from HSH_Snipe
+	}
+
+	/* Nuking inline means the reserve is not keeping up */
+	if (cache_param->lru_reserve > 0 && wrk != lru_reserve_wrk)
+		AZ(pthread_cond_signal(&lru_reserve_cond));
+	return (nuked);
 }
 
 /*--------------------------------------------------------------------
@@ -165,43 +613,141 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, double now)
 int
 LRU_NukeOne(struct worker *wrk, struct lru *lru)
 {
-	struct objcore *oc, *oc2;
+
+	return (lru_nuke(wrk, lru, 1, 1) > 0);
+}
+
+/*--------------------------------------------------------------------
+ * Attempt to make space for an allocation of 'bytes' by nuking as many
+ * objects as it takes, in batches.
+ * Returns: the number of objects nuked in this batch, 0 if none
+ */
+
+unsigned
+LRU_Nuke(struct worker *wrk, struct lru *lru, ssize_t bytes)
+{
+
+	return (lru_nuke(wrk, lru, bytes, LRU_NUKE_BATCH));
+}
+
+/*--------------------------------------------------------------------
+ * Gain a reference on up to 'nmax' of the oldest objects which aren't
+ * in use, until they add up to about 'bytes', so they can be moved to
+ * another stevedore.  Like the nuked ones, they go to the tail of
+ * their list, and the caller must drop the references.
+ * Returns: the number of objects in ocp[]
+ */
+
+unsigned
+LRU_Borrow(struct worker *wrk, struct lru *lru, ssize_t bytes,
+    struct objcore **ocp, unsigned nmax)
+{
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AN(ocp);
+	AN(nmax);
+	return (lru_sweep(wrk, lru, ocp, nmax, bytes, 1));
+}
 
-	if (wrk->strangelove-- <= 0) {
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU reached nuke_limit");
-		return (0);
-	}
+/*--------------------------------------------------------------------
+ * Decide if a new object is worth nuking for, called before the first
+ * nuke on its behalf.  Without a sketch, everything is.
+ * Returns: 1: admit, 0: don't;
+ */
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
+int
+LRU_Admit(struct worker *wrk, struct lru *lru, const struct objcore *oc)
+{
+	const struct objcore *victim;
+	struct lru_list *ll;
+	unsigned f_oc, f_victim = 0;
 
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-			break;
-		}
+	if (lru->sketch == NULL || oc->flags & OC_F_PRIVATE)
+		return (1);
+
+	lru_sketch_add(lru->sketch, oc);
+	f_oc = lru_sketch_get(lru->sketch, oc);
+
+	ll = &lru->list[lru->nuke_next % lru->nlist];
+	Lck_Lock(&ll->mtx);
+	victim = VTAILQ_FIRST(&ll->lru_head);
+	if (victim == NULL)
+		victim = VTAILQ_FIRST(&ll->prot_head);
+	if (victim != NULL)
+		f_victim = lru_sketch_get(lru->sketch, victim);
+	Lck_Unlock(&ll->mtx);
+
+	if (victim == NULL || f_oc > f_victim) {
+		lru->vsc->admitted++;
+		return (1);
 	}
-	Lck_Unlock(&lru->mtx);
+	lru->vsc->rejected++;
+	VSLb(wrk->vsl, SLT_ExpKill, "LRU_Reject n=%u v=%u",
+	    f_oc, f_victim);
+	return (0);
+}
 
-	if (oc == NULL) {
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
-		return (0);
+/*--------------------------------------------------------------------
+ * Keep lru_reserve bytes free in each storage which can tell us how
+ * much it has free, so fetches rarely have to nuke inline.
+ */
+
+static void * __match_proto__(bgthread_t)
+lru_reserve_thread(struct worker *wrk, void *priv)
+{
+	struct vsl_log vsl;
+	struct stevedore *stv;
+	VCL_BYTES space;
+	unsigned n, u;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+
+	VSL_Setup(&vsl, NULL, 0);
+	wrk->vsl = &vsl;
+	lru_reserve_wrk = wrk;
+
+	while (1) {
+		n = 0;
+		STV_Foreach(stv) {
+			if (stv->lru == NULL || stv->var_free_space == NULL)
+				continue;
+			/* The tiered stevedore makes room in its tiers */
+			if (stv->tiered != NULL)
+				continue;
+			space = stv->var_free_space(stv);
+			/* An unbounded malloc wraps around to negative */
+			if (space < 0 || space >= cache_param->lru_reserve)
+				continue;
+			wrk->strangelove = cache_param->nuke_limit;
+			u = LRU_Nuke(wrk, stv->lru,
+			    cache_param->lru_reserve - space);
+			stv->lru->vsc->reserve_nuked += u;
+			n += u;
+		}
+		VSL_Flush(&vsl, 0);
+		if (n > 0)
+			continue;
+		Pool_Sumstat(wrk);
+		Lck_Lock(&lru_reserve_mtx);
+		(void)Lck_CondWait(&lru_reserve_cond, &lru_reserve_mtx,
+		    VTIM_real() + 1.);
+		Lck_Unlock(&lru_reserve_mtx);
 	}
+	NEEDLESS(return NULL);
+}
 
-	/* XXX: We could grab and return one storage segment to our caller */
-	ObjSlim(wrk, oc);
+void
+LRU_Init(void)
+{
+	pthread_t pt;
 
-	VSLb(wrk->vsl, SLT_ExpKill, "LRU x=%u", ObjGetXID(wrk, oc));
-	(void)HSH_DerefObjCore(wrk, &oc, 0);	// Ref from HSH_Snipe
-	return (1);
+	Lck_New(&lru_reserve_mtx, lck_lru);
+	AZ(pthread_cond_init(&lru_reserve_cond, NULL));
+	WRK_BgThread(&pt, "lru-reserve", lru_reserve_thread, NULL);
 }
@@ -34,8 +34,11 @@
 #include "cache/cache_varnishd.h"
 #include "common/heritage.h"
 
+#include <sys/mman.h>
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
@@ -62,6 +65,10 @@ struct sma {
 };
 
 static struct VSC_lck *lck_sma;
+static uintptr_t sma_pagesize;
+
+/* Only allocations this large can have huge pages of their own */
+#define SMA_HUGE_MIN		(2 * 1024 * 1024)
 
 static struct storage * __match_proto__(sml_alloc_f)
 sma_alloc(const struct stevedore *st, size_t size)
@@ -120,6 +127,12 @@ sma_alloc(const struct stevedore *st, size_t size)
 		Lck_Unlock(&sma_sc->sma_mtx);
 		return (NULL);
 	}
+#ifdef MADV_HUGEPAGE
+	if (st->hugepages != STV_HUGEPAGES_OFF && size >= SMA_HUGE_MIN)
+		(void)madvise((void*)RUP2((uintptr_t)p, sma_pagesize),
+		    RDN2((uintptr_t)p + size, sma_pagesize) -
+		    RUP2((uintptr_t)p, sma_pagesize), MADV_HUGEPAGE);
+#endif
 	sma->sc = sma_sc;
 	sma->sz = size;
 	sma->s.priv = sma;
@@ -186,6 +199,8 @@ sma_init(struct stevedore *parent, int ac, char * const *av)
 	AZ(av[ac]);
 	if (ac > 1)
 		ARGV_ERR("(-smalloc) too many arguments\n");
+	if (parent->prefault != STV_PREFAULT_OFF)
+		ARGV_ERR("(-smalloc) prefault is not supported\n");
 
 	if (ac == 0 || *av[0] == '\0')
 		 return;
@@ -208,9 +223,10 @@ sma_open(struct stevedore *st)
 	struct sma_sc *sma_sc;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_sma == NULL)
 		lck_sma = Lck_CreateClass("sma");
+	sma_pagesize = getpagesize();
 	CAST_OBJ_NOTNULL(sma_sc, st->priv, SMA_SC_MAGIC);
 	Lck_New(&sma_sc->sma_mtx, lck_sma);
 	sma_sc->stats = VSC_sma_New(st->ident);
@@ -241,7 +241,7 @@ smp_open_segs(struct smp_sc *sc, struct smp_signspace *spc)
 
 		/*
 		 * HACK: prevent save_segs from nuking segment until we have
-		 * HACK: loaded it.
+		 * HACK: loaded it.  smp_thread() drops this hold.
 		 */
 		sg->nobj = 1;
 		if (sg1 != NULL) {
@@ -272,6 +272,74 @@ smp_open_segs(struct smp_sc *sc, struct smp_signspace *spc)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Closing segments early makes more of them, do not fill more than
+ * half of the segment tables that way.
+ */
+
+static int
+smp_segs_room(const struct smp_sc *sc)
+{
+	const struct smp_seg *sg;
+	uint64_t n = 0;
+
+	Lck_AssertHeld(&sc->mtx);
+	VTAILQ_FOREACH(sg, &sc->segments, list)
+		n++;
+	return (n * sizeof(struct smp_segptr) * 2 <
+	    smp_stuff_len(sc, SMP_SEG1_STUFF));
+}
+
+/*--------------------------------------------------------------------
+ * Segment checker threads
+ *
+ * They stay no more than a few segments ahead of the silo thread, so
+ * what they pulled in from disk is still there when it gets to it.
+ */
+
+static struct smp_seg *
+smp_next_mustload(struct smp_seg *sg)
+{
+
+	while (sg != NULL && !(sg->flags & SMP_SEG_MUSTLOAD))
+		sg = VTAILQ_NEXT(sg, list);
+	return (sg);
+}
+
+static void *
+smp_checker(void *priv)
+{
+	struct smp_sc	*sc;
+	struct smp_seg *sg;
+	int i;
+
+	CAST_OBJ_NOTNULL(sc, priv, SMP_SC_MAGIC);
+	THR_SetName("persistence-check");
+	THR_Init();
+
+	Lck_Lock(&sc->mtx);
+	while ((sg = sc->check_next) != NULL) {
+		if (sc->nahead >= 2 * SMP_NCHECKER) {
+			(void)Lck_CondWait(&sc->cond, &sc->mtx, 0);
+			continue;
+		}
+		sc->check_next = smp_next_mustload(VTAILQ_NEXT(sg, list));
+		sc->nahead++;
+		Lck_Unlock(&sc->mtx);
+		i = smp_check_seg(sc, sg);
+		if (i > 1)
+			printf("Silo segment 0x%jx bad (reason=%d)\n",
+			    (uintmax_t)sg->p.offset, i);
+		Lck_Lock(&sc->mtx);
+		if (i)
+			sg->flags |= SMP_SEG_BAD;
+		sg->flags |= SMP_SEG_CHECKED;
+		AZ(pthread_cond_broadcast(&sc->cond));
+	}
+	Lck_Unlock(&sc->mtx);
+	return (NULL);
+}
+
 /*--------------------------------------------------------------------
  * Silo worker thread
  */
@@ -280,16 +348,42 @@ static void * __match_proto__(bgthread_t)
 smp_thread(struct worker *wrk, void *priv)
 {
 	struct smp_sc	*sc;
-	struct smp_seg *sg;
+	struct smp_seg *sg, *sg2;
+	unsigned u;
+	double t;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(sc, priv, SMP_SC_MAGIC);
 	sc->thread = pthread_self();
 
-	/* First, load all the objects from all segments */
-	VTAILQ_FOREACH(sg, &sc->segments, list)
-		if (sg->flags & SMP_SEG_MUSTLOAD)
-			smp_load_seg(wrk, sc, sg);
+	/*
+	 * First, load all the objects from all segments, in order, as the
+	 * checkers are done with them, so that when an object is in more
+	 * than one segment, the newest one ends up first in the hash.
+	 */
+	Lck_Lock(&sc->mtx);
+	sc->check_next = smp_next_mustload(VTAILQ_FIRST(&sc->segments));
+	for (u = 0; u < SMP_NCHECKER; u++)
+		AZ(pthread_create(&sc->checker[u], NULL, smp_checker, sc));
+	sg = smp_next_mustload(VTAILQ_FIRST(&sc->segments));
+	while (sg != NULL) {
+		while (!(sg->flags & SMP_SEG_CHECKED))
+			(void)Lck_CondWait(&sc->cond, &sc->mtx, 0);
+		Lck_Unlock(&sc->mtx);
+		smp_load_seg(wrk, sc, sg);
+		Lck_Lock(&sc->mtx);
+		assert(sc->nahead > 0);
+		sc->nahead--;
+		AZ(pthread_cond_broadcast(&sc->cond));
+		sg2 = smp_next_mustload(VTAILQ_NEXT(sg, list));
+		/* Drop the hold from smp_open_segs() */
+		assert(sg->nobj > 0);
+		sg->nobj--;
+		sg = sg2;
+	}
+	Lck_Unlock(&sc->mtx);
+	for (u = 0; u < SMP_NCHECKER; u++)
+		AZ(pthread_join(sc->checker[u], NULL));
 
 	sc->flags |= SMP_SC_LOADED;
 	BAN_Release();
@@ -302,6 +396,15 @@ smp_thread(struct worker *wrk, void *priv)
 		if (sg != NULL && sg != sc->cur_seg && sg->nobj == 0)
 			smp_save_segs(sc);
 
+		/* Bound what a crash can lose */
+		t = cache_param->persistent_sync_interval;
+		sg = sc->cur_seg;
+		if (t > 0. && sg != NULL && sg->nalloc > 0 &&
+		    VTIM_real() - sg->t_open > t && smp_segs_room(sc)) {
+			smp_close_seg(sc, sg);
+			smp_new_seg(sc);
+		}
+
 		Lck_Unlock(&sc->mtx);
 		VTIM_sleep(3.14159265359 - 2);
 		Lck_Lock(&sc->mtx);
@@ -332,6 +435,7 @@ smp_open(struct stevedore *st)
 	CAST_OBJ_NOTNULL(sc, st->priv, SMP_SC_MAGIC);
 
 	Lck_New(&sc->mtx, lck_smp);
+	AZ(pthread_cond_init(&sc->cond, NULL));
 	Lck_Lock(&sc->mtx);
 
 	sc->stevedore = st;
@@ -560,12 +664,17 @@ smp_allocobj(struct worker *wrk, const struct stevedore *stv,
 	sg->nfixed++;
 	sg->nobj++;
 
+	/* The smp_objects may have been moved by smp_close_seg() */
+	assert(objidx > 0 && objidx <= sg->p.lobjlist);
+	so = &sg->objs[sg->p.lobjlist - objidx];
+
 	/* We have to do this somewhere, might as well be here... */
 	assert(sizeof so->hash == DIGEST_LEN);
 	memcpy(so->hash, oc->objhead->digest, DIGEST_LEN);
 	EXP_COPY(so, oc);
 	so->ptr = (uint8_t*)o - sc->base;
 	so->ban = BAN_Time(oc->ban);
+	so->check = smp_object_check(so);
 
 	smp_init_oc(oc, sg, objidx);
 
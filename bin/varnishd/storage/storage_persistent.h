@@ -57,12 +57,25 @@
  *	sha256[...]			checksum of same
  *
  *	N segments {
- *		struct smp_sign;
- *		struct smp_object[M]	Objects in segment
+ *		struct smp_sign;	SEGHEAD
  *		sha256[...]		checksum of same
  *		objspace
+ *		struct smp_sign;	OBJIDX
+ *		sha256[...]		checksum of same
+ *		struct smp_object[M]	Objects in segment
+ *		struct smp_sign;	SEGTAIL
+ *		sha256[...]		checksum of same
  *	}
  *
+ * The silo is written as a log: objects go into the open segment, and
+ * when it is closed, its contents are synced to disk before the OBJIDX
+ * and SEGTAIL signatures are written and the segment is added to the
+ * segment tables.  A segment which is in the tables is thus complete
+ * on disk, and a crash only loses the open segment.
+ *
+ * The smp_objects are updated in place while the segment is in use,
+ * so they can not be covered by the OBJIDX signature.  Instead each
+ * one carries a check of the fields which do not change.
  */
 
 /*
@@ -109,6 +122,8 @@ struct smp_ident {
 
 #define SMP_IDENT_STRING	"Varnish Persistent Storage Silo"
 
+#define SMP_MAJOR_VERSION	3
+
 /*
  * This is used to sign various bits on the disk.
  */
@@ -148,7 +163,8 @@ struct smp_object {
 	float			ttl;
 	float			grace;
 	float			keep;
-	uint32_t		__filler__;	/* -> align/8 on 32bit */
+	uint32_t		check;		/* crc32 of hash and ptr,
+						 * also align/8 on 32bit */
 	double			ban;
 	uint64_t		ptr;		/* rel to silo */
 };
@@ -205,6 +221,10 @@ struct smp_seg {
 	unsigned		flags;
 #define SMP_SEG_MUSTLOAD	(1 << 0)
 #define SMP_SEG_LOADED		(1 << 1)
+#define SMP_SEG_CHECKED		(1 << 2)
+#define SMP_SEG_BAD		(1 << 3)
+
+	double			t_open;		/* when it became cur_seg */
 
 	uint32_t		nobj;		/* Number of objects */
 	uint32_t		nalloc;		/* Allocations */
@@ -217,12 +237,16 @@ struct smp_seg {
 
 VTAILQ_HEAD(smp_seghead, smp_seg);
 
+/* Threads checking segments ahead of loading them */
+#define SMP_NCHECKER		4
+
 struct smp_sc {
 	unsigned		magic;
 #define SMP_SC_MAGIC		0x7b73af0a
 	struct stevedore	*parent;
 
 	pthread_t		bgthread;
+	pthread_t		checker[SMP_NCHECKER];
 	unsigned		flags;
 #define SMP_SC_LOADED		(1 << 0)
 #define SMP_SC_STOP		(1 << 1)
@@ -257,6 +281,11 @@ struct smp_sc {
 	struct smp_signspace	seg2;
 
 	struct lock		mtx;
+	pthread_cond_t		cond;
+
+	/* Loading */
+	struct smp_seg		*check_next;	/* next to check */
+	unsigned		nahead;		/* checked, not loaded */
 
 	/* Cleaner metrics */
 
@@ -303,11 +332,13 @@ void smp_mgt_init(struct stevedore *parent, int ac, char * const *av);
 
 /* storage_persistent_silo.c */
 
+int smp_check_seg(const struct smp_sc *sc, const struct smp_seg *sg);
 void smp_load_seg(struct worker *, const struct smp_sc *sc, struct smp_seg *sg);
 void smp_new_seg(struct smp_sc *sc);
 void smp_close_seg(struct smp_sc *sc, struct smp_seg *sg);
 void smp_init_oc(struct objcore *oc, struct smp_seg *sg, unsigned objidx);
 void smp_save_segs(struct smp_sc *sc);
+uint32_t smp_object_check(const struct smp_object *so);
 sml_getobj_f smp_sml_getobj;
 void smp_oc_objfree(struct worker *, struct objcore *);
 obj_event_f smp_oc_event;
@@ -319,6 +350,7 @@ void smp_def_sign(const struct smp_sc *sc, struct smp_signctx *ctx,
 int smp_chk_sign(struct smp_signctx *ctx);
 void smp_reset_sign(struct smp_signctx *ctx);
 void smp_sync_sign(const struct smp_signctx *ctx);
+void smp_sync_range(const struct smp_sc *sc, uint64_t off, uint64_t len);
 
 int smp_chk_signspace(struct smp_signspace *spc);
 void smp_append_signspace(struct smp_signspace *spc, uint32_t len);
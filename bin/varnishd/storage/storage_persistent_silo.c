@@ -42,6 +42,7 @@
 
 #include "vsha256.h"
 #include "vend.h"
+#include "vgz.h"
 #include "vtim.h"
 
 #include "cache/cache_objhead.h"
@@ -113,6 +114,65 @@ smp_save_segs(struct smp_sc *sc)
 	smp_save_seg(sc, &sc->seg2);
 }
 
+/*--------------------------------------------------------------------
+ * The check of the parts of a smp_object which never change
+ */
+
+uint32_t
+smp_object_check(const struct smp_object *so)
+{
+	uLong crc;
+
+	crc = crc32(0L, so->hash, sizeof so->hash);
+	crc = crc32(crc, (const void *)&so->ptr, sizeof so->ptr);
+	return ((uint32_t)crc);
+}
+
+/*--------------------------------------------------------------------
+ * Check a segment before loading it
+ *
+ * This is where the time goes when a silo is loaded, since it pulls
+ * the object index in from disk, so it is done by several threads
+ * ahead of smp_load_seg(), which runs in segment order.
+ */
+
+int
+smp_check_seg(const struct smp_sc *sc, const struct smp_seg *sg)
+{
+	struct smp_signctx ctx[1];
+	const volatile uint8_t *p;
+	uint64_t l, u, pg;
+
+	CHECK_OBJ_NOTNULL(sg, SMP_SEG_MAGIC);
+	AN(sg->p.offset);
+	if (sg->p.objlist == 0)
+		return (1);		/* Never closed */
+	if (sg->p.objlist < sg->p.offset + 2 * IRNUP(sc, SMP_SIGN_SPACE) ||
+	    sg->p.objlist + sizeof(struct smp_object) * sg->p.lobjlist +
+	    IRNUP(sc, SMP_SIGN_SPACE) > smp_segend(sg) ||
+	    smp_segend(sg) > (uint64_t)sc->mediasize)
+		return (2);		/* Does not add up */
+
+	smp_def_sign(sc, ctx, sg->p.offset, "SEGHEAD");
+	if (smp_chk_sign(ctx))
+		return (3);
+	smp_def_sign(sc, ctx, sg->p.objlist - IRNUP(sc, SMP_SIGN_SPACE),
+	    "OBJIDX");
+	if (smp_chk_sign(ctx))
+		return (4);
+	smp_def_sign(sc, ctx, smp_segend(sg) - IRNUP(sc, SMP_SIGN_SPACE),
+	    "SEGTAIL");
+	if (smp_chk_sign(ctx))
+		return (5);
+
+	p = sc->base + sg->p.objlist;
+	l = sizeof(struct smp_object) * sg->p.lobjlist;
+	pg = getpagesize();
+	for (u = 0; u < l; u += pg)
+		(void)p[u];
+	return (0);
+}
+
 /*--------------------------------------------------------------------
  * Load segments
  *
@@ -131,44 +191,49 @@ void
 smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
     struct smp_seg *sg)
 {
+	struct smp_sc *sc2;
 	struct smp_object *so;
 	struct objcore *oc;
 	struct ban *ban;
-	uint32_t no;
+	uint32_t no, nbad = 0;
 	double t_now = VTIM_real();
-	struct smp_signctx ctx[1];
 
 	ASSERT_SILO_THREAD(sc);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(sg, SMP_SEG_MAGIC);
+	CAST_OBJ_NOTNULL(sc2, sg->sc, SMP_SC_MAGIC);
 	assert(sg->flags & SMP_SEG_MUSTLOAD);
+	assert(sg->flags & SMP_SEG_CHECKED);
 	sg->flags &= ~SMP_SEG_MUSTLOAD;
-	AN(sg->p.offset);
-	if (sg->p.objlist == 0)
-		return;
-	smp_def_sign(sc, ctx, sg->p.offset, "SEGHEAD");
-	if (smp_chk_sign(ctx))
+	if (sg->flags & SMP_SEG_BAD)
 		return;
 
-	/* test SEGTAIL */
-	/* test OBJIDX */
 	so = (void*)(sc->base + sg->p.objlist);
 	sg->objs = so;
 	no = sg->p.lobjlist;
-	/* Clear the bogus "hold" count */
-	sg->nobj = 0;
+	/*
+	 * The objects go into the hash as we get to them, so they can be
+	 * used, and freed, while we are still at it.  The segment has a
+	 * bogus hold on nobj until the silo thread is done with it.
+	 */
 	for (;no > 0; so++,no--) {
-		if (EXP_WHEN(so) < t_now)
+		if (so->ptr == 0 || EXP_WHEN(so) < t_now)
 			continue;
+		if (so->check != smp_object_check(so)) {
+			nbad++;
+			continue;
+		}
 		ban = BAN_FindBan(so->ban);
 		AN(ban);
 		oc = ObjNew(wrk);
 		oc->stobj->stevedore = sc->parent;
 		smp_init_oc(oc, sg, no);
-		VTAILQ_INSERT_TAIL(&sg->objcores, oc, lru_list);
 		oc->stobj->priv2 |= NEED_FIXUP;
 		EXP_COPY(oc, so);
+		Lck_Lock(&sc2->mtx);
+		VTAILQ_INSERT_TAIL(&sg->objcores, oc, lru_list);
 		sg->nobj++;
+		Lck_Unlock(&sc2->mtx);
 		oc->refcnt++;
 		HSH_Insert(wrk, so->hash, oc, ban);
 		AN(oc->ban);
@@ -176,6 +241,9 @@ smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
 		(void)HSH_DerefObjCore(wrk, &oc, HSH_RUSH_POLICY);
 		wrk->stats->n_vampireobject++;
 	}
+	if (nbad > 0)
+		printf("Silo segment 0x%jx: %u bad objects dropped\n",
+		    (uintmax_t)sg->p.offset, nbad);
 	Pool_Sumstat(wrk);
 	sg->flags |= SMP_SEG_LOADED;
 }
@@ -245,6 +313,7 @@ smp_new_seg(struct smp_sc *sc)
 
 	/* Set up our allocation points */
 	sc->cur_seg = sg;
+	sg->t_open = VTIM_real();
 	sc->next_bot = sg->p.offset + IRNUP(sc, SMP_SIGN_SPACE);
 	sc->next_top = smp_segend(sg);
 	sc->next_top -= IRNUP(sc, SMP_SIGN_SPACE);
@@ -304,6 +373,13 @@ smp_close_seg(struct smp_sc *sc, struct smp_seg *sg)
 	/* Update the segment header */
 	sg->p.objlist = sc->next_top;
 
+	/*
+	 * Everything in the segment must be on disk before the signatures
+	 * which say it is complete, and the segment tables which point to
+	 * it, are.
+	 */
+	smp_sync_range(sc, sg->p.offset, sg->p.length);
+
 	/* Write the (empty) OBJIDX signature */
 	sc->next_top -= IRNUP(sc, SMP_SIGN_SPACE);
 	assert(sc->next_top >= sc->next_bot);
@@ -161,6 +161,19 @@ smp_sync_sign(const struct smp_signctx *ctx)
 	smp_msync(ctx->ss, SMP_SIGN_SPACE + ctx->ss->length);
 }
 
+/*--------------------------------------------------------------------
+ * Force a write of a range of the silo to the backing store.
+ */
+
+void
+smp_sync_range(const struct smp_sc *sc, uint64_t off, uint64_t len)
+{
+
+	assert(off + len <= (uint64_t)sc->mediasize);
+	if (len > 0)
+		smp_msync(sc->base + off, len);
+}
+
 /*--------------------------------------------------------------------
  * Create and force a new signature to backing store
  */
@@ -289,7 +302,7 @@ smp_newsilo(struct smp_sc *sc)
 	strcpy(si->ident, SMP_IDENT_STRING);
 	si->byte_order = 0x12345678;
 	si->size = sizeof *si;
-	si->major_version = 2;
+	si->major_version = SMP_MAJOR_VERSION;
 	si->unique = sc->unique;
 	si->mediasize = sc->mediasize;
 	si->granularity = sc->granularity;
@@ -343,7 +356,7 @@ smp_valid_silo(struct smp_sc *sc)
 		return (13);
 	if (si->size != sizeof *si)
 		return (14);
-	if (si->major_version != 2)
+	if (si->major_version != SMP_MAJOR_VERSION)
 		return (15);
 	if (si->mediasize != sc->mediasize)
 		return (17);
@@ -31,17 +31,23 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <stdlib.h>
+
 #include "cache/cache_obj.h"
 #include "cache/cache_objhead.h"
 
 #include "storage/storage.h"
 #include "storage/storage_simple.h"
 
+#include "vsha256.h"
 #include "vtim.h"
+#include "vtree.h"
 
 /* Flags for allocating memory in sml_stv_alloc */
 #define LESS_MEM_ALLOCED_IS_OK	1
 
+static objiterator_f sml_iterator;
+
 /*-------------------------------------------------------------------*/
 
 static struct storage *
@@ -90,6 +96,148 @@ sml_stv_free(const struct stevedore *stv, struct storage *st)
 		stv->sml_free(st);
 }
 
+/*--------------------------------------------------------------------
+ * Small bodies can live in the allocation of their object, see
+ * SML_allocobj().  Such a segment goes when its object goes.
+ */
+
+static int
+sml_inline(const struct object *o, const struct storage *st)
+{
+	const struct storage *ost;
+
+	ost = o->objstore;
+	return (st != NULL && ost != NULL &&
+	    (const unsigned char *)st >= ost->ptr &&
+	    (const unsigned char *)st < ost->ptr + ost->space);
+}
+
+static void
+sml_seg_free(const struct stevedore *stv, const struct object *o,
+    struct storage *st)
+{
+
+	if (!sml_inline(o, st))
+		sml_stv_free(stv, st);
+}
+
+/*--------------------------------------------------------------------
+ * Identical bodies, typically Vary variants which do not differ or the
+ * same content under several URLs, are stored only once:  When a body
+ * is complete we look for one with the same digest and length in the
+ * same stevedore, and if there is one, the object drops its segments
+ * and refers to the shared ones instead.
+ *
+ * The reference is a segment without memory, the only one on the
+ * object's list, so that objects which do not share pay nothing.
+ */
+
+struct sml_body {
+	unsigned		magic;
+#define SML_BODY_MAGIC		0x1d5a3c6b
+	unsigned		refcnt;
+	int			indexed;
+	const struct stevedore	*stv;
+	ssize_t			len;
+	unsigned char		digest[VSHA256_LEN];
+	VRB_ENTRY(sml_body)	tree;
+	struct storagehead	list;
+};
+
+struct sml_job {
+	unsigned		magic;
+#define SML_JOB_MAGIC		0x4e0a9f1d
+	unsigned		tries;
+	double			when;
+	struct objcore		*oc;
+	struct sml_body		key;
+	VTAILQ_ENTRY(sml_job)	list;
+};
+
+#define SML_DEDUP_QUEUE		1024
+#define SML_DEDUP_TRIES		5
+
+struct sml_share {
+	struct storage		*ref;
+	struct storagehead	*list;	/* Where the segments go */
+};
+
+static int
+sml_body_cmp(const struct sml_body *b1, const struct sml_body *b2)
+{
+
+	if (b1->stv != b2->stv)
+		return ((uintptr_t)b1->stv < (uintptr_t)b2->stv ? -1 : 1);
+	if (b1->len != b2->len)
+		return (b1->len < b2->len ? -1 : 1);
+	return (memcmp(b1->digest, b2->digest, sizeof b1->digest));
+}
+
+VRB_HEAD(sml_body_tree, sml_body);
+VRB_PROTOTYPE_STATIC(sml_body_tree, sml_body, tree, sml_body_cmp)
+VRB_GENERATE_STATIC(sml_body_tree, sml_body, tree, sml_body_cmp)
+
+static struct sml_body_tree sml_bodies = VRB_INITIALIZER(&sml_bodies);
+static struct VSC_lck *lck_sml;
+static struct lock sml_body_mtx;
+static pthread_cond_t sml_dedup_cond;
+static VTAILQ_HEAD(, sml_job) sml_jobs = VTAILQ_HEAD_INITIALIZER(sml_jobs);
+static VTAILQ_HEAD(, sml_job) sml_retry = VTAILQ_HEAD_INITIALIZER(sml_retry);
+static unsigned sml_njob;
+static int sml_dedup_running;
+
+static struct sml_body *
+sml_shared(const struct object *o)
+{
+	struct storage *st;
+	struct sml_body *b;
+
+	st = VTAILQ_FIRST(&o->list);
+	if (st == NULL || st->ptr != NULL)
+		return (NULL);
+	CHECK_OBJ(st, STORAGE_MAGIC);
+	AZ(VTAILQ_NEXT(st, list));
+	CAST_OBJ_NOTNULL(b, st->priv, SML_BODY_MAGIC);
+	return (b);
+}
+
+static struct storagehead *
+sml_bodylist(struct object *o)
+{
+	struct sml_body *b;
+
+	b = sml_shared(o);
+	if (b == NULL)
+		return (&o->list);
+	return (&b->list);
+}
+
+static void
+sml_body_deref(struct worker *wrk, struct sml_body **bp)
+{
+	struct sml_body *b;
+	struct storage *st, *stn;
+	unsigned r;
+
+	TAKE_OBJ_NOTNULL(b, bp, SML_BODY_MAGIC);
+	Lck_Lock(&sml_body_mtx);
+	assert(b->refcnt > 0);
+	r = --b->refcnt;
+	if (r == 0 && b->indexed) {
+		VRB_REMOVE(sml_body_tree, &sml_bodies, b);
+		wrk->stats->n_dedup_body--;
+	}
+	Lck_Unlock(&sml_body_mtx);
+	if (r > 0)
+		return;
+	VTAILQ_FOREACH_SAFE(st, &b->list, list, stn) {
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		VTAILQ_REMOVE(&b->list, st, list);
+		sml_stv_free(b->stv, st);
+	}
+	FREE_OBJ(b);
+}
+
 /*--------------------------------------------------------------------
  * This function is called by stevedores ->allocobj() method, which
  * very often will be SML_allocobj() below, to convert a slab
@@ -123,6 +271,11 @@ SML_MkObject(const struct stevedore *stv, struct objcore *oc, void *ptr)
 /*--------------------------------------------------------------------
  * This is the default ->allocobj() which all stevedores who do not
  * implement persistent storage can rely on.
+ *
+ * If the body is known to be no larger than the inline_body_max
+ * parameter, it gets a segment right after the variable attributes, so
+ * that small objects take a single allocation.  Stevedores which do
+ * their own iteration get no inline segments, they may not expect them.
  */
 
 int __match_proto__(storage_allocobj_f)
@@ -130,8 +283,10 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
     struct objcore *oc, unsigned wsl)
 {
 	struct object *o;
-	struct storage *st = NULL;
-	unsigned ltot;
+	struct storage *st = NULL, *st2;
+	unsigned lobj, lbody = 0, ltot;
+	VCL_BYTES space;
+	int admitted = 0;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
@@ -139,15 +294,46 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 
 	AN(stv->sml_alloc);
 
-	ltot = sizeof(struct object) + PRNDUP(wsl);
+	lobj = sizeof(struct object) + PRNDUP(wsl);
+	if (oc->boc != NULL && oc->boc->len_estimate > 0 &&
+	    oc->boc->len_estimate <= cache_param->inline_body_max &&
+	    stv->methods->objiterator == sml_iterator)
+		lbody = oc->boc->len_estimate;
+	ltot = lobj;
+	if (lbody > 0)
+		ltot += sizeof *st2 + lbody;
+
+	/*
+	 * It is usually the body which needs room made for it, and its
+	 * segments are allocated too late to go to Transient instead, so
+	 * if we know it will not fit, ask the LRU policy now.
+	 */
+	if (lbody == 0 && stv->lru != NULL && stv->var_free_space != NULL &&
+	    oc->boc != NULL && oc->boc->len_estimate > 0) {
+		space = stv->var_free_space(stv);
+		/* An unbounded malloc wraps around to negative */
+		if (space >= 0 && space < ltot + oc->boc->len_estimate) {
+			if (!LRU_Admit(wrk, stv->lru, oc))
+				return (0);
+			admitted = 1;
+		}
+	}
 
-	do {
+	while (1) {
 		st = stv->sml_alloc(stv, ltot);
 		if (st != NULL && st->space < ltot) {
 			stv->sml_free(st);
 			st = NULL;
 		}
-	} while (st == NULL && LRU_NukeOne(wrk, stv->lru));
+		if (st != NULL)
+			break;
+		/* Ask the LRU policy if this object is worth nuking for */
+		if (!admitted && !LRU_Admit(wrk, stv->lru, oc))
+			break;
+		admitted = 1;
+		if (!LRU_Nuke(wrk, stv->lru, ltot))
+			break;
+	}
 	if (st == NULL)
 		return (0);
 
@@ -156,6 +342,15 @@ SML_allocobj(struct worker *wrk, const struct stevedore *stv,
 	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
 	st->len = sizeof(*o);
 	o->objstore = st;
+	if (lbody > 0) {
+		st2 = (void *)(st->ptr + lobj);
+		assert(PAOK(st2));
+		INIT_OBJ(st2, STORAGE_MAGIC);
+		st2->priv = st->priv;
+		st2->ptr = (void *)(st2 + 1);
+		st2->space = lbody;
+		VTAILQ_INSERT_TAIL(&o->list, st2, list);
+	}
 	return (1);
 }
 
@@ -186,6 +381,7 @@ sml_slim(struct worker *wrk, struct objcore *oc)
 	const struct stevedore *stv;
 	struct object *o;
 	struct storage *st, *stn;
+	struct sml_body *b;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 
@@ -201,10 +397,18 @@ sml_slim(struct worker *wrk, struct objcore *oc)
 	}
 #include "tbl/obj_attr.h"
 
+	b = sml_shared(o);
+	if (b != NULL) {
+		st = VTAILQ_FIRST(&o->list);
+		VTAILQ_REMOVE(&o->list, st, list);
+		FREE_OBJ(st);
+		sml_body_deref(wrk, &b);
+	}
+
 	VTAILQ_FOREACH_SAFE(st, &o->list, list, stn) {
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
 		VTAILQ_REMOVE(&o->list, st, list);
-		sml_stv_free(stv, st);
+		sml_seg_free(stv, o, st);
 	}
 }
 
@@ -229,14 +433,46 @@ sml_objfree(struct worker *wrk, struct objcore *oc)
 	wrk->stats->n_object--;
 }
 
+/*--------------------------------------------------------------------
+ * Tell the stevedore which segment delivery is at, and keep it told
+ * about the next cache_param->readahead ones.  ra is the last segment
+ * it was told about, unless delivery has got past it.
+ */
+
+static struct storage *
+sml_readahead(const struct stevedore *stv, struct storage *st,
+    struct storage *ra)
+{
+	struct storage *st2;
+	unsigned n = 0, lim = cache_param->readahead;
+
+	stv->sml_readahead(st, 0);
+	for (st2 = st; ra != NULL && st2 != NULL && st2 != ra && n <= lim;
+	    st2 = VTAILQ_NEXT(st2, list))
+		n++;
+	if (ra == NULL || st2 != ra) {
+		ra = st;
+		n = 0;
+	}
+	while (n < lim && (st2 = VTAILQ_NEXT(ra, list)) != NULL) {
+		ra = st2;
+		n++;
+		if (ra->len > 0)
+			stv->sml_readahead(ra, 1);
+	}
+	return (ra);
+}
+
 static int __match_proto__(objiterate_f)
 sml_iterator(struct worker *wrk, struct objcore *oc,
     void *priv, objiterate_f *func, int final)
 {
 	struct boc *boc;
 	struct object *obj;
+	struct storagehead *sh;
 	struct storage *st;
 	struct storage *checkpoint = NULL;
+	struct storage *ra = NULL;
 	const struct stevedore *stv;
 	ssize_t checkpoint_len = 0;
 	ssize_t len = 0;
@@ -255,12 +491,16 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 	boc = HSH_RefBoc(oc);
 
 	if (boc == NULL) {
-		VTAILQ_FOREACH_SAFE(st, &obj->list, list, checkpoint) {
-			if (ret == 0 && st->len > 0)
+		sh = sml_bodylist(obj);
+		VTAILQ_FOREACH_SAFE(st, sh, list, checkpoint) {
+			if (ret == 0 && st->len > 0) {
+				if (stv->sml_readahead != NULL)
+					ra = sml_readahead(stv, st, ra);
 				ret = func(priv, 1, st->ptr, st->len);
-			if (final) {
-				VTAILQ_REMOVE(&obj->list, st, list);
-				sml_stv_free(stv, st);
+			}
+			if (final && sh == &obj->list) {
+				VTAILQ_REMOVE(sh, st, list);
+				sml_seg_free(stv, obj, st);
 			} else if (ret)
 				break;
 		}
@@ -309,7 +549,7 @@ sml_iterator(struct worker *wrk, struct objcore *oc,
 				if (final && checkpoint != NULL) {
 					VTAILQ_REMOVE(&obj->list,
 					    checkpoint, list);
-					sml_stv_free(stv, checkpoint);
+					sml_seg_free(stv, obj, checkpoint);
 				}
 				checkpoint = st;
 				checkpoint_len = sl;
@@ -359,7 +599,7 @@ objallocwithnuke(struct worker *wrk, const struct stevedore *stv, size_t size,
 		/* no luck; try to free some space and keep trying */
 		if (stv->lru == NULL)
 			break;
-	} while (LRU_NukeOne(wrk, stv->lru));
+	} while (LRU_Nuke(wrk, stv->lru, size));
 
 	CHECK_OBJ_ORNULL(st, STORAGE_MAGIC);
 	return (st);
@@ -450,11 +690,11 @@ sml_trimstore(struct worker *wrk, struct objcore *oc)
 		Lck_Lock(&oc->boc->mtx);
 		VTAILQ_REMOVE(&o->list, st, list);
 		Lck_Unlock(&oc->boc->mtx);
-		sml_stv_free(stv, st);
+		sml_seg_free(stv, o, st);
 		return;
 	}
 
-	if (st->space - st->len < 512)
+	if (st->space - st->len < 512 || sml_inline(o, st))
 		return;
 
 	st1 = sml_stv_alloc(stv, st->len, 0);
@@ -473,6 +713,230 @@ sml_trimstore(struct worker *wrk, struct objcore *oc)
 	oc->boc->stevedore_priv = st;
 }
 
+static void __match_proto__(hsh_exclusive_f)
+sml_share(struct objcore *oc, void *priv)
+{
+	struct sml_share *ss;
+	struct object *o;
+
+	AN(priv);
+	ss = priv;
+	CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+	AZ(sml_shared(o));
+	VTAILQ_CONCAT(ss->list, &o->list, list);
+	VTAILQ_INSERT_HEAD(&o->list, ss->ref, list);
+}
+
+static int
+sml_dedup(struct worker *wrk, struct sml_job *j)
+{
+	struct object *o;
+	struct sml_body *b, *key;
+	struct sml_share ss;
+	struct storagehead sh;
+	struct storage *st, *stn;
+	struct VSHA256Context sha;
+
+	CHECK_OBJ_NOTNULL(j, SML_JOB_MAGIC);
+	o = sml_getobj(wrk, j->oc);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	if (sml_shared(o) != NULL || (j->oc->flags & OC_F_DYING))
+		return (0);
+	/* Inline bodies cannot be handed over, and are tiny anyway */
+	if (sml_inline(o, VTAILQ_FIRST(&o->list)))
+		return (0);
+
+	key = &j->key;
+	if (key->magic == 0) {
+		INIT_OBJ(key, SML_BODY_MAGIC);
+		key->stv = j->oc->stobj->stevedore;
+		VSHA256_Init(&sha);
+		VTAILQ_FOREACH(st, &o->list, list) {
+			VSHA256_Update(&sha, st->ptr, st->len);
+			key->len += st->len;
+		}
+		VSHA256_Final(key->digest, &sha);
+	}
+	if (key->len == 0)
+		return (0);
+
+	Lck_Lock(&sml_body_mtx);
+	b = VRB_FIND(sml_body_tree, &sml_bodies, key);
+	if (b != NULL)
+		b->refcnt++;
+	Lck_Unlock(&sml_body_mtx);
+
+	ALLOC_OBJ(ss.ref, STORAGE_MAGIC);
+	AN(ss.ref);
+
+	if (b == NULL) {
+		/* First of its kind, hand our segments over to a body */
+		ALLOC_OBJ(b, SML_BODY_MAGIC);
+		AN(b);
+		b->refcnt = 1;
+		b->stv = key->stv;
+		b->len = key->len;
+		memcpy(b->digest, key->digest, sizeof b->digest);
+		VTAILQ_INIT(&b->list);
+		ss.ref->priv = b;
+		ss.list = &b->list;
+		if (!HSH_Exclusive(j->oc, sml_share, &ss)) {
+			FREE_OBJ(ss.ref);
+			FREE_OBJ(b);
+			return (1);
+		}
+		Lck_Lock(&sml_body_mtx);
+		if (VRB_INSERT(sml_body_tree, &sml_bodies, b) == NULL) {
+			b->indexed = 1;
+			wrk->stats->n_dedup_body++;
+		}
+		Lck_Unlock(&sml_body_mtx);
+		return (0);
+	}
+
+	VTAILQ_INIT(&sh);
+	ss.ref->priv = b;
+	ss.list = &sh;
+	if (!HSH_Exclusive(j->oc, sml_share, &ss)) {
+		FREE_OBJ(ss.ref);
+		sml_body_deref(wrk, &b);
+		return (1);
+	}
+	VTAILQ_FOREACH_SAFE(st, &sh, list, stn) {
+		VTAILQ_REMOVE(&sh, st, list);
+		sml_stv_free(key->stv, st);
+	}
+	wrk->stats->dedup_shared++;
+	wrk->stats->dedup_bytes += key->len;
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Objects are queued for deduplication when their body is complete.
+ * Whoever completed it is usually still delivering it, so we do the
+ * work in the background, and try again a little later as long as
+ * somebody is using the object.
+ */
+
+static void * __match_proto__(bgthread_t)
+sml_dedup_thread(struct worker *wrk, void *priv)
+{
+	struct sml_job *j;
+	double now;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(priv);
+
+	Lck_Lock(&sml_body_mtx);
+	while (1) {
+		now = VTIM_real();
+		j = VTAILQ_FIRST(&sml_jobs);
+		if (j == NULL) {
+			j = VTAILQ_FIRST(&sml_retry);
+			if (j != NULL && j->when > now) {
+				Pool_Sumstat(wrk);
+				(void)Lck_CondWait(&sml_dedup_cond,
+				    &sml_body_mtx, j->when);
+				continue;
+			}
+		}
+		if (j == NULL) {
+			Pool_Sumstat(wrk);
+			(void)Lck_CondWait(&sml_dedup_cond, &sml_body_mtx, 0);
+			continue;
+		}
+		CHECK_OBJ(j, SML_JOB_MAGIC);
+		if (j->tries == 0)
+			VTAILQ_REMOVE(&sml_jobs, j, list);
+		else
+			VTAILQ_REMOVE(&sml_retry, j, list);
+		Lck_Unlock(&sml_body_mtx);
+
+		i = sml_dedup(wrk, j);
+
+		Lck_Lock(&sml_body_mtx);
+		if (i && ++j->tries < SML_DEDUP_TRIES) {
+			j->when = now + 1.;
+			VTAILQ_INSERT_TAIL(&sml_retry, j, list);
+			continue;
+		}
+		if (i)
+			wrk->stats->dedup_fail++;
+		sml_njob--;
+		Lck_Unlock(&sml_body_mtx);
+		(void)HSH_DerefObjCore(wrk, &j->oc, 0);
+		FREE_OBJ(j);
+		Lck_Lock(&sml_body_mtx);
+	}
+	NEEDLESS(return NULL);
+}
+
+static void
+sml_dedup_queue(struct worker *wrk, struct objcore *oc)
+{
+	struct sml_job *j = NULL;
+	pthread_t pt;
+
+	Lck_Lock(&sml_body_mtx);
+	if (!sml_dedup_running) {
+		WRK_BgThread(&pt, "sml-dedup", sml_dedup_thread, NULL);
+		sml_dedup_running = 1;
+	}
+	if (sml_njob < SML_DEDUP_QUEUE) {
+		ALLOC_OBJ(j, SML_JOB_MAGIC);
+		AN(j);
+		HSH_Ref(oc);
+		j->oc = oc;
+		VTAILQ_INSERT_TAIL(&sml_jobs, j, list);
+		sml_njob++;
+		AZ(pthread_cond_signal(&sml_dedup_cond));
+	}
+	Lck_Unlock(&sml_body_mtx);
+	if (j == NULL)
+		wrk->stats->dedup_fail++;
+}
+
+/*--------------------------------------------------------------------
+ * How much getting rid of an object frees, which is nothing while
+ * others share its body.  The refcount is read without the lock, the
+ * LRU can live with a stale answer.
+ */
+
+ssize_t
+SML_Freeable(struct worker *wrk, struct objcore *oc)
+{
+	const struct stevedore *stv;
+	struct object *o;
+	struct sml_body *b;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	if (stv->sml_getobj == NULL &&
+	    stv->methods->objiterator == sml_iterator) {
+		CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+		b = sml_shared(o);
+		if (b != NULL && b->refcnt > 1)
+			return (0);
+	}
+	return ((ssize_t)ObjGetLen(wrk, oc));
+}
+
+/*--------------------------------------------------------------------
+ * The dedup thread is started with the first object queued for it.
+ */
+
+void
+SML_Init(void)
+{
+
+	lck_sml = Lck_CreateClass("sml");
+	Lck_New(&sml_body_mtx, lck_sml);
+	AZ(pthread_cond_init(&sml_dedup_cond, NULL));
+}
+
 static void __match_proto__(objbocdone_f)
 sml_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
 {
@@ -493,6 +957,19 @@ sml_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
 		sml_stv_free(stv, st);
 	}
 
+	/*
+	 * Only cached objects of stevedores which leave their segments
+	 * entirely to us can share bodies.
+	 */
+	if (cache_param->dedup_min_size > 0 &&
+	    boc->state == BOS_FINISHED &&
+	    !(oc->flags & (OC_F_PRIVATE | OC_F_FAILED)) &&
+	    stv->lru != NULL && stv->sml_free != NULL &&
+	    stv->sml_getobj == NULL &&
+	    stv->methods->objiterator == sml_iterator &&
+	    ObjGetLen(wrk, oc) >= cache_param->dedup_min_size)
+		sml_dedup_queue(wrk, oc);
+
 	if (stv->lru != NULL) {
 		if (isnan(wrk->lastused))
 			wrk->lastused = VTIM_real();
@@ -645,6 +1122,8 @@ SML_panic(struct vsb *vsb, const struct objcore *oc)
 {
 	struct object *o;
 	struct storage *st;
+	struct storagehead *sh;
+	struct sml_body *b;
 
 	VSB_printf(vsb, "Simple = %p,\n", oc->stobj->priv);
 	if (oc->stobj->priv == NULL)
@@ -666,7 +1145,15 @@ SML_panic(struct vsb *vsb, const struct objcore *oc)
 
 #include "tbl/obj_attr.h"
 
-	VTAILQ_FOREACH(st, &o->list, list) {
+	sh = &o->list;
+	st = VTAILQ_FIRST(sh);
+	if (st != NULL && st->ptr == NULL) {
+		b = st->priv;
+		VSB_printf(vsb, "Shared = %p {refcnt=%u},\n",
+		    b, b->refcnt);
+		sh = &b->list;
+	}
+	VTAILQ_FOREACH(st, sh, list) {
 		sml_panic_st(vsb, "Body", st);
 	}
 }
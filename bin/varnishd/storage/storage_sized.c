@@ -0,0 +1,529 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage method which puts objects in one of two other stevedores,
+ * depending on the size of their body.
+ *
+ *	-s small=malloc,1G -s large=file,/var/cache/v,100G
+ *	-s s=sized,small,large,1M
+ *
+ * Objects with a Content-Length of at least the threshold go to the
+ * large storage, all others to the small one.  When the body of an
+ * object in the small storage grows past the threshold, the object
+ * is copied to the large storage right there, if nobody can see it
+ * yet, which is the case unless it is streamed.  Streamed objects are
+ * moved after the fetch, by a background thread, once nobody but the
+ * expiry holds a reference to them, see LRU_Replace().
+ *
+ * The two storages are only used through this stevedore.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_obj.h"
+#include "cache/cache_objhead.h"
+#include "common/heritage.h"
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+#include "vtim.h"
+
+#include "VSC_smz.h"
+
+#define SMZ_SMALL		0
+#define SMZ_LARGE		1
+#define SMZ_QUEUE		64
+#define SMZ_TRIES		5
+#define SMZ_THRESHOLD		"1M"
+
+struct smz_sc {
+	unsigned		magic;
+#define SMZ_SC_MAGIC		0x2c8f61a4
+	struct stevedore	*tier[2];
+	struct obj_methods	methods[2];
+	objgetspace_f		*getspace;
+	objbocdone_f		*bocdone[2];
+	uint64_t		threshold;
+
+	struct lock		mtx;
+	pthread_cond_t		cond;
+	pthread_t		thread;
+	struct objcore		*queue[SMZ_QUEUE];
+	unsigned		tries[SMZ_QUEUE];
+	unsigned		nqueue;
+
+	struct VSC_smz		*stats;
+};
+
+static struct VSC_lck *lck_smz;
+
+static struct smz_sc *
+smz_sc(const struct objcore *oc, unsigned *t)
+{
+	const struct stevedore *stv;
+	struct smz_sc *sc;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(stv->sized, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->sized->priv, SMZ_SC_MAGIC);
+	*t = stv == sc->tier[SMZ_SMALL] ? SMZ_SMALL : SMZ_LARGE;
+	assert(stv == sc->tier[*t]);
+	return (sc);
+}
+
+/*--------------------------------------------------------------------
+ * Copy an object into a new one in the large storage.  The body of an
+ * object being fetched cannot be iterated over before it is complete,
+ * so we take its segments as they are.
+ */
+
+struct smz_copy {
+	unsigned		magic;
+#define SMZ_COPY_MAGIC		0x7a01d3e5
+	struct worker		*wrk;
+	struct objcore		*oc;
+	ssize_t			left;
+};
+
+static int __match_proto__(objiterate_f)
+smz_copy_body(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct smz_copy *cp;
+	const uint8_t *ps = ptr;
+	uint8_t *pd;
+	ssize_t l;
+
+	(void)flush;
+	CAST_OBJ_NOTNULL(cp, priv, SMZ_COPY_MAGIC);
+
+	while (len > 0) {
+		/* Ask for the rest of the body, to get it in one piece */
+		l = cp->left > len ? cp->left : len;
+		if (!ObjGetSpace(cp->wrk, cp->oc, &l, &pd))
+			return (1);
+		if (len < l)
+			l = len;
+		memcpy(pd, ps, l);
+		ObjExtend(cp->wrk, cp->oc, l);
+		ps += l;
+		len -= l;
+		cp->left -= l;
+	}
+	return (0);
+}
+
+static struct objcore *
+smz_dup(struct worker *wrk, struct smz_sc *sc, struct objcore *oc)
+{
+	struct stevedore *stv = sc->tier[SMZ_LARGE];
+	struct smz_copy cp[1];
+	struct objcore *noc;
+	struct object *o;
+	struct storage *st;
+	enum obj_attr a;
+	unsigned wsl = 0;
+	ssize_t l;
+	int i = 0;
+
+#define OBJ_VARATTR(U, n)						\
+	if (ObjGetAttr(wrk, oc, OA_##U, &l) != NULL)			\
+		wsl += l;
+#include "tbl/obj_attr.h"
+
+	noc = ObjNew(wrk);
+	noc->flags |= OC_F_PRIVATE;
+	if (!stv->allocobj(wrk, stv, noc, wsl)) {
+		ObjDestroy(wrk, &noc);
+		return (NULL);
+	}
+	wrk->stats->n_object++;
+
+	INIT_OBJ(cp, SMZ_COPY_MAGIC);
+	cp->wrk = wrk;
+	cp->oc = noc;
+	if (oc->boc != NULL) {
+		CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+		cp->left = oc->boc->len_so_far;
+		VTAILQ_FOREACH(st, &o->list, list)
+			if (i == 0 && st->len > 0)
+				i = smz_copy_body(cp, 0, st->ptr, st->len);
+	} else {
+		cp->left = ObjGetLen(wrk, oc);
+		i = ObjIterate(wrk, oc, cp, smz_copy_body, 0);
+		if (i == 0)
+			ObjTrimStore(wrk, noc);
+	}
+
+	for (a = (enum obj_attr)0; i == 0 && a < OA__MAX; a++)
+		if (ObjHasAttr(wrk, oc, a))
+			i = ObjCopyAttr(wrk, noc, oc, a);
+
+	if (oc->boc == NULL || i) {
+		ObjBocDone(wrk, noc, &noc->boc);
+		if (i) {
+			ObjFreeObj(wrk, noc);
+			ObjDestroy(wrk, &noc);
+		}
+	}
+	return (noc);
+}
+
+/*--------------------------------------------------------------------
+ * The objgetspace method of the small storage.  When the body outgrows
+ * the threshold with the segment which just filled up, and nobody can
+ * see the object yet, it continues in the large storage.
+ */
+
+static int __match_proto__(objgetspace_f)
+smz_getspace(struct worker *wrk, struct objcore *oc, ssize_t *sz,
+    uint8_t **ptr)
+{
+	struct smz_sc *sc;
+	struct objcore *noc;
+	struct storeobj stobj;
+	struct object *o;
+	struct storage *st;
+	uint64_t len;
+	unsigned t;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	sc = smz_sc(oc, &t);
+	assert(t == SMZ_SMALL);
+	CHECK_OBJ_NOTNULL(oc->boc, BOC_MAGIC);
+
+	CAST_OBJ_NOTNULL(o, oc->stobj->priv, OBJECT_MAGIC);
+	st = VTAILQ_LAST(&o->list, storagehead);
+	len = oc->boc->len_so_far;
+	if (st == NULL || st->len < st->space || len < sc->threshold ||
+	    len - st->len >= sc->threshold ||
+	    (oc->flags & OC_F_PRIVATE))
+		return (sc->getspace(wrk, oc, sz, ptr));
+
+	/* Streamed objects are moved when they are complete */
+	if (!(oc->flags & OC_F_BUSY) || oc->boc->state >= BOS_PREP_STREAM)
+		return (sc->getspace(wrk, oc, sz, ptr));
+
+	noc = smz_dup(wrk, sc, oc);
+	if (noc == NULL) {
+		sc->stats->c_migrate_fail++;
+		return (sc->getspace(wrk, oc, sz, ptr));
+	}
+	CHECK_OBJ_NOTNULL(noc->boc, BOC_MAGIC);
+
+	Lck_Lock(&oc->boc->mtx);
+	stobj = *oc->stobj;
+	*oc->stobj = *noc->stobj;
+	*noc->stobj = stobj;
+	Lck_Unlock(&oc->boc->mtx);
+	ObjBocDone(wrk, noc, &noc->boc);
+	ObjFreeObj(wrk, noc);
+	ObjDestroy(wrk, &noc);
+
+	VSLb(wrk->vsl, SLT_Storage, "%s %s",
+	    oc->stobj->stevedore->name, oc->stobj->stevedore->ident);
+	sc->stats->c_migrated++;
+	sc->stats->c_migrated_bytes += len;
+	return (ObjGetSpace(wrk, oc, sz, ptr));
+}
+
+/*--------------------------------------------------------------------
+ * The objbocdone method of both storages counts the objects, and
+ * queues those which outgrew the small storage for the thread.
+ */
+
+static void __match_proto__(objbocdone_f)
+smz_bocdone(struct worker *wrk, struct objcore *oc, struct boc *boc)
+{
+	struct smz_sc *sc;
+	uint64_t len;
+	unsigned t;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(boc, BOC_MAGIC);
+	sc = smz_sc(oc, &t);
+	sc->bocdone[t](wrk, oc, boc);
+
+	if (boc->state != BOS_FINISHED ||
+	    oc->flags & (OC_F_PRIVATE | OC_F_FAILED))
+		return;
+
+	len = ObjGetLen(wrk, oc);
+	Lck_Lock(&sc->mtx);
+	if (t == SMZ_SMALL) {
+		sc->stats->c_small++;
+		sc->stats->c_small_bytes += len;
+	} else {
+		sc->stats->c_large++;
+		sc->stats->c_large_bytes += len;
+	}
+	if (t == SMZ_SMALL && len >= sc->threshold &&
+	    sc->nqueue < SMZ_QUEUE) {
+		HSH_Ref(oc);
+		sc->tries[sc->nqueue] = 0;
+		sc->queue[sc->nqueue++] = oc;
+		sc->stats->g_queue = sc->nqueue;
+	}
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Move a complete object we hold a reference on to the large storage.
+ * Returns: 1: moved or gave up, 0: in use, try again later
+ */
+
+static int
+smz_move(struct worker *wrk, struct smz_sc *sc, struct objcore *oc)
+{
+	struct objcore *noc;
+	uint64_t len;
+	int i;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (oc->stobj->stevedore != sc->tier[SMZ_SMALL] || oc->boc != NULL ||
+	    oc->flags & (OC_F_DYING | OC_F_FAILED) || isnan(oc->last_lru))
+		return (1);
+	/* Save the copy while the client which fetched it is at it */
+	if (oc->refcnt > 2)
+		return (0);
+
+	len = ObjGetLen(wrk, oc);
+	noc = smz_dup(wrk, sc, oc);
+	if (noc == NULL) {
+		sc->stats->c_migrate_fail++;
+		return (1);
+	}
+	i = LRU_Replace(oc, noc);
+	ObjFreeObj(wrk, noc);
+	ObjDestroy(wrk, &noc);
+	if (!i)
+		return (0);
+
+	Lck_Lock(&sc->mtx);
+	sc->stats->c_moved++;
+	sc->stats->c_moved_bytes += len;
+	Lck_Unlock(&sc->mtx);
+	return (1);
+}
+
+static void * __match_proto__(bgthread_t)
+smz_thread(struct worker *wrk, void *priv)
+{
+	struct smz_sc *sc;
+	struct objcore *ocs[SMZ_QUEUE];
+	unsigned tries[SMZ_QUEUE];
+	unsigned u, n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sc, priv, SMZ_SC_MAGIC);
+
+	while (1) {
+		Lck_Lock(&sc->mtx);
+		(void)Lck_CondWait(&sc->cond, &sc->mtx, VTIM_real() + 1.);
+		n = sc->nqueue;
+		memcpy(ocs, sc->queue, n * sizeof *ocs);
+		memcpy(tries, sc->tries, n * sizeof *tries);
+		sc->nqueue = 0;
+		Lck_Unlock(&sc->mtx);
+
+		for (u = 0; u < n; u++) {
+			if (!smz_move(wrk, sc, ocs[u]) &&
+			    ++tries[u] < SMZ_TRIES) {
+				Lck_Lock(&sc->mtx);
+				if (sc->nqueue < SMZ_QUEUE) {
+					sc->tries[sc->nqueue] = tries[u];
+					sc->queue[sc->nqueue++] = ocs[u];
+					ocs[u] = NULL;
+				}
+				Lck_Unlock(&sc->mtx);
+			}
+			if (ocs[u] != NULL)
+				(void)HSH_DerefObjCore(wrk, &ocs[u], 0);
+		}
+		Lck_Lock(&sc->mtx);
+		sc->stats->g_queue = sc->nqueue;
+		Lck_Unlock(&sc->mtx);
+		Pool_Sumstat(wrk);
+	}
+	NEEDLESS(return NULL);
+}
+
+/*--------------------------------------------------------------------
+ * New objects go by their Content-Length, if they have one.
+ */
+
+static int __match_proto__(storage_allocobj_f)
+smz_allocobj(struct worker *wrk, const struct stevedore *stv,
+    struct objcore *oc, unsigned wsl)
+{
+	struct smz_sc *sc;
+	struct stevedore *tier;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMZ_SC_MAGIC);
+
+	if (oc->boc != NULL && oc->boc->len_estimate >= 0 &&
+	    (uint64_t)oc->boc->len_estimate >= sc->threshold)
+		tier = sc->tier[SMZ_LARGE];
+	else
+		tier = sc->tier[SMZ_SMALL];
+	return (tier->allocobj(wrk, tier, oc, wsl));
+}
+
+static VCL_BYTES __match_proto__(stv_var_free_space)
+smz_free_space(const struct stevedore *stv)
+{
+	struct smz_sc *sc;
+	VCL_BYTES r = 0, s;
+	int i;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMZ_SC_MAGIC);
+	for (i = 0; i < 2; i++) {
+		if (sc->tier[i]->var_free_space == NULL)
+			continue;
+		s = sc->tier[i]->var_free_space(sc->tier[i]);
+		if (s > 0)
+			r += s;
+	}
+	return (r);
+}
+
+static VCL_BYTES __match_proto__(stv_var_used_space)
+smz_used_space(const struct stevedore *stv)
+{
+	struct smz_sc *sc;
+	VCL_BYTES r = 0;
+	int i;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMZ_SC_MAGIC);
+	for (i = 0; i < 2; i++)
+		if (sc->tier[i]->var_used_space != NULL)
+			r += sc->tier[i]->var_used_space(sc->tier[i]);
+	return (r);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void __match_proto__(storage_init_f)
+smz_init(struct stevedore *parent, int ac, char * const *av)
+{
+	struct smz_sc *sc;
+	struct stevedore *stv;
+	const char *e, *p;
+	uintmax_t u;
+	int i;
+
+	ASSERT_MGT();
+	AZ(av[ac]);
+	if (ac < 2)
+		ARGV_ERR("(-ssized) need a small and a large storage\n");
+	if (ac > 3)
+		ARGV_ERR("(-ssized) too many arguments\n");
+
+	ALLOC_OBJ(sc, SMZ_SC_MAGIC);
+	AN(sc);
+
+	for (i = 0; i < 2; i++) {
+		STV_Foreach(stv)
+			if (!strcmp(stv->ident, av[i]))
+				break;
+		if (stv == NULL)
+			ARGV_ERR("(-ssized) storage \"%s\" must be "
+			    "defined before\n", av[i]);
+		if (stv->tiered != NULL || stv->sized != NULL)
+			ARGV_ERR("(-ssized) storage \"%s\" is a tier "
+			    "already\n", av[i]);
+		/* Persistent objects cannot move */
+		if (stv->sml_alloc == NULL || stv->baninfo != NULL)
+			ARGV_ERR("(-ssized) storage \"%s\" cannot be "
+			    "a tier\n", av[i]);
+		stv->sized = parent;
+		sc->tier[i] = stv;
+	}
+	if (sc->tier[SMZ_SMALL] == sc->tier[SMZ_LARGE])
+		ARGV_ERR("(-ssized) need two different storages\n");
+
+	p = ac > 2 && *av[2] != '\0' ? av[2] : SMZ_THRESHOLD;
+	e = VNUM_2bytes(p, &u, 0);
+	if (e != NULL)
+		ARGV_ERR("(-ssized) threshold \"%s\": %s\n", p, e);
+	if (u == 0)
+		ARGV_ERR("(-ssized) threshold \"%s\": out of range\n", p);
+	sc->threshold = u;
+	parent->priv = sc;
+}
+
+static void __match_proto__(storage_open_f)
+smz_open(struct stevedore *st)
+{
+	struct smz_sc *sc;
+	struct stevedore *stv;
+	int i;
+
+	ASSERT_CLI();
+	if (lck_smz == NULL)
+		lck_smz = Lck_CreateClass("smz");
+	CAST_OBJ_NOTNULL(sc, st->priv, SMZ_SC_MAGIC);
+	Lck_New(&sc->mtx, lck_smz);
+	AZ(pthread_cond_init(&sc->cond, NULL));
+	sc->stats = VSC_smz_New(st->ident);
+
+	/* The tiers were defined, so opened, before us */
+	for (i = 0; i < 2; i++) {
+		stv = sc->tier[i];
+		AN(stv->lru);
+		AN(stv->methods);
+		sc->methods[i] = *stv->methods;
+		sc->bocdone[i] = sc->methods[i].objbocdone;
+		AN(sc->bocdone[i]);
+		sc->methods[i].objbocdone = smz_bocdone;
+		stv->methods = &sc->methods[i];
+	}
+	sc->getspace = sc->methods[SMZ_SMALL].objgetspace;
+	sc->methods[SMZ_SMALL].objgetspace = smz_getspace;
+
+	WRK_BgThread(&sc->thread, "sized", smz_thread, sc);
+}
+
+const struct stevedore smz_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"sized",
+	.init		=	smz_init,
+	.open		=	smz_open,
+	.allocobj	=	smz_allocobj,
+	.methods	=	&SML_methods,
+	.var_free_space	=	smz_free_space,
+	.var_used_space	=	smz_used_space,
+};
@@ -0,0 +1,716 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage backend carving mmap'ed slabs into size classes
+ *
+ * The arena is one anonymous mapping, cut in slabs of equal size.  A
+ * slab is handed to a size class when the class runs out of chunks,
+ * and carved into chunks of that size, with the struct storage for all
+ * of them at the front of the slab, so there is no malloc(3) for each
+ * allocation.  When all chunks of a slab are free again, the slab goes
+ * back to the pool for any class to use, and its pages are given back
+ * to the kernel.  Each class holds on to one empty slab, which another
+ * class will take if the pool runs dry.
+ *
+ * With prefault, or huge pages from MAP_HUGETLB, the pages of empty
+ * slabs are kept, since getting them back is what those options avoid.
+ *
+ * The classes go up in quarter powers of two, plus fetch_chunksize and
+ * its doublings, which is what the fetch code asks for most of the time.
+ *
+ * Each thread caches a few free chunks of each of the smaller classes,
+ * so most allocations and frees do not touch the lock.  The thread's
+ * share of the counters is kept with its cache, and added to the VSC
+ * when it holds the lock.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+#include "common/heritage.h"
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+
+#include "VSC_sms.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0 /* XXX Not Solaris */
+#endif
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0 /* XXX Linux only */
+#endif
+
+#define SMS_ALIGN		64
+#define SMS_MIN_CLASS		256
+#define SMS_NCLASS		96
+#define SMS_SLABSIZE		(4 * 1024 * 1024)
+#define SMS_TCACHE		16	/* Max chunks per class per thread */
+#define SMS_TCACHE_BYTES	(256 * 1024)
+#define SMS_TCACHE_FLUSH	64	/* Ops between counter flushes */
+
+struct sms_sc;
+
+struct sms_slab {
+	unsigned		magic;
+#define SMS_SLAB_MAGIC		0x3b9a7c21
+	unsigned		cls;	/* SMS_NCLASS if in the pool */
+	unsigned		nfree;
+	struct sms_sc		*sc;
+	uint8_t			*base;
+	VTAILQ_HEAD(,storage)	free;
+	VTAILQ_ENTRY(sms_slab)	list;
+};
+
+struct sms_class {
+	unsigned		size;
+	unsigned		nchunk;	/* per slab */
+	unsigned		tcache;	/* per thread */
+	struct sms_slab		*empty;
+	VTAILQ_HEAD(,sms_slab)	partial;
+};
+
+/* Counter changes not yet in the VSC */
+struct sms_delta {
+	int64_t			c_req;
+	int64_t			c_fail;
+	int64_t			c_bytes;
+	int64_t			c_freed;
+	int64_t			g_alloc;
+	int64_t			g_bytes;
+	int64_t			g_waste;
+	int64_t			g_cached;
+};
+
+struct sms_sc {
+	unsigned		magic;
+#define SMS_SC_MAGIC		0x5c4b1e0d
+	struct lock		mtx;
+	struct VSC_sms		*stats;
+
+	size_t			size;
+	size_t			slabsize;
+	unsigned		nslab;
+	unsigned		keep;	/* Do not release pages */
+	uint8_t			*arena;
+	struct sms_slab		*slabs;
+	VTAILQ_HEAD(,sms_slab)	pool;
+
+	unsigned		nclass;
+	struct sms_class	cls[SMS_NCLASS];
+
+	pthread_key_t		tkey;
+};
+
+struct sms_tcache {
+	unsigned		magic;
+#define SMS_TCACHE_MAGIC	0x0f5e7a93
+	struct sms_sc		*sc;
+	unsigned		nops;
+	struct sms_delta	d;
+	unsigned		n[SMS_NCLASS];
+	struct storage		*st[SMS_NCLASS][SMS_TCACHE];
+};
+
+static struct VSC_lck *lck_sms;
+
+/*--------------------------------------------------------------------
+ * Must hold the lock
+ */
+
+static void
+sms_flush_delta(struct sms_sc *sc, struct sms_delta *d)
+{
+	struct VSC_sms *vsc;
+
+	Lck_AssertHeld(&sc->mtx);
+	vsc = sc->stats;
+	vsc->c_req += d->c_req;
+	vsc->c_fail += d->c_fail;
+	vsc->c_bytes += d->c_bytes;
+	vsc->c_freed += d->c_freed;
+	vsc->g_alloc += d->g_alloc;
+	vsc->g_bytes += d->g_bytes;
+	vsc->g_waste += d->g_waste;
+	vsc->g_cached += d->g_cached;
+	vsc->g_space = vsc->g_slabs_free * sc->slabsize +
+	    vsc->g_frag + vsc->g_cached;
+	memset(d, 0, sizeof *d);
+}
+
+/*--------------------------------------------------------------------
+ * Slabs, must hold the lock
+ */
+
+static void
+sms_slab_release(struct sms_sc *sc, struct sms_slab *sl)
+{
+	struct sms_class *cls;
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(sl->cls < sc->nclass);
+	cls = &sc->cls[sl->cls];
+	assert(sl->nfree == cls->nchunk);
+	VTAILQ_REMOVE(&cls->partial, sl, list);
+	if (cls->empty == sl)
+		cls->empty = NULL;
+	sc->stats->g_frag -= (uint64_t)cls->nchunk * cls->size;
+	sl->cls = SMS_NCLASS;
+	sl->nfree = 0;
+	VTAILQ_INIT(&sl->free);
+	if (!sc->keep)
+		(void)madvise(sl->base, sc->slabsize, MADV_DONTNEED);
+	VTAILQ_INSERT_HEAD(&sc->pool, sl, list);
+	sc->stats->g_slabs--;
+	sc->stats->g_slabs_free++;
+}
+
+static struct sms_slab *
+sms_slab_get(struct sms_sc *sc, unsigned c)
+{
+	struct sms_class *cls;
+	struct sms_slab *sl;
+	struct storage *st;
+	uint8_t *p;
+	unsigned u;
+
+	Lck_AssertHeld(&sc->mtx);
+	if (VTAILQ_EMPTY(&sc->pool)) {
+		/* Take the empty slab some other class keeps */
+		for (u = 0; u < sc->nclass; u++) {
+			if (u == c || sc->cls[u].empty == NULL)
+				continue;
+			sms_slab_release(sc, sc->cls[u].empty);
+			sc->stats->c_rebalance++;
+			break;
+		}
+	}
+	sl = VTAILQ_FIRST(&sc->pool);
+	if (sl == NULL)
+		return (NULL);
+	CHECK_OBJ(sl, SMS_SLAB_MAGIC);
+	VTAILQ_REMOVE(&sc->pool, sl, list);
+	sc->stats->g_slabs_free--;
+	sc->stats->g_slabs++;
+
+	cls = &sc->cls[c];
+	sl->cls = c;
+	sl->nfree = cls->nchunk;
+	st = (void*)sl->base;
+	p = sl->base + RUP2(cls->nchunk * sizeof *st, SMS_ALIGN);
+	for (u = 0; u < cls->nchunk; u++, st++, p += cls->size) {
+		INIT_OBJ(st, STORAGE_MAGIC);
+		st->priv = sl;
+		st->ptr = p;
+		VTAILQ_INSERT_TAIL(&sl->free, st, list);
+	}
+	assert(p <= sl->base + sc->slabsize);
+	sc->stats->g_frag += (uint64_t)cls->nchunk * cls->size;
+	VTAILQ_INSERT_HEAD(&cls->partial, sl, list);
+	return (sl);
+}
+
+/*--------------------------------------------------------------------
+ * Chunks, must hold the lock.  Free chunks in a slab which belongs to
+ * a class are what we count as fragmentation.
+ */
+
+static struct storage *
+sms_chunk_get(struct sms_sc *sc, unsigned c)
+{
+	struct sms_class *cls;
+	struct sms_slab *sl;
+	struct storage *st;
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(c < sc->nclass);
+	cls = &sc->cls[c];
+	sl = VTAILQ_FIRST(&cls->partial);
+	if (sl == NULL)
+		sl = sms_slab_get(sc, c);
+	if (sl == NULL)
+		return (NULL);
+	CHECK_OBJ(sl, SMS_SLAB_MAGIC);
+	assert(sl->cls == c);
+	assert(sl->nfree > 0);
+	if (cls->empty == sl)
+		cls->empty = NULL;
+	st = VTAILQ_FIRST(&sl->free);
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	VTAILQ_REMOVE(&sl->free, st, list);
+	if (--sl->nfree == 0)
+		VTAILQ_REMOVE(&cls->partial, sl, list);
+	sc->stats->g_frag -= cls->size;
+	return (st);
+}
+
+static void
+sms_chunk_put(struct sms_sc *sc, struct storage *st)
+{
+	struct sms_class *cls;
+	struct sms_slab *sl;
+
+	Lck_AssertHeld(&sc->mtx);
+	CAST_OBJ_NOTNULL(sl, st->priv, SMS_SLAB_MAGIC);
+	assert(sl->cls < sc->nclass);
+	cls = &sc->cls[sl->cls];
+	VTAILQ_INSERT_HEAD(&sl->free, st, list);
+	if (sl->nfree++ == 0)
+		VTAILQ_INSERT_HEAD(&cls->partial, sl, list);
+	sc->stats->g_frag += cls->size;
+	if (sl->nfree < cls->nchunk)
+		return;
+	if (cls->empty == NULL)
+		cls->empty = sl;
+	else if (cls->empty != sl)
+		sms_slab_release(sc, sl);
+}
+
+/*--------------------------------------------------------------------
+ * Thread caches
+ */
+
+static void
+sms_tcache_drain(struct sms_tcache *tc, unsigned c, unsigned keep)
+{
+	struct sms_sc *sc;
+
+	sc = tc->sc;
+	Lck_AssertHeld(&sc->mtx);
+	while (tc->n[c] > keep) {
+		sms_chunk_put(sc, tc->st[c][--tc->n[c]]);
+		tc->d.g_cached -= sc->cls[c].size;
+	}
+}
+
+static void
+sms_tcache_fini(void *priv)
+{
+	struct sms_tcache *tc;
+	struct sms_sc *sc;
+	unsigned c;
+
+	CAST_OBJ_NOTNULL(tc, priv, SMS_TCACHE_MAGIC);
+	sc = tc->sc;
+	Lck_Lock(&sc->mtx);
+	for (c = 0; c < sc->nclass; c++)
+		sms_tcache_drain(tc, c, 0);
+	sms_flush_delta(sc, &tc->d);
+	Lck_Unlock(&sc->mtx);
+	FREE_OBJ(tc);
+}
+
+static struct sms_tcache *
+sms_tcache_get(struct sms_sc *sc)
+{
+	struct sms_tcache *tc;
+
+	tc = pthread_getspecific(sc->tkey);
+	if (tc != NULL) {
+		CHECK_OBJ(tc, SMS_TCACHE_MAGIC);
+		return (tc);
+	}
+	ALLOC_OBJ(tc, SMS_TCACHE_MAGIC);
+	if (tc == NULL)
+		return (NULL);
+	tc->sc = sc;
+	AZ(pthread_setspecific(sc->tkey, tc));
+	return (tc);
+}
+
+/* Every so often, bring the VSC up to date if nobody holds the lock */
+
+static void
+sms_tcache_tick(struct sms_tcache *tc)
+{
+
+	if (++tc->nops < SMS_TCACHE_FLUSH || Lck_Trylock(&tc->sc->mtx))
+		return;
+	sms_flush_delta(tc->sc, &tc->d);
+	Lck_Unlock(&tc->sc->mtx);
+	tc->nops = 0;
+}
+
+/*--------------------------------------------------------------------*/
+
+static unsigned
+sms_class(const struct sms_sc *sc, size_t size)
+{
+	unsigned lo = 0, hi = sc->nclass, m;
+
+	while (lo < hi) {
+		m = (lo + hi) / 2;
+		if (sc->cls[m].size < size)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+	return (lo);
+}
+
+static struct storage * __match_proto__(sml_alloc_f)
+sms_alloc(const struct stevedore *stv, size_t size)
+{
+	struct sms_sc *sc;
+	struct sms_class *cls;
+	struct sms_tcache *tc = NULL;
+	struct sms_delta ld, *d;
+	struct storage *st = NULL;
+	unsigned c;
+	int locked = 0;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMS_SC_MAGIC);
+	assert(size > 0);
+	c = sms_class(sc, size);
+	/*
+	 * Larger than a slab is not a failure, our caller asks again for
+	 * less, see sml_stv_alloc().
+	 */
+	if (c == sc->nclass)
+		return (NULL);
+	if (sc->cls[c].tcache > 0)
+		tc = sms_tcache_get(sc);
+	if (tc != NULL) {
+		d = &tc->d;
+	} else {
+		memset(&ld, 0, sizeof ld);
+		d = &ld;
+	}
+
+	if (tc != NULL && tc->n[c] > 0) {
+		st = tc->st[c][--tc->n[c]];
+		d->g_cached -= sc->cls[c].size;
+	} else {
+		Lck_Lock(&sc->mtx);
+		locked = 1;
+		st = sms_chunk_get(sc, c);
+		if (st == NULL && tc != NULL) {
+			/* Our own cache may be holding up a slab */
+			for (c = 0; c < sc->nclass; c++)
+				sms_tcache_drain(tc, c, 0);
+			c = sms_class(sc, size);
+			st = sms_chunk_get(sc, c);
+		}
+		/* Fill half the cache while we have the lock */
+		while (st != NULL && tc != NULL &&
+		    tc->n[c] < sc->cls[c].tcache / 2) {
+			tc->st[c][tc->n[c]] = sms_chunk_get(sc, c);
+			if (tc->st[c][tc->n[c]] == NULL)
+				break;
+			tc->n[c]++;
+			d->g_cached += sc->cls[c].size;
+		}
+	}
+
+	d->c_req++;
+	if (st == NULL) {
+		AN(locked);
+		d->c_fail++;
+		sms_flush_delta(sc, d);
+		Lck_Unlock(&sc->mtx);
+		return (NULL);
+	}
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	cls = &sc->cls[c];
+	st->len = 0;
+	st->space = size;
+	d->c_bytes += size;
+	d->g_alloc++;
+	d->g_bytes += size;
+	d->g_waste += cls->size - size;
+	if (locked) {
+		sms_flush_delta(sc, d);
+		Lck_Unlock(&sc->mtx);
+	} else
+		sms_tcache_tick(tc);
+	return (st);
+}
+
+static void __match_proto__(sml_free_f)
+sms_free(struct storage *st)
+{
+	struct sms_sc *sc;
+	struct sms_slab *sl;
+	struct sms_class *cls;
+	struct sms_tcache *tc = NULL;
+	struct sms_delta ld, *d;
+	unsigned c;
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(sl, st->priv, SMS_SLAB_MAGIC);
+	CAST_OBJ_NOTNULL(sc, sl->sc, SMS_SC_MAGIC);
+	c = sl->cls;
+	assert(c < sc->nclass);
+	cls = &sc->cls[c];
+	assert(st->space <= cls->size);
+
+	if (cls->tcache > 0)
+		tc = sms_tcache_get(sc);
+	if (tc != NULL) {
+		d = &tc->d;
+	} else {
+		memset(&ld, 0, sizeof ld);
+		d = &ld;
+	}
+	d->c_freed += st->space;
+	d->g_alloc--;
+	d->g_bytes -= st->space;
+	d->g_waste -= cls->size - st->space;
+
+	if (tc != NULL && tc->n[c] < cls->tcache) {
+		tc->st[c][tc->n[c]++] = st;
+		d->g_cached += cls->size;
+		sms_tcache_tick(tc);
+		return;
+	}
+
+	Lck_Lock(&sc->mtx);
+	if (tc != NULL)
+		sms_tcache_drain(tc, c, cls->tcache / 2);
+	sms_chunk_put(sc, st);
+	sms_flush_delta(sc, d);
+	Lck_Unlock(&sc->mtx);
+}
+
+static VCL_BYTES __match_proto__(stv_var_free_space)
+sms_free_space(const struct stevedore *stv)
+{
+	struct sms_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMS_SC_MAGIC);
+	return (sc->stats->g_space);
+}
+
+static VCL_BYTES __match_proto__(stv_var_used_space)
+sms_used_space(const struct stevedore *stv)
+{
+	struct sms_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMS_SC_MAGIC);
+	return (sc->size - sc->stats->g_space);
+}
+
+/*--------------------------------------------------------------------
+ * The size classes.  All are multiples of SMS_ALIGN, and the largest
+ * takes up a slab on its own.
+ */
+
+static void
+sms_class_add(struct sms_sc *sc, size_t size)
+{
+	unsigned u;
+
+	size = RUP2(size, SMS_ALIGN);
+	if (size < SMS_MIN_CLASS || size > sc->slabsize - SMS_ALIGN)
+		return;
+	for (u = 0; u < sc->nclass; u++)
+		if (sc->cls[u].size == size)
+			return;
+	assert(sc->nclass < SMS_NCLASS);
+	sc->cls[sc->nclass++].size = size;
+}
+
+static int
+sms_class_cmp(const void *a, const void *b)
+{
+	const struct sms_class *ca = a, *cb = b;
+
+	return (ca->size < cb->size ? -1 : ca->size > cb->size);
+}
+
+static void
+sms_classes(struct sms_sc *sc)
+{
+	struct sms_class *cls;
+	size_t sz;
+	unsigned u;
+
+	for (sz = SMS_MIN_CLASS; sz < sc->slabsize; sz <<= 1) {
+		sms_class_add(sc, sz);
+		sms_class_add(sc, sz + sz / 4);
+		sms_class_add(sc, sz + sz / 2);
+		sms_class_add(sc, sz + 3 * sz / 4);
+	}
+	for (sz = cache_param->fetch_chunksize; sz < sc->slabsize; sz <<= 1)
+		sms_class_add(sc, sz);
+	sms_class_add(sc, sc->slabsize - SMS_ALIGN);
+	qsort(sc->cls, sc->nclass, sizeof sc->cls[0], sms_class_cmp);
+
+	for (u = 0; u < sc->nclass; u++) {
+		cls = &sc->cls[u];
+		cls->nchunk =
+		    sc->slabsize / (cls->size + sizeof(struct storage));
+		while (cls->nchunk > 1 && RUP2(cls->nchunk *
+		    sizeof(struct storage), SMS_ALIGN) +
+		    (size_t)cls->nchunk * cls->size > sc->slabsize)
+			cls->nchunk--;
+		assert(cls->nchunk > 0);
+		if (cls->size * SMS_TCACHE <= SMS_TCACHE_BYTES)
+			cls->tcache = SMS_TCACHE;
+		else
+			cls->tcache = SMS_TCACHE_BYTES / cls->size;
+		if (cls->size > 64 * 1024)
+			cls->tcache = 0;
+		VTAILQ_INIT(&cls->partial);
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+sms_init(struct stevedore *parent, int ac, char * const *av)
+{
+	const char *e;
+	uintmax_t u;
+	struct sms_sc *sc;
+
+	ASSERT_MGT();
+	ALLOC_OBJ(sc, SMS_SC_MAGIC);
+	AN(sc);
+	sc->slabsize = SMS_SLABSIZE;
+	parent->priv = sc;
+
+	AZ(av[ac]);
+	if (ac > 2)
+		ARGV_ERR("(-sslab) too many arguments\n");
+	if (ac == 0 || *av[0] == '\0')
+		ARGV_ERR("(-sslab) size is required\n");
+
+	if (ac > 1 && *av[1] != '\0') {
+		e = VNUM_2bytes(av[1], &u, 0);
+		if (e != NULL)
+			ARGV_ERR("(-sslab) slabsize \"%s\": %s\n", av[1], e);
+		if (u < 1024 * 1024 || u > 64 * 1024 * 1024 || !PWR2(u))
+			ARGV_ERR("(-sslab) slabsize \"%s\": must be a "
+			    "power of two from 1M to 64M\n", av[1]);
+		sc->slabsize = u;
+	}
+
+	e = VNUM_2bytes(av[0], &u, 0);
+	if (e != NULL)
+		ARGV_ERR("(-sslab) size \"%s\": %s\n", av[0], e);
+	if ((u != (uintmax_t)(size_t)u))
+		ARGV_ERR("(-sslab) size \"%s\": too big\n", av[0]);
+	if (u < 2 * sc->slabsize)
+		ARGV_ERR("(-sslab) size \"%s\": too small, "
+			 "must be at least two slabs\n", av[0]);
+
+	sc->nslab = u / sc->slabsize;
+	sc->size = (size_t)sc->nslab * sc->slabsize;
+}
+
+static void
+sms_map(struct stevedore *st, struct sms_sc *sc)
+{
+	int flags = MAP_PRIVATE | MAP_ANON;
+	void *p = MAP_FAILED;
+
+	if (st->hugepages == STV_HUGEPAGES_ON && MAP_HUGETLB != 0) {
+		/*
+		 * Without MAP_NORESERVE this fails right here when there
+		 * are not enough huge pages, rather than with a SIGBUS
+		 * the first time we touch the memory.
+		 */
+		p = mmap(NULL, sc->size, PROT_READ | PROT_WRITE,
+		    flags | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED)
+			printf("SMS.%s no MAP_HUGETLB (%s),"
+			    " advising huge pages instead\n",
+			    st->ident, strerror(errno));
+		else
+			sc->keep = 1;
+	}
+	if (p == MAP_FAILED)
+		p = mmap(NULL, sc->size, PROT_READ | PROT_WRITE,
+		    flags | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		printf("SMS.%s mmap of %zu bytes failed (%s)\n",
+		    st->ident, sc->size, strerror(errno));
+		exit(4);
+	}
+	sc->arena = p;
+	STV_Hugepages(st, p, sc->size, &sc->stats->g_huge);
+	STV_Prefault(st, p, sc->size, 1);
+	if (st->prefault != STV_PREFAULT_OFF)
+		sc->keep = 1;
+}
+
+static void __match_proto__(storage_open_f)
+sms_open(struct stevedore *st)
+{
+	struct sms_sc *sc;
+	struct sms_slab *sl;
+	unsigned u;
+
+	ASSERT_CLI();
+	st->lru = LRU_Alloc(st);
+	if (lck_sms == NULL)
+		lck_sms = Lck_CreateClass("sms");
+	CAST_OBJ_NOTNULL(sc, st->priv, SMS_SC_MAGIC);
+	Lck_New(&sc->mtx, lck_sms);
+	sc->stats = VSC_sms_New(st->ident);
+	AZ(pthread_key_create(&sc->tkey, sms_tcache_fini));
+	sms_map(st, sc);
+
+	sc->slabs = calloc(sc->nslab, sizeof *sc->slabs);
+	AN(sc->slabs);
+	VTAILQ_INIT(&sc->pool);
+	for (u = 0; u < sc->nslab; u++) {
+		sl = &sc->slabs[u];
+		INIT_OBJ(sl, SMS_SLAB_MAGIC);
+		sl->cls = SMS_NCLASS;
+		sl->sc = sc;
+		sl->base = sc->arena + (size_t)u * sc->slabsize;
+		VTAILQ_INIT(&sl->free);
+		VTAILQ_INSERT_TAIL(&sc->pool, sl, list);
+	}
+	sms_classes(sc);
+	sc->stats->g_slabs_free = sc->nslab;
+	sc->stats->g_space = sc->size;
+}
+
+const struct stevedore sms_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"slab",
+	.init		=	sms_init,
+	.open		=	sms_open,
+	.sml_alloc	=	sms_alloc,
+	.sml_free	=	sms_free,
+	.allocobj	=	SML_allocobj,
+	.panic		=	SML_panic,
+	.methods	=	&SML_methods,
+	.var_free_space =	sms_free_space,
+	.var_used_space =	sms_used_space,
+};
@@ -0,0 +1,636 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Storage method which puts objects in one of two other stevedores,
+ * and moves them between the two as they are used.
+ *
+ *	-s hot=malloc,1G -s cold=file,/var/cache/v,100G -s t=tiered,hot,cold
+ *
+ * New objects go to the hot tier, unless it is full.  A background
+ * thread keeps 'reserve' bytes free in the hot tier, by moving its
+ * least recently used objects to the cold tier, which nukes as usual
+ * to make room for them.  When an object in the cold tier is hit, the
+ * hit queues it to be moved back, if there is room in the hot tier
+ * without nuking.  Going below the reserve that way demotes the least
+ * recently used objects, which the promoted one is not.
+ *
+ * An object is moved by copying it into a new objcore of the other
+ * tier, and then swapping the storage of the two objcores, see
+ * LRU_Replace().  The swap only happens if nobody but the expiry
+ * holds a reference to the object, otherwise the copy is thrown away.
+ * While it is copied, the object is served from the old tier as usual.
+ *
+ * With the gzip argument, bodies are gzip'ed on their way to the cold
+ * tier, unless they are gzip'ed already or do not shrink much.  Their
+ * headers are left alone, and the OF_STVGZIP flag tells delivery to
+ * add Content-Encoding when it sends the gzip'ed body as it is, and
+ * to leave it out when it gunzips it.
+ *
+ * The tiers are the ones doing the work, this stevedore only picks the
+ * tier for new objects, and the tiers are not used for new objects on
+ * their own.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_filter.h"
+#include "cache/cache_obj.h"
+#include "cache/cache_objhead.h"
+#include "cache/cache_vgz.h"
+#include "common/heritage.h"
+
+#include "storage/storage.h"
+#include "storage/storage_simple.h"
+
+#include "vnum.h"
+#include "vtim.h"
+
+#include "VSC_smt.h"
+
+#define SMT_HOT			0
+#define SMT_COLD		1
+#define SMT_BATCH		16
+#define SMT_QUEUE		64
+#define SMT_RESERVE_PCT		10
+#define SMT_GZIP_MIN		1024
+#define SMT_GZIP_PCT		90
+
+struct smt_sc {
+	unsigned		magic;
+#define SMT_SC_MAGIC		0x5e0b1c3d
+	const char		*ident;
+	struct stevedore	*tier[2];
+	struct obj_methods	methods[2];
+	objtouch_f		*touch[2];
+	ssize_t			reserve;
+	int			gzip;
+
+	struct lock		mtx;
+	pthread_cond_t		cond;
+	pthread_t		thread;
+	struct objcore		*queue[SMT_QUEUE];
+	unsigned		nqueue;
+
+	struct VSC_smt		*stats;
+};
+
+static struct VSC_lck *lck_smt;
+
+/*--------------------------------------------------------------------
+ * The objtouch method of the tiers.  Hits in the cold tier take a
+ * reference on the object for the promotion queue.  The queue is
+ * only looked at every so often, so that the hit which put an object
+ * on it is usually done with the object by then.
+ */
+
+static void __match_proto__(objtouch_f)
+smt_touch(struct worker *wrk, struct objcore *oc, double now)
+{
+	const struct stevedore *stv;
+	struct smt_sc *sc;
+	unsigned u, t;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(stv->tiered, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->tiered->priv, SMT_SC_MAGIC);
+
+	t = stv == sc->tier[SMT_HOT] ? SMT_HOT : SMT_COLD;
+	assert(stv == sc->tier[t]);
+	if (sc->touch[t] != NULL)
+		sc->touch[t](wrk, oc, now);
+
+	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
+		return;
+	if (t == SMT_HOT) {
+		sc->stats->c_hot_hit++;
+		return;
+	}
+	sc->stats->c_cold_hit++;
+
+	/* A promotion can wait for the next hit */
+	if (sc->nqueue == SMT_QUEUE || Lck_Trylock(&sc->mtx))
+		return;
+	for (u = 0; u < sc->nqueue; u++)
+		if (sc->queue[u] == oc)
+			break;
+	if (u == sc->nqueue && u < SMT_QUEUE) {
+		HSH_Ref(oc);
+		sc->queue[sc->nqueue++] = oc;
+		sc->stats->g_queue = sc->nqueue;
+	}
+	Lck_Unlock(&sc->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Copy the body and the attributes of an object into a new one,
+ * optionally gzip'ing the body on the way.
+ */
+
+struct smt_copy {
+	unsigned		magic;
+#define SMT_COPY_MAGIC		0x0d7b4a2e
+	struct worker		*wrk;
+	struct objcore		*oc;
+	ssize_t			left;
+	struct vgz		*vg;
+	uint64_t		out;
+};
+
+static int __match_proto__(objiterate_f)
+smt_copy_body(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct smt_copy *cp;
+	const uint8_t *ps = ptr;
+	uint8_t *pd;
+	ssize_t l;
+
+	(void)flush;
+	CAST_OBJ_NOTNULL(cp, priv, SMT_COPY_MAGIC);
+
+	while (len > 0) {
+		/* Ask for the rest of the body, to get it in one piece */
+		l = cp->left > len ? cp->left : len;
+		if (!ObjGetSpace(cp->wrk, cp->oc, &l, &pd))
+			return (1);
+		if (len < l)
+			l = len;
+		memcpy(pd, ps, l);
+		ObjExtend(cp->wrk, cp->oc, l);
+		ps += l;
+		len -= l;
+		cp->left -= l;
+	}
+	return (0);
+}
+
+static enum vgzret_e
+smt_gzip_out(struct smt_copy *cp, enum vgz_flag flag)
+{
+	enum vgzret_e vr;
+	const void *dp;
+	ssize_t dl, l;
+	uint8_t *pd;
+
+	/* The plain size is plenty, and trimmed after */
+	l = cp->left > SMT_GZIP_MIN ? cp->left : SMT_GZIP_MIN;
+	if (!ObjGetSpace(cp->wrk, cp->oc, &l, &pd))
+		return (VGZ_ERROR);
+	VGZ_Obuf(cp->vg, pd, l);
+	vr = VGZ_Gzip(cp->vg, &dp, &dl, flag);
+	if (dl > 0) {
+		ObjExtend(cp->wrk, cp->oc, dl);
+		cp->out += dl;
+	}
+	return (vr);
+}
+
+static int __match_proto__(objiterate_f)
+smt_gzip_body(void *priv, int flush, const void *ptr, ssize_t len)
+{
+	struct smt_copy *cp;
+
+	(void)flush;
+	CAST_OBJ_NOTNULL(cp, priv, SMT_COPY_MAGIC);
+
+	if (len == 0)
+		return (0);
+	VGZ_Ibuf(cp->vg, ptr, len);
+	cp->left -= len;
+	do {
+		if (smt_gzip_out(cp, VGZ_NORMAL) != VGZ_OK)
+			return (1);
+	} while (!VGZ_IbufEmpty(cp->vg));
+	return (0);
+}
+
+static int
+smt_copy(struct worker *wrk, struct objcore *noc, struct objcore *oc,
+    int gzip)
+{
+	struct smt_copy cp[1];
+	struct vfp_ctx vc[1];
+	enum vgzret_e vr = VGZ_OK;
+	enum obj_attr a;
+	int i;
+
+	INIT_OBJ(cp, SMT_COPY_MAGIC);
+	cp->wrk = wrk;
+	cp->oc = noc;
+	cp->left = ObjGetLen(wrk, oc);
+	if (!gzip) {
+		if (ObjIterate(wrk, oc, cp, smt_copy_body, 0))
+			return (-1);
+	} else {
+		cp->vg = VGZ_NewGzip(wrk->vsl, "G S -");
+		i = ObjIterate(wrk, oc, cp, smt_gzip_body, 0);
+		while (!i && (vr = smt_gzip_out(cp, VGZ_FINISH)) == VGZ_OK)
+			continue;
+		if (!i && vr == VGZ_END) {
+			VFP_Setup(vc, wrk);
+			vc->oc = noc;
+			VGZ_UpdateObj(vc, cp->vg, VUA_END_GZIP);
+		} else
+			i = -1;
+		(void)VGZ_Destroy(&cp->vg);
+		if (i)
+			return (-1);
+	}
+	ObjTrimStore(wrk, noc);
+
+	for (a = (enum obj_attr)0; a < OA__MAX; a++) {
+		if (gzip && (a == OA_LEN || a == OA_GZIPBITS))
+			continue;
+		if (ObjHasAttr(wrk, oc, a) && ObjCopyAttr(wrk, noc, oc, a))
+			return (-1);
+	}
+	if (gzip) {
+		AZ(ObjSetU64(wrk, noc, OA_LEN, cp->out));
+		ObjSetFlag(wrk, noc, OF_GZIPED, 1);
+		ObjSetFlag(wrk, noc, OF_STVGZIP, 1);
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Bodies are gzip'ed if nothing else did, they are not ESI processed,
+ * since the ESI data has offsets into the plain body, and gzip'ing
+ * them saves enough.
+ */
+
+static int
+smt_gzipable(struct worker *wrk, struct objcore *oc)
+{
+
+	if (ObjCheckFlag(wrk, oc, OF_GZIPED) ||
+	    ObjHasAttr(wrk, oc, OA_ESIDATA) ||
+	    ObjGetLen(wrk, oc) < SMT_GZIP_MIN)
+		return (0);
+	return (HTTP_GetHdrPack(wrk, oc, H_Content_Encoding) == NULL);
+}
+
+static struct objcore *
+smt_dup(struct worker *wrk, struct objcore *oc, struct stevedore *stv,
+    int nuke, int gzip)
+{
+	struct objcore *noc;
+	unsigned wsl = 0;
+	ssize_t l;
+	int i;
+
+#define OBJ_VARATTR(U, n)						\
+	if (ObjGetAttr(wrk, oc, OA_##U, &l) != NULL)			\
+		wsl += l;
+#include "tbl/obj_attr.h"
+
+	noc = ObjNew(wrk);
+	noc->flags |= OC_F_PRIVATE;
+	wrk->strangelove = nuke ? cache_param->nuke_limit : 0;
+	if (!stv->allocobj(wrk, stv, noc, wsl)) {
+		ObjDestroy(wrk, &noc);
+		return (NULL);
+	}
+	wrk->stats->n_object++;
+	i = smt_copy(wrk, noc, oc, gzip);
+	ObjBocDone(wrk, noc, &noc->boc);
+	if (i) {
+		ObjFreeObj(wrk, noc);
+		ObjDestroy(wrk, &noc);
+	}
+	return (noc);
+}
+
+/*--------------------------------------------------------------------
+ * Move an object we hold a reference on to the other tier.
+ * Nuking in the cold tier makes room for demoted objects, but
+ * promoted ones only go where there is room.
+ * Returns: 1: moved, 0: didn't
+ */
+
+static int
+smt_move(struct worker *wrk, struct smt_sc *sc, struct objcore *oc,
+    unsigned to)
+{
+	struct stevedore *stv;
+	struct objcore *noc = NULL;
+	uint64_t len, glen;
+	int i;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = sc->tier[to];
+	if (oc->stobj->stevedore != sc->tier[!to] || oc->boc != NULL ||
+	    oc->flags & (OC_F_DYING | OC_F_FAILED) || isnan(oc->last_lru))
+		return (0);
+
+	if (sc->gzip && to == SMT_COLD && smt_gzipable(wrk, oc)) {
+		noc = smt_dup(wrk, oc, stv, 1, 1);
+		len = ObjGetLen(wrk, oc);
+		if (noc != NULL) {
+			glen = ObjGetLen(wrk, noc);
+			if (glen * 100 <= len * SMT_GZIP_PCT) {
+				sc->stats->c_gzip++;
+				sc->stats->c_gzip_in += len;
+				sc->stats->c_gzip_out += glen;
+			} else {
+				sc->stats->c_gzip_skip++;
+				ObjFreeObj(wrk, noc);
+				ObjDestroy(wrk, &noc);
+			}
+		}
+	}
+	if (noc == NULL)
+		noc = smt_dup(wrk, oc, stv, to == SMT_COLD, 0);
+	if (noc == NULL) {
+		sc->stats->c_move_fail++;
+		return (0);
+	}
+
+	i = LRU_Replace(oc, noc);
+	if (!i)
+		sc->stats->c_move_busy++;
+	ObjFreeObj(wrk, noc);
+	ObjDestroy(wrk, &noc);
+	return (i);
+}
+
+/*--------------------------------------------------------------------*/
+
+static unsigned
+smt_demote(struct worker *wrk, struct smt_sc *sc)
+{
+	struct stevedore *hot = sc->tier[SMT_HOT];
+	struct objcore *ocs[SMT_BATCH];
+	VCL_BYTES space;
+	uint64_t len;
+	unsigned u, n, moved = 0;
+
+	space = hot->var_free_space(hot);
+	/* An unbounded malloc wraps around to negative */
+	if (space < 0 || space >= sc->reserve)
+		return (0);
+	n = LRU_Borrow(wrk, hot->lru, sc->reserve - space, ocs, SMT_BATCH);
+	for (u = 0; u < n; u++) {
+		len = ObjGetLen(wrk, ocs[u]);
+		if (smt_move(wrk, sc, ocs[u], SMT_COLD)) {
+			sc->stats->c_demoted++;
+			sc->stats->c_demoted_bytes += len;
+			moved++;
+		}
+		(void)HSH_DerefObjCore(wrk, &ocs[u], 0);
+	}
+	return (moved);
+}
+
+static unsigned
+smt_promote(struct worker *wrk, struct smt_sc *sc)
+{
+	struct objcore *ocs[SMT_QUEUE];
+	uint64_t len;
+	unsigned u, n, moved = 0;
+
+	Lck_Lock(&sc->mtx);
+	n = sc->nqueue;
+	memcpy(ocs, sc->queue, n * sizeof *ocs);
+	sc->nqueue = 0;
+	sc->stats->g_queue = 0;
+	Lck_Unlock(&sc->mtx);
+
+	for (u = 0; u < n; u++) {
+		len = ObjGetLen(wrk, ocs[u]);
+		if (smt_move(wrk, sc, ocs[u], SMT_HOT)) {
+			sc->stats->c_promoted++;
+			sc->stats->c_promoted_bytes += len;
+			moved++;
+		}
+		(void)HSH_DerefObjCore(wrk, &ocs[u], 0);
+	}
+	return (moved);
+}
+
+static void * __match_proto__(bgthread_t)
+smt_thread(struct worker *wrk, void *priv)
+{
+	struct smt_sc *sc;
+	struct vsl_log vsl;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sc, priv, SMT_SC_MAGIC);
+
+	VSL_Setup(&vsl, NULL, 0);
+	wrk->vsl = &vsl;
+
+	while (1) {
+		n = smt_demote(wrk, sc);
+		n += smt_promote(wrk, sc);
+		VSL_Flush(&vsl, 0);
+		if (n > 0)
+			continue;
+		Pool_Sumstat(wrk);
+		Lck_Lock(&sc->mtx);
+		(void)Lck_CondWait(&sc->cond, &sc->mtx, VTIM_real() + 1.);
+		Lck_Unlock(&sc->mtx);
+	}
+	NEEDLESS(return NULL);
+}
+
+/*--------------------------------------------------------------------
+ * New objects go to the hot tier if there is room, without nuking,
+ * otherwise to the cold one.
+ */
+
+static int __match_proto__(storage_allocobj_f)
+smt_allocobj(struct worker *wrk, const struct stevedore *stv,
+    struct objcore *oc, unsigned wsl)
+{
+	struct smt_sc *sc;
+	struct stevedore *hot, *cold;
+	int i, nuke;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	hot = sc->tier[SMT_HOT];
+	cold = sc->tier[SMT_COLD];
+
+	nuke = wrk->strangelove;
+	wrk->strangelove = 0;
+	i = hot->allocobj(wrk, hot, oc, wsl);
+	wrk->strangelove = nuke;
+	if (i)
+		return (1);
+	AZ(pthread_cond_signal(&sc->cond));
+	return (cold->allocobj(wrk, cold, oc, wsl));
+}
+
+static VCL_BYTES __match_proto__(stv_var_free_space)
+smt_free_space(const struct stevedore *stv)
+{
+	struct smt_sc *sc;
+	VCL_BYTES r = 0, s;
+	int i;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	for (i = 0; i < 2; i++) {
+		if (sc->tier[i]->var_free_space == NULL)
+			continue;
+		s = sc->tier[i]->var_free_space(sc->tier[i]);
+		if (s > 0)
+			r += s;
+	}
+	return (r);
+}
+
+static VCL_BYTES __match_proto__(stv_var_used_space)
+smt_used_space(const struct stevedore *stv)
+{
+	struct smt_sc *sc;
+	VCL_BYTES r = 0;
+	int i;
+
+	CAST_OBJ_NOTNULL(sc, stv->priv, SMT_SC_MAGIC);
+	for (i = 0; i < 2; i++)
+		if (sc->tier[i]->var_used_space != NULL)
+			r += sc->tier[i]->var_used_space(sc->tier[i]);
+	return (r);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void __match_proto__(storage_init_f)
+smt_init(struct stevedore *parent, int ac, char * const *av)
+{
+	struct smt_sc *sc;
+	struct stevedore *stv;
+	const char *e;
+	uintmax_t u;
+	int i;
+
+	ASSERT_MGT();
+	AZ(av[ac]);
+	if (ac < 2)
+		ARGV_ERR("(-stiered) need a hot and a cold storage\n");
+	if (ac > 4)
+		ARGV_ERR("(-stiered) too many arguments\n");
+
+	ALLOC_OBJ(sc, SMT_SC_MAGIC);
+	AN(sc);
+
+	for (i = 0; i < 2; i++) {
+		STV_Foreach(stv)
+			if (!strcmp(stv->ident, av[i]))
+				break;
+		if (stv == NULL)
+			ARGV_ERR("(-stiered) storage \"%s\" must be "
+			    "defined before\n", av[i]);
+		if (stv->tiered != NULL || stv->sized != NULL)
+			ARGV_ERR("(-stiered) storage \"%s\" is a tier "
+			    "already\n", av[i]);
+		/* Persistent objects cannot move */
+		if (stv->sml_alloc == NULL || stv->baninfo != NULL)
+			ARGV_ERR("(-stiered) storage \"%s\" cannot be "
+			    "a tier\n", av[i]);
+		if (i == SMT_HOT && stv->var_free_space == NULL)
+			ARGV_ERR("(-stiered) storage \"%s\" does not "
+			    "tell its free space\n", av[i]);
+		stv->tiered = parent;
+		sc->tier[i] = stv;
+	}
+
+	if (ac > 2 && *av[2] != '\0') {
+		e = VNUM_2bytes(av[2], &u, 0);
+		if (e != NULL)
+			ARGV_ERR("(-stiered) reserve \"%s\": %s\n", av[2], e);
+		if (u == 0 || u != (uintmax_t)(ssize_t)u)
+			ARGV_ERR("(-stiered) reserve \"%s\": "
+			    "out of range\n", av[2]);
+		sc->reserve = u;
+	}
+	if (ac > 3 && !strcmp(av[3], "gzip"))
+		sc->gzip = 1;
+	else if (ac > 3 && *av[3] != '\0' && strcmp(av[3], "off"))
+		ARGV_ERR("(-stiered) unknown compression \"%s\""
+		    " (use gzip or off)\n", av[3]);
+	parent->priv = sc;
+}
+
+static void __match_proto__(storage_open_f)
+smt_open(struct stevedore *st)
+{
+	struct smt_sc *sc;
+	struct stevedore *stv;
+	VCL_BYTES space;
+	int i;
+
+	ASSERT_CLI();
+	if (lck_smt == NULL)
+		lck_smt = Lck_CreateClass("smt");
+	CAST_OBJ_NOTNULL(sc, st->priv, SMT_SC_MAGIC);
+	sc->ident = st->ident;
+	Lck_New(&sc->mtx, lck_smt);
+	AZ(pthread_cond_init(&sc->cond, NULL));
+	sc->stats = VSC_smt_New(st->ident);
+
+	/* The tiers were defined, so opened, before us */
+	for (i = 0; i < 2; i++) {
+		stv = sc->tier[i];
+		AN(stv->lru);
+		AN(stv->methods);
+		sc->methods[i] = *stv->methods;
+		sc->touch[i] = sc->methods[i].objtouch;
+		sc->methods[i].objtouch = smt_touch;
+		stv->methods = &sc->methods[i];
+	}
+
+	if (sc->reserve == 0) {
+		stv = sc->tier[SMT_HOT];
+		space = stv->var_free_space(stv);
+		if (space > 0)
+			sc->reserve = space / 100 * SMT_RESERVE_PCT;
+		else
+			printf("SMT.%s hot storage has no size,"
+			    " nothing gets demoted\n", st->ident);
+	}
+
+	WRK_BgThread(&sc->thread, "tiered", smt_thread, sc);
+}
+
+const struct stevedore smt_stevedore = {
+	.magic		=	STEVEDORE_MAGIC,
+	.name		=	"tiered",
+	.init		=	smt_init,
+	.open		=	smt_open,
+	.allocobj	=	smt_allocobj,
+	.methods	=	&SML_methods,
+	.var_free_space	=	smt_free_space,
+	.var_used_space	=	smt_used_space,
+};
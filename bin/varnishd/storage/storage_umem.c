@@ -231,6 +231,9 @@ smu_init(struct stevedore *parent, int ac, char * const *av)
 	AZ(av[ac]);
 	if (ac > 1)
 		ARGV_ERR("(-sumem) too many arguments\n");
+	if (parent->hugepages != STV_HUGEPAGES_OFF ||
+	    parent->prefault != STV_PREFAULT_OFF)
+		ARGV_ERR("(-sumem) hugepages and prefault are not supported\n");
 
 	if (ac == 0 || *av[0] == '\0')
 		 return;
@@ -253,7 +256,7 @@ smu_open(struct stevedore *st)
 	struct smu_sc *smu_sc;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_smu == NULL)
 		lck_smu = Lck_CreateClass("smu");
 	CAST_OBJ_NOTNULL(smu_sc, st->priv, SMU_SC_MAGIC);
@@ -56,6 +56,14 @@ struct binheap *binheap_new(void *priv, binheap_cmp_t, binheap_update_t);
 	 * 'priv' is passed to cmp and update functions.
 	 */
 
+struct binheap *binheap_new_arity(void *priv, binheap_cmp_t,
+    binheap_update_t, unsigned arity);
+	/*
+	 * Create a d-ary heap with 'arity' children per node, or with
+	 * zero the same as binheap_new().
+	 * The root item does not have index one with this.
+	 */
+
 void binheap_insert(struct binheap *, void *);
 	/*
 	 * Insert an item
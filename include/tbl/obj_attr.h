@@ -58,6 +58,7 @@
   OBJ_FLAG(CHGGZIP,	chggzip,	(1<<2))
   OBJ_FLAG(IMSCAND,	imscand,	(1<<3))
   OBJ_FLAG(ESIPROC,	esiproc,	(1<<4))
+  OBJ_FLAG(STVGZIP,	stvgzip,	(1<<5))
   #undef OBJ_FLAG
 #endif
 
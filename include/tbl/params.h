@@ -410,6 +410,25 @@ PARAM(
 )
 #endif
 
+PARAM(
+	/* name */	dedup_min_size,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Objects with bodies of at least this size share their body with "
+	"objects of identical content in the same storage, such as Vary "
+	"variants which do not really vary, or the same file under "
+	"several URLs.  Each body is hashed once it is complete, which "
+	"costs some CPU.  Zero disables it.\n"
+	"The disk and persistent stevedores do not take part.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	default_grace,
 	/* typ */	timeout,
@@ -473,6 +492,43 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	expiry_threads,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"1",
+	/* units */	"threads",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Number of expiry threads.\n"
+	"Objects are split over this many shards on their hash digest,"
+	" each with its own timer heap, inbox and thread.  Raise this if"
+	" the EXP.*.inbox backlog keeps growing, as it does when very"
+	" many short-lived objects expire at the same time.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	expiry_wheel,
+	/* typ */	timeout,
+	/* min */	"0.000",
+	/* max */	"60.000",
+	/* default */	"0.000",
+	/* units */	"seconds",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Keep the expiry timers in a timing wheel with this tick instead"
+	" of a binary heap.\n"
+	"The wheel has constant cost per insert, move and delete, no"
+	" matter how many objects there are, but objects expire up to"
+	" one tick late.\n"
+	"Zero means the binary heap.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_bits.c*/
 /* See tbl/feature_bits.h */
@@ -580,6 +636,27 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	hash_nolock,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Look for cache hits without taking the objhead lock first, when "
+	"the hash algorithm supports it.  Lookups which do not find a "
+	"fresh object that way, because it is busy, stale, banned or "
+	"simply not there, are retried with the lock held.\n"
+	"Once this has been turned on, dead objects are freed by a "
+	"background thread, which waits for lockless lookups to finish, "
+	"until the child is restarted.\n"
+	"This has not seen much production use yet.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	http_gzip_support,
 	/* typ */	bool,
@@ -731,6 +808,26 @@ PARAM(
 )
 #undef XYZZY
 
+PARAM(
+	/* name */	inline_body_max,
+	/* typ */	bytes,
+	/* min */	"0",
+	/* max */	"4k",
+	/* default */	"0",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Bodies with a Content-Length of at most this size are stored "
+	"in the same allocation as the object itself, instead of in a "
+	"separate one.  This saves memory and a cache miss per delivery "
+	"of small objects.  Zero disables it.\n"
+	"The inline space is sized after the Content-Length, and stays "
+	"allocated if gzip or ESI processing makes the body smaller.\n"
+	"The disk and persistent stevedores do not take part.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	listen_depth,
 	/* typ */	uint,
@@ -745,6 +842,27 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	lru_clock,
+	/* typ */	bool,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* default */	"off",
+	/* units */	"bool",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Use CLOCK (second chance) instead of LRU for nuking.\n"
+	"A hit only marks the object as referenced, and does not move it "
+	"on the list, if the object was not added or passed over in the "
+	"last lru_interval.  The mark is set under a trylock of the list, "
+	"so hits never wait for it.  When space is needed, "
+	"referenced objects are moved to the back of the list and "
+	"unmarked, and the first unreferenced object which is not in use "
+	"is nuked.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	lru_interval,
 	/* typ */	timeout,
@@ -763,6 +881,43 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	lru_reserve,
+	/* typ */	bytes,
+	/* min */	"0b",
+	/* max */	NULL,
+	/* default */	"0b",
+	/* units */	"bytes",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Free space to keep in each storage backend.\n"
+	"When set, a background thread nukes objects, in batches, "
+	"whenever a storage has less than this much space left, so that "
+	"fetches rarely have to nuke objects themselves.  Only storage "
+	"backends which know their free space take part, which includes "
+	"malloc, umem and file.  Zero disables the reserve.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	lru_shards,
+	/* typ */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* default */	"1",
+	/* units */	"lists",
+	/* flags */	MUST_RESTART| EXPERIMENTAL,
+	/* s-text */
+	"Number of LRU lists per storage backend.\n"
+	"Objects are spread over the lists on their address, each list "
+	"with its own lock, and nuking starts on a different list every "
+	"time.  More lists mean less lock contention, but a coarser "
+	"approximation of LRU.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	max_esi_depth,
 	/* typ */	uint,
@@ -854,6 +1009,23 @@ PARAM(
 )
 #endif
 
+PARAM(
+	/* name */	persistent_sync_interval,
+	/* typ */	timeout,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"30",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How long the open segment of a persistent silo can receive "
+	"objects before it is closed and written out.  Objects in the "
+	"open segment are lost in a crash, so this bounds how much "
+	"is lost.  Zero only closes segments when they are full.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	ping_interval,
 	/* typ */	uint,
@@ -950,6 +1122,43 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	readahead,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	"64",
+	/* default */	"4",
+	/* units */	"segments",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"How many storage segments ahead of delivery the stevedore is "
+	"asked to start reading, so that delivery does not have to wait "
+	"for the disk.  Only the file and disk stevedores make use of "
+	"this.  Zero disables it.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
+PARAM(
+	/* name */	rush_adaptive,
+	/* typ */	timeout,
+	/* min */	"0.000",
+	/* max */	NULL,
+	/* default */	"0.000",
+	/* units */	"seconds",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"When non-zero, size the number of parked requests started from "
+	"the number of requests waiting and how long the oldest of them "
+	"waited: half of them once it waited this long, more the longer "
+	"it waited, never fewer than rush_exponent.\n"
+	"Requests which the object that was just unbusied satisfies are "
+	"handed that object, rather than repeating the lookup.\n"
+	"Zero keeps the fixed rush_exponent behaviour.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 PARAM(
 	/* name */	rush_exponent,
 	/* typ */	uint,
@@ -1411,6 +1620,24 @@ PARAM(
 	/* func */	NULL
 )
 
+PARAM(
+	/* name */	vary_index,
+	/* typ */	uint,
+	/* min */	"0",
+	/* max */	NULL,
+	/* default */	"0",
+	/* units */	"objects",
+	/* flags */	EXPERIMENTAL,
+	/* s-text */
+	"Number of objects with a Vary header on one hash entry, above "
+	"which they are indexed on the values of the request headers they "
+	"vary on, so lookups no longer examine every variant.\n"
+	"Zero disables the index for new hash entries.\n"
+	"Objects on persistent storage are never indexed.",
+	/* l-text */	"",
+	/* func */	NULL
+)
+
 #if 0
 /* actual location mgt_param_tbl.c */
 PARAM(
@@ -323,6 +323,8 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"LRU_Fail\n"
 	"\tLogged when no suitable candidate object is found for LRU force"
 	" expiry.\n\n"
+	"LRU_Reject\n"
+	"\tLogged when the tinylfu policy does not let a new object in.\n\n"
 	"The format is::\n\n"
 	"\tEXP_Rearm p=%p E=%f e=%f f=0x%x\n"
 	"\tEXP_Inbox p=%p e=%f f=0x%x\n"
@@ -332,6 +334,7 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"\tLRU_Cand p=%p f=0x%x r=%d\n"
 	"\tLRU x=%u\n"
 	"\tLRU_Fail\n"
+	"\tLRU_Reject n=%u v=%u\n"
 	"\t\n"
 	"\tLegend:\n"
 	"\tp=%p         Objcore pointer\n"
@@ -341,6 +344,8 @@ SLTM(ExpKill, 0, "Object expiry event",
 	"\tf=0x%x       Objcore flags\n"
 	"\tr=%d         Objcore refcount\n"
 	"\tx=%u         Object VXID\n"
+	"\tn=%u         Estimated accesses to the new object\n"
+	"\tv=%u         Estimated accesses to the LRU candidate\n"
 	"\n"
 )
 
@@ -404,7 +409,7 @@ SLTM(Gzip, 0, "G(un)zip performed on object",
 	"\t|  |  |  |  +---------- Bytes output\n"
 	"\t|  |  |  +------------- Bytes input\n"
 	"\t|  |  +---------------- 'E': ESI, '-': Plain object\n"
-	"\t|  +------------------- 'F': Fetch, 'D': Deliver\n"
+	"\t|  +------------------- 'F': Fetch, 'D': Deliver, 'S': Storage\n"
 	"\t+---------------------- 'G': Gzip, 'U': Gunzip, 'u': Gunzip-test\n"
 	"\n"
 	"Examples::\n\n"
@@ -0,0 +1,88 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hierarchical timing wheel API
+ *
+ * Same idea as binary_heap.h, but for items which are ordered by a
+ * point in time: insert, move and delete are O(1), and the items come
+ * out in the order of their tick, rather than strictly in time order.
+ * An item is only handed out once its tick has fully passed, so it is
+ * up to one tick late but never early.
+ */
+
+/* Public Interface --------------------------------------------------*/
+
+struct twheel;
+
+typedef void twheel_update_t(void *priv, void *a, unsigned newidx);
+	/*
+	 * Update function
+	 * Gets called with the handle of an item when it is inserted
+	 * and with TWHEEL_NOIDX when it is deleted.  Unlike the binheap
+	 * index, the handle does not change while the item is in the
+	 * wheel.
+	 */
+
+struct twheel *twheel_new(void *priv, twheel_update_t, double now,
+    double tick);
+	/*
+	 * Create timing wheel, starting at 'now', with 'tick' seconds
+	 * resolution.
+	 * 'priv' is passed to the update function.
+	 */
+
+void twheel_insert(struct twheel *, void *, double when);
+	/*
+	 * Insert an item, due at 'when'
+	 */
+
+void twheel_reorder(struct twheel *, unsigned idx, double when);
+	/*
+	 * Move an item to a new time
+	 */
+
+void twheel_delete(struct twheel *, unsigned idx);
+	/*
+	 * Delete an item
+	 */
+
+void *twheel_due(struct twheel *, double now);
+	/*
+	 * Return an item which is due at 'now', or NULL if there is none.
+	 * The item stays in the wheel until it is deleted.
+	 */
+
+double twheel_next(const struct twheel *);
+	/*
+	 * Return the earliest time twheel_due() may have an item to
+	 * return, or zero if the wheel is empty.
+	 */
+
+unsigned twheel_count(const struct twheel *);
+	/*
+	 * Return the number of items in the wheel
+	 */
+
+#define TWHEEL_NOIDX	0
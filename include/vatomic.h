@@ -0,0 +1,51 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Atomic operations
+ *
+ * These are full memory barriers, same as the VMB() family, so no
+ * additional fencing is needed around them.
+ */
+
+#ifndef VATOMIC_H_INCLUDED
+#define VATOMIC_H_INCLUDED
+
+#if defined(__GNUC__) || defined(__clang__)
+
+#define VATOMIC_ADD(p, v)	__sync_add_and_fetch((p), (v))
+#define VATOMIC_SUB(p, v)	__sync_sub_and_fetch((p), (v))
+#define VATOMIC_INC(p)		VATOMIC_ADD((p), 1)
+#define VATOMIC_DEC(p)		VATOMIC_SUB((p), 1)
+#define VATOMIC_OR(p, v)	__sync_or_and_fetch((p), (v))
+#define VATOMIC_AND(p, v)	__sync_and_and_fetch((p), (v))
+#define VATOMIC_CAS(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+
+#else
+
+#error "No atomic operations for this compiler"
+
+#endif
+
+#endif /* VATOMIC_H_INCLUDED */
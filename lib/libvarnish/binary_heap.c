@@ -31,6 +31,12 @@
  * See also:
  *	http://dl.acm.org/citation.cfm?doid=1785414.1785434
  *	(or: http://queue.acm.org/detail.cfm?id=1814327)
+ *
+ * binheap_new_arity() gives a plain d-ary heap instead, laid out so
+ * that the children of a node start on a multiple of d, ie: share a
+ * cache line for d = 8 and 64 byte lines.  Fewer levels, at the cost
+ * of more comparisons per level, which may or may not pay off,
+ * depending on the size of the heap and the hardware.
  */
 
 #include "config.h"
@@ -77,6 +83,8 @@
 struct binheap {
 	unsigned		magic;
 #define BINHEAP_MAGIC		0xf581581aU	/* from /dev/random */
+	unsigned		arity;		/* 0: B-heap */
+	unsigned		root;
 	void			*priv;
 	binheap_cmp_t		*cmp;
 	binheap_update_t	*update;
@@ -178,6 +186,39 @@ child(const struct binheap *bh, unsigned u, unsigned *a, unsigned *b)
 
 #endif
 
+/*
+ * d-ary heap: the logical index i lives at i + root, where root is
+ * d - 1, so the first child of every node is on a multiple of d.
+ */
+
+static unsigned
+dary_parent(const struct binheap *bh, unsigned u)
+{
+
+	assert(u > bh->root);
+	return ((u - bh->root - 1) / bh->arity + bh->root);
+}
+
+static unsigned
+dary_child(const struct binheap *bh, unsigned u)
+{
+	uintmax_t uu;
+
+	uu = (uintmax_t)(u - bh->root) * bh->arity + 1 + bh->root;
+	if (uu > UINT_MAX)
+		return (UINT_MAX);	/* See child() */
+	return ((unsigned)uu);
+}
+
+static unsigned
+binheap_parent(const struct binheap *bh, unsigned u)
+{
+
+	if (bh->arity != 0)
+		return (dary_parent(bh, u));
+	return (parent(bh, u));
+}
+
 /* Implementation ----------------------------------------------------*/
 
 static void
@@ -202,15 +243,20 @@ binheap_addrow(struct binheap *bh)
 }
 
 struct binheap *
-binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
+binheap_new_arity(void *priv, binheap_cmp_t *cmp_f,
+    binheap_update_t *update_f, unsigned arity)
 {
 	struct binheap *bh;
 	unsigned u;
 
+	assert(arity != 1);
+	assert(arity <= 64);
 	bh = calloc(1, sizeof *bh);
 	if (bh == NULL)
 		return (bh);
 	bh->priv = priv;
+	bh->arity = arity;
+	bh->root = arity != 0 ? arity - 1 : ROOT_IDX;
 
 	bh->page_size = (unsigned)getpagesize() / sizeof (void *);
 	bh->page_mask = bh->page_size - 1;
@@ -222,16 +268,23 @@ binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
 
 	bh->cmp = cmp_f;
 	bh->update = update_f;
-	bh->next = ROOT_IDX;
+	bh->next = bh->root;
 	bh->rows = 16;		/* A tiny-ish number */
 	bh->array = calloc(bh->rows, sizeof *bh->array);
 	assert(bh->array != NULL);
 	binheap_addrow(bh);
-	A(bh, ROOT_IDX) = NULL;
+	A(bh, bh->root) = NULL;
 	bh->magic = BINHEAP_MAGIC;
 	return (bh);
 }
 
+struct binheap *
+binheap_new(void *priv, binheap_cmp_t *cmp_f, binheap_update_t *update_f)
+{
+
+	return (binheap_new_arity(priv, cmp_f, update_f, 0));
+}
+
 static void
 binheap_update(const struct binheap *bh, unsigned u)
 {
@@ -270,10 +323,10 @@ binheap_trickleup(const struct binheap *bh, unsigned u)
 	assert(u < bh->next);
 	assert(A(bh, u) != NULL);
 
-	while (u > ROOT_IDX) {
+	while (u > bh->root) {
 		assert(u < bh->next);
 		assert(A(bh, u) != NULL);
-		v = parent(bh, u);
+		v = binheap_parent(bh, u);
 		assert(v < u);
 		assert(v < bh->next);
 		assert(A(bh, v) != NULL);
@@ -285,6 +338,30 @@ binheap_trickleup(const struct binheap *bh, unsigned u)
 	return (u);
 }
 
+static unsigned
+dary_trickledown(const struct binheap *bh, unsigned u)
+{
+	unsigned v, w, e;
+
+	while (1) {
+		assert(u < bh->next);
+		assert(A(bh, u) != NULL);
+		v = dary_child(bh, u);
+		if (v >= bh->next)
+			return (u);
+		e = bh->next - v > bh->arity ? v + bh->arity : bh->next;
+		for (w = v + 1; w < e; w++) {
+			assert(A(bh, w) != NULL);
+			if (bh->cmp(bh->priv, A(bh, w), A(bh, v)))
+				v = w;
+		}
+		if (bh->cmp(bh->priv, A(bh, u), A(bh, v)))
+			return (u);
+		binhead_swap(bh, u, v);
+		u = v;
+	}
+}
+
 static unsigned
 binheap_trickledown(const struct binheap *bh, unsigned u)
 {
@@ -295,6 +372,9 @@ binheap_trickledown(const struct binheap *bh, unsigned u)
 	assert(u < bh->next);
 	assert(A(bh, u) != NULL);
 
+	if (bh->arity != 0)
+		return (dary_trickledown(bh, u));
+
 	while (1) {
 		assert(u < bh->next);
 		assert(A(bh, u) != NULL);
@@ -347,8 +427,8 @@ chk(const struct binheap *bh)
 {
 	unsigned u, v;
 
-	for (u = 2; u < bh->next; u++) {
-		v = parent(bh, u);
+	for (u = bh->root + 1; u < bh->next; u++) {
+		v = binheap_parent(bh, u);
 		AZ(bh->cmp(bh->priv, A(bh, u), A(bh, v)));
 	}
 }
@@ -363,7 +443,7 @@ binheap_root(const struct binheap *bh)
 #ifdef PARANOIA
 	chk(bh);
 #endif
-	return (A(bh, ROOT_IDX));
+	return (A(bh, bh->root));
 }
 
 /*
@@ -396,9 +476,9 @@ binheap_delete(struct binheap *bh, unsigned idx)
 
 	assert(bh != NULL);
 	assert(bh->magic == BINHEAP_MAGIC);
-	assert(bh->next > ROOT_IDX);
+	assert(bh->next > bh->root);
 	assert(idx < bh->next);
-	assert(idx > 0);
+	assert(idx >= bh->root);
 	assert(A(bh, idx) != NULL);
 	bh->update(bh->priv, A(bh, idx), BINHEAP_NOIDX);
 	if (idx == --bh->next) {
@@ -439,9 +519,9 @@ binheap_reorder(const struct binheap *bh, unsigned idx)
 
 	assert(bh != NULL);
 	assert(bh->magic == BINHEAP_MAGIC);
-	assert(bh->next > ROOT_IDX);
+	assert(bh->next > bh->root);
 	assert(idx < bh->next);
-	assert(idx > 0);
+	assert(idx >= bh->root);
 	assert(A(bh, idx) != NULL);
 	idx = binheap_trickleup(bh, idx);
 	assert(idx < bh->next);
@@ -0,0 +1,449 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Benchmark for the timer structures, as used for object expiry.
+ *
+ * A population of items is inserted first, then time is moved forward
+ * in steps which expire roughly one item each, replacing the expired
+ * items with new ones and moving a configurable share of the live
+ * items to a new time.  The steady state rate counts the deletes,
+ * inserts and moves.  Then random items are moved to a new time, and
+ * finally all items are deleted in random order.
+ *
+ * The binheap is tested both with its default B-heap layout and as a
+ * d-ary heap, to help chose the best layout for a given machine.
+ * Run it with a list of sizes, eg: -n 1000000,10000000,100000000.
+ *
+ * The "ttl" workload draws times from a mix which looks like what
+ * a cache sees, the "random" workload spreads them evenly.  The random
+ * generator is seeded from -s, so runs are reproducible.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vdef.h"
+
+#include "binary_heap.h"
+#include "miniobj.h"
+#include "timer_wheel.h"
+#include "vas.h"
+#include "vtim.h"
+
+struct item {
+	unsigned		magic;
+#define ITEM_MAGIC		0x6bd4bf0b
+	unsigned		idx;
+	double			when;
+};
+
+struct bench_impl {
+	const char		*name;
+	unsigned		arity;
+	void			(*new)(const struct bench_impl *, double now);
+	void			(*insert)(struct item *);
+	void			(*reorder)(struct item *);
+	void			(*delete)(struct item *);
+	struct item		*(*due)(double now);
+};
+
+static unsigned bench_nitem = 1000000;
+static unsigned bench_nop = 10000000;
+static unsigned bench_rearm = 100;		/* per mille */
+static uint64_t bench_seed = 1;
+static double bench_tick = 0.1;
+static const char *bench_workload = "ttl";
+
+static struct item *items;
+static unsigned *freelist;
+static unsigned nfree;
+
+/*--------------------------------------------------------------------*/
+
+static uint64_t rnd_state;
+
+static uint64_t
+rnd(void)
+{
+
+	/* xorshift64* */
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return (rnd_state * 0x2545f4914f6cdd1dULL);
+}
+
+static double
+rnd_double(void)
+{
+
+	return ((rnd() >> 11) * 0x1p-53);
+}
+
+static double bench_meanttl;
+
+static double
+bench_ttl(void)
+{
+	double r;
+
+	if (!strcmp(bench_workload, "random"))
+		return (rnd_double() * 7200.);
+
+	/*
+	 * Mostly the default ttl, a fair share of short lived objects,
+	 * and a tail of long lived ones.
+	 */
+	r = rnd_double();
+	if (r < .5)
+		return (120. + rnd_double());
+	if (r < .8)
+		return (1. + rnd_double() * 59.);
+	if (r < .95)
+		return (3600. * (1. + rnd_double()));
+	return (86400. * (1. + 6. * rnd_double()));
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct binheap *bh;
+
+static int __match_proto__(binheap_cmp_t)
+bh_cmp(void *priv, const void *a, const void *b)
+{
+	const struct item *aa, *bb;
+
+	(void)priv;
+	aa = a;
+	bb = b;
+	return (aa->when < bb->when);
+}
+
+static void __match_proto__(binheap_update_t)
+item_update(void *priv, void *p, unsigned u)
+{
+	struct item *it;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(it, p, ITEM_MAGIC);
+	it->idx = u;
+}
+
+static void
+bh_new(const struct bench_impl *bi, double now)
+{
+
+	(void)now;
+	bh = binheap_new_arity(NULL, bh_cmp, item_update, bi->arity);
+	AN(bh);
+}
+
+static void
+bh_insert(struct item *it)
+{
+
+	binheap_insert(bh, it);
+}
+
+static void
+bh_reorder(struct item *it)
+{
+
+	binheap_reorder(bh, it->idx);
+}
+
+static void
+bh_delete(struct item *it)
+{
+
+	binheap_delete(bh, it->idx);
+}
+
+static struct item *
+bh_due(double now)
+{
+	struct item *it;
+
+	it = binheap_root(bh);
+	if (it == NULL || it->when > now)
+		return (NULL);
+	return (it);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct twheel *tw;
+
+static void
+tw_new(const struct bench_impl *bi, double now)
+{
+
+	(void)bi;
+	tw = twheel_new(NULL, item_update, now, bench_tick);
+	AN(tw);
+}
+
+static void
+tw_insert(struct item *it)
+{
+
+	twheel_insert(tw, it, it->when);
+}
+
+static void
+tw_reorder(struct item *it)
+{
+
+	twheel_reorder(tw, it->idx, it->when);
+}
+
+static void
+tw_delete(struct item *it)
+{
+
+	twheel_delete(tw, it->idx);
+}
+
+static struct item *
+tw_due(double now)
+{
+
+	return (twheel_due(tw, now));
+}
+
+/*--------------------------------------------------------------------*/
+
+#define BH(n, a) { n, a, bh_new, bh_insert, bh_reorder, bh_delete, bh_due }
+static const struct bench_impl bench_impls[] = {
+	BH("binheap", 0),
+	BH("heap2", 2),
+	BH("heap4", 4),
+	BH("heap8", 8),
+	BH("heap16", 16),
+	{ "twheel", 0, tw_new, tw_insert, tw_reorder, tw_delete, tw_due },
+	{ NULL }
+};
+#undef BH
+
+static void
+bench_report(const struct bench_impl *bi, const char *what, uint64_t n,
+    double t, const char *extra)
+{
+
+	printf("%-8s %-6s %10u %-8s %11ju ops %8.3f s %8.3f Mops/s%s\n",
+	    bi->name, bench_workload, bench_nitem, what, (uintmax_t)n, t,
+	    n / t * 1e-6, extra);
+	(void)fflush(stdout);
+}
+
+static void
+bench_run(const struct bench_impl *bi)
+{
+	char buf[80];
+	struct item *it;
+	double now, dt, t0, t1;
+	uint64_t nexp = 0, nrearm = 0;
+	unsigned u, v;
+
+	rnd_state = bench_seed;
+	now = 1e9;
+	bi->new(bi, now);
+	memset(items, 0, bench_nitem * sizeof *items);
+	nfree = 0;
+
+	t0 = VTIM_mono();
+	for (u = 0; u < bench_nitem; u++) {
+		it = &items[u];
+		it->magic = ITEM_MAGIC;
+		it->when = now + bench_ttl();
+		bi->insert(it);
+	}
+	t1 = VTIM_mono();
+	bench_report(bi, "insert", bench_nitem, t1 - t0, "");
+
+	/* Advance time so that about one item expires per operation */
+	dt = bench_meanttl / bench_nitem;
+	t0 = VTIM_mono();
+	for (u = 0; u < bench_nop; u++) {
+		now += dt;
+		while ((it = bi->due(now)) != NULL) {
+			CHECK_OBJ_NOTNULL(it, ITEM_MAGIC);
+			assert(it->when < now + bench_tick);
+			bi->delete(it);
+			freelist[nfree++] = it - items;
+			nexp++;
+		}
+		/* The cache stays full, everything expired is refetched */
+		while (nfree > 0) {
+			it = &items[freelist[--nfree]];
+			it->when = now + bench_ttl();
+			bi->insert(it);
+		}
+		if (rnd() % 1000 < bench_rearm) {
+			v = rnd() % bench_nitem;
+			it = &items[v];
+			if (it->idx == 0)
+				continue;
+			it->when = now + bench_ttl();
+			bi->reorder(it);
+			nrearm++;
+		}
+	}
+	t1 = VTIM_mono();
+	bprintf(buf, " (%ju expired and replaced, %ju moved)",
+	    (uintmax_t)nexp, (uintmax_t)nrearm);
+	bench_report(bi, "steady", 2 * nexp + nrearm, t1 - t0, buf);
+
+	/* Move random items to a new time */
+	t0 = VTIM_mono();
+	for (u = 0; u < bench_nop; u++) {
+		it = &items[rnd() % bench_nitem];
+		if (it->idx == 0)
+			continue;
+		it->when = now + bench_ttl();
+		bi->reorder(it);
+	}
+	t1 = VTIM_mono();
+	bench_report(bi, "reorder", bench_nop, t1 - t0, "");
+
+	/* Delete the live items in random order */
+	for (u = 0; u < bench_nitem; u++)
+		freelist[u] = u;
+	for (u = bench_nitem; u > 1; u--) {
+		v = rnd() % u;
+		nfree = freelist[v];
+		freelist[v] = freelist[u - 1];
+		freelist[u - 1] = nfree;
+	}
+	t0 = VTIM_mono();
+	v = 0;
+	for (u = 0; u < bench_nitem; u++) {
+		it = &items[freelist[u]];
+		if (it->idx == 0)
+			continue;
+		bi->delete(it);
+		v++;
+	}
+	t1 = VTIM_mono();
+	bench_report(bi, "delete", v, t1 - t0, "");
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+usage(void)
+{
+	const struct bench_impl *bi;
+
+	fprintf(stderr, "Usage: timer_bench [-i impl,...] [-n items,...]"
+	    " [-o ops] [-r rearm] [-s seed] [-t tick] [-w workload]\n"
+	    "\t-i\timplementations (all):");
+	for (bi = bench_impls; bi->name != NULL; bi++)
+		fprintf(stderr, " %s", bi->name);
+	fprintf(stderr, "\n"
+	    "\t-n\titems inserted before the run (%u)\n"
+	    "\t-o\ttime steps in the run (%u)\n"
+	    "\t-r\titems moved per 1000 steps (%u)\n"
+	    "\t-s\trandom seed (%ju)\n"
+	    "\t-t\ttimer wheel tick (%g)\n"
+	    "\t-w\tttl or random (%s)\n",
+	    bench_nitem, bench_nop, bench_rearm, (uintmax_t)bench_seed,
+	    bench_tick, bench_workload);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct bench_impl *bi;
+	const char *i_arg = NULL, *n_arg = NULL, *p;
+	char *e;
+	unsigned u, n = 0;
+	size_t l;
+	int o;
+
+	while ((o = getopt(argc, argv, "i:n:o:r:s:t:w:")) != -1) {
+		switch (o) {
+		case 'i': i_arg = optarg; break;
+		case 'n': n_arg = optarg; break;
+		case 'o': bench_nop = strtoul(optarg, NULL, 0); break;
+		case 'r': bench_rearm = strtoul(optarg, NULL, 0); break;
+		case 's': bench_seed = strtoull(optarg, NULL, 0); break;
+		case 't': bench_tick = strtod(optarg, NULL); break;
+		case 'w': bench_workload = optarg; break;
+		default: usage();
+		}
+	}
+	if (argc != optind || bench_rearm > 1000 ||
+	    bench_seed == 0 || !(bench_tick > 0.) ||
+	    (strcmp(bench_workload, "ttl") &&
+	    strcmp(bench_workload, "random")))
+		usage();
+
+	rnd_state = bench_seed;
+	for (u = 0; u < 1000000; u++)
+		bench_meanttl += bench_ttl();
+	bench_meanttl /= u;
+
+	p = n_arg;
+	do {
+		if (p != NULL) {
+			bench_nitem = strtoul(p, &e, 0);
+			if (bench_nitem == 0 || (*e != '\0' && *e != ','))
+				usage();
+			p = *e == ',' ? e + 1 : NULL;
+		}
+		items = calloc(bench_nitem, sizeof *items);
+		AN(items);
+		freelist = calloc(bench_nitem, sizeof *freelist);
+		AN(freelist);
+
+		for (bi = bench_impls; bi->name != NULL; bi++) {
+			if (i_arg != NULL) {
+				l = strlen(bi->name);
+				e = strstr(i_arg, bi->name);
+				while (e != NULL && ((e != i_arg && e[-1] != ',') ||
+				    (e[l] != '\0' && e[l] != ',')))
+					e = strstr(e + 1, bi->name);
+				if (e == NULL)
+					continue;
+			}
+			bench_run(bi);
+			n++;
+		}
+		if (n == 0)
+			usage();
+
+		free(items);
+		free(freelist);
+	} while (p != NULL);
+	return (0);
+}
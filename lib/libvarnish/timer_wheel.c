@@ -0,0 +1,543 @@
+/*-
+ * Copyright (c) 2017 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Implementation of a hierarchical timing wheel
+ *
+ * Four levels of 256 slots each, level N slot S holding the items whose
+ * tick has S in bits 8N..8N+7 and which are within 256 slots of the
+ * current position at that level.  Whatever is further out than four
+ * levels go on a single far list.  When the current tick crosses a
+ * level boundary, the slot at that position on the higher levels is
+ * emptied into the lower levels.
+ *
+ * The items are kept in doubly linked lists threaded through an array
+ * of entries, and the index of its entry is the handle of the item.
+ * The entries are allocated in chunks which never move, so there is no
+ * need to tell the items about renumbering, as the binheap has to.
+ *
+ * Per-level bitmaps of the non-empty slots let us skip empty ticks
+ * quickly, and tell when the next item can be due.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "timer_wheel.h"
+#include "vas.h"
+
+/* Parameters --------------------------------------------------------*/
+
+#define TW_BITS			8
+#define TW_LEVELS		4
+
+/*
+ * Entries are allocated this many at a time, 96 kB on 64bit systems.
+ */
+#define CHUNK_SHIFT		12
+
+/* Private definitions -----------------------------------------------*/
+
+#define TW_SLOTS		(1U << TW_BITS)
+#define TW_MASK			((uint64_t)TW_SLOTS - 1)
+#define TW_FAR			(TW_LEVELS * TW_SLOTS)
+#define TW_NSLOT		(TW_FAR + 1)
+#define TW_WORDS		(TW_SLOTS / 32)
+
+#define CHUNK_WIDTH		(1U << CHUNK_SHIFT)
+
+#define E(tw, n)		\
+	(&(tw)->chunks[(n) >> CHUNK_SHIFT][(n) & (CHUNK_WIDTH - 1)])
+
+struct tw_entry {
+	void			*item;
+	double			when;
+	unsigned		next;
+	unsigned		prev;
+	unsigned		slot;
+};
+
+struct twheel {
+	unsigned		magic;
+#define TWHEEL_MAGIC		0x0b3a53c1
+	void			*priv;
+	twheel_update_t		*update;
+	double			tick;
+	uint64_t		cur;
+	struct tw_entry		**chunks;
+	unsigned		nchunk;
+	unsigned		nentry;
+	unsigned		freelist;
+	unsigned		count;
+	unsigned		head[TW_NSLOT];
+	uint32_t		bits[TW_LEVELS][TW_WORDS];
+};
+
+/*--------------------------------------------------------------------*/
+
+static uint64_t
+tw_tick(const struct twheel *tw, double when)
+{
+	double d;
+
+	d = when / tw->tick;
+	if (!(d > 0.))
+		return (0);
+	if (d >= 0x1p63)
+		return ((uint64_t)1 << 63);
+	return ((uint64_t)d);
+}
+
+/*
+ * Return the distance from slot 's' to the first non-empty slot on
+ * level 'l', going around if need be, or TW_SLOTS if the level is empty.
+ */
+
+static unsigned
+tw_dist(const struct twheel *tw, unsigned l, unsigned s)
+{
+	unsigned w, u;
+	uint32_t m;
+
+	assert(l < TW_LEVELS);
+	assert(s < TW_SLOTS);
+	w = s / 32;
+	m = tw->bits[l][w] & (~0U << (s % 32));
+	for (u = 0; m == 0; u++) {
+		if (u == TW_WORDS)
+			return (TW_SLOTS);
+		w = (w + 1) % TW_WORDS;
+		m = tw->bits[l][w];
+	}
+	return (((w * 32 + ffs((int)m) - 1) - s) & TW_MASK);
+}
+
+static void
+tw_link(struct twheel *tw, unsigned idx, unsigned slot)
+{
+	struct tw_entry *e;
+
+	assert(slot < TW_NSLOT);
+	e = E(tw, idx);
+	e->slot = slot;
+	e->prev = 0;
+	e->next = tw->head[slot];
+	if (e->next != 0)
+		E(tw, e->next)->prev = idx;
+	tw->head[slot] = idx;
+	if (slot < TW_FAR)
+		tw->bits[slot / TW_SLOTS][(slot % TW_SLOTS) / 32] |=
+		    1U << (slot % 32);
+}
+
+static void
+tw_unlink(struct twheel *tw, unsigned idx)
+{
+	struct tw_entry *e;
+	unsigned slot;
+
+	e = E(tw, idx);
+	slot = e->slot;
+	assert(slot < TW_NSLOT);
+	if (e->prev != 0)
+		E(tw, e->prev)->next = e->next;
+	else
+		tw->head[slot] = e->next;
+	if (e->next != 0)
+		E(tw, e->next)->prev = e->prev;
+	if (tw->head[slot] == 0 && slot < TW_FAR)
+		tw->bits[slot / TW_SLOTS][(slot % TW_SLOTS) / 32] &=
+		    ~(1U << (slot % 32));
+}
+
+static void
+tw_place(struct twheel *tw, unsigned idx)
+{
+	uint64_t t;
+	unsigned l, sh;
+
+	t = tw_tick(tw, E(tw, idx)->when);
+	if (t < tw->cur)
+		t = tw->cur;
+	for (l = 0; l < TW_LEVELS; l++) {
+		sh = l * TW_BITS;
+		if ((t >> sh) - (tw->cur >> sh) < TW_SLOTS) {
+			tw_link(tw, idx,
+			    l * TW_SLOTS + (unsigned)((t >> sh) & TW_MASK));
+			return;
+		}
+	}
+	tw_link(tw, idx, TW_FAR);
+}
+
+static void
+tw_cascade(struct twheel *tw, unsigned slot)
+{
+	unsigned idx, next;
+
+	idx = tw->head[slot];
+	tw->head[slot] = 0;
+	if (slot < TW_FAR)
+		tw->bits[slot / TW_SLOTS][(slot % TW_SLOTS) / 32] &=
+		    ~(1U << (slot % 32));
+	for (; idx != 0; idx = next) {
+		next = E(tw, idx)->next;
+		tw_place(tw, idx);
+	}
+}
+
+/*
+ * Return the next tick after the current one at which something
+ * happens: a level 0 slot becomes current, or a non-empty slot on a
+ * higher level has to be cascaded.  '*due' tells which.
+ */
+
+static uint64_t
+tw_event(const struct twheel *tw, int *due)
+{
+	uint64_t e, t, pos;
+	unsigned l, sh, d;
+
+	e = UINT64_MAX;
+	*due = 0;
+	d = tw_dist(tw, 0, (unsigned)((tw->cur + 1) & TW_MASK));
+	if (d < TW_SLOTS) {
+		e = tw->cur + 1 + d;
+		*due = 1;
+	}
+	for (l = 1; l < TW_LEVELS; l++) {
+		sh = l * TW_BITS;
+		pos = tw->cur >> sh;
+		d = tw_dist(tw, l, (unsigned)((pos + 1) & TW_MASK));
+		if (d == TW_SLOTS)
+			continue;
+		t = (pos + 1 + d) << sh;
+		if (t <= e) {
+			e = t;
+			*due = 0;
+		}
+	}
+	if (tw->head[TW_FAR] != 0) {
+		sh = TW_LEVELS * TW_BITS;
+		t = ((tw->cur >> sh) + 1) << sh;
+		if (t <= e) {
+			e = t;
+			*due = 0;
+		}
+	}
+	return (e);
+}
+
+/*
+ * Move the current tick towards 'target', but stop on the first
+ * non-empty slot.
+ */
+
+static void
+tw_advance(struct twheel *tw, uint64_t target)
+{
+	unsigned l;
+	uint64_t m;
+	int due;
+
+	while (tw->cur < target) {
+		if (tw->head[tw->cur & TW_MASK] != 0)
+			return;
+		m = tw_event(tw, &due);
+		if (m > target) {
+			tw->cur = target;
+			return;
+		}
+		tw->cur = m;
+
+		m = (uint64_t)1 << (TW_LEVELS * TW_BITS);
+		if ((tw->cur & (m - 1)) == 0)
+			tw_cascade(tw, TW_FAR);
+		for (l = TW_LEVELS - 1; l > 0; l--) {
+			m = (uint64_t)1 << (l * TW_BITS);
+			if ((tw->cur & (m - 1)) == 0)
+				tw_cascade(tw, l * TW_SLOTS +
+				    (unsigned)((tw->cur >> (l * TW_BITS)) &
+				    TW_MASK));
+		}
+	}
+}
+
+/*--------------------------------------------------------------------*/
+
+struct twheel *
+twheel_new(void *priv, twheel_update_t *update_f, double now, double tick)
+{
+	struct twheel *tw;
+
+	AN(update_f);
+	assert(tick > 0.);
+	tw = calloc(1, sizeof *tw);
+	AN(tw);
+	tw->magic = TWHEEL_MAGIC;
+	tw->priv = priv;
+	tw->update = update_f;
+	tw->tick = tick;
+	tw->cur = tw_tick(tw, now);
+	tw->nentry = 1;		/* Entry zero is the list terminator */
+	return (tw);
+}
+
+static unsigned
+tw_alloc(struct twheel *tw)
+{
+	unsigned idx, n;
+
+	if (tw->freelist != 0) {
+		idx = tw->freelist;
+		tw->freelist = E(tw, idx)->next;
+		return (idx);
+	}
+	idx = tw->nentry;
+	assert(idx < UINT32_MAX);
+	if ((idx >> CHUNK_SHIFT) == tw->nchunk) {
+		n = tw->nchunk ? 2 * tw->nchunk : 8;
+		if ((idx >> CHUNK_SHIFT) >= n)
+			n = (idx >> CHUNK_SHIFT) + 1;
+		tw->chunks = realloc(tw->chunks, n * sizeof *tw->chunks);
+		AN(tw->chunks);
+		memset(tw->chunks + tw->nchunk, 0,
+		    (n - tw->nchunk) * sizeof *tw->chunks);
+		tw->nchunk = n;
+	}
+	if (tw->chunks[idx >> CHUNK_SHIFT] == NULL) {
+		tw->chunks[idx >> CHUNK_SHIFT] =
+		    malloc(CHUNK_WIDTH * sizeof **tw->chunks);
+		AN(tw->chunks[idx >> CHUNK_SHIFT]);
+	}
+	tw->nentry++;
+	return (idx);
+}
+
+void
+twheel_insert(struct twheel *tw, void *p, double when)
+{
+	struct tw_entry *e;
+	unsigned idx;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	AN(p);
+	idx = tw_alloc(tw);
+	e = E(tw, idx);
+	e->item = p;
+	e->when = when;
+	tw_place(tw, idx);
+	tw->count++;
+	tw->update(tw->priv, p, idx);
+}
+
+void
+twheel_reorder(struct twheel *tw, unsigned idx, double when)
+{
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	assert(idx > 0 && idx < tw->nentry);
+	AN(E(tw, idx)->item);
+	tw_unlink(tw, idx);
+	E(tw, idx)->when = when;
+	tw_place(tw, idx);
+}
+
+void
+twheel_delete(struct twheel *tw, unsigned idx)
+{
+	struct tw_entry *e;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	assert(idx > 0 && idx < tw->nentry);
+	e = E(tw, idx);
+	AN(e->item);
+	tw_unlink(tw, idx);
+	tw->update(tw->priv, e->item, TWHEEL_NOIDX);
+	e->item = NULL;
+	e->next = tw->freelist;
+	tw->freelist = idx;
+	assert(tw->count > 0);
+	tw->count--;
+}
+
+void *
+twheel_due(struct twheel *tw, double now)
+{
+	uint64_t t;
+	unsigned idx;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	if (tw->count == 0)
+		return (NULL);
+	t = tw_tick(tw, now);
+	tw_advance(tw, t);
+	if (tw->cur >= t)
+		return (NULL);
+	idx = tw->head[tw->cur & TW_MASK];
+	AN(idx);
+	return (E(tw, idx)->item);
+}
+
+double
+twheel_next(const struct twheel *tw)
+{
+	uint64_t e;
+	int due;
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	if (tw->count == 0)
+		return (0.);
+	if (tw->head[tw->cur & TW_MASK] != 0)
+		return ((tw->cur + 1) * tw->tick);
+	e = tw_event(tw, &due);
+	assert(e != UINT64_MAX);
+	/* A cascade may bring something due right away, look then */
+	return ((e + (due ? 1 : 0)) * tw->tick);
+}
+
+unsigned
+twheel_count(const struct twheel *tw)
+{
+
+	assert(tw != NULL);
+	assert(tw->magic == TWHEEL_MAGIC);
+	return (tw->count);
+}
+
+#ifdef TEST_DRIVER
+
+/*
+ * Compile with:
+ *	cc -o foo -DTEST_DRIVER -I../.. -I../../include timer_wheel.c vas.c -lm
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "miniobj.h"
+
+/* Test driver -------------------------------------------------------*/
+
+struct foo {
+	unsigned	magic;
+#define FOO_MAGIC	0x23239823
+	unsigned	idx;
+	double		when;
+	double		tick;	/* Tick it is due after */
+};
+
+#define N 10007		/* Number of items */
+#define M 3000017	/* Number of operations */
+#define TICK 0.01
+
+static struct foo *ff[N];
+
+static void
+update(void *priv, void *a, unsigned u)
+{
+	struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	fa->idx = u;
+}
+
+/*
+ * Random times from "just now" to years ahead, so that all levels and
+ * the far list get used.
+ */
+static double
+when(double now)
+{
+	double d;
+
+	d = ldexp((double)random() / RAND_MAX, (int)(random() % 36));
+	return (now + d * TICK - 3 * TICK);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct twheel *tw;
+	struct foo *fp;
+	double now;
+	unsigned u, v;
+
+	(void)argc;
+	(void)argv;
+	now = 1e9;
+	tw = twheel_new(NULL, update, now, TICK);
+	for (u = 0; u < M; u++) {
+		/* Time moves forward in bigger and bigger jumps */
+		now += ldexp((double)random() / RAND_MAX,
+		    (int)(u % 23) - 6) * TICK;
+		while ((fp = twheel_due(tw, now)) != NULL) {
+			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+			assert(fp->tick < floor(now / TICK));
+			twheel_delete(tw, fp->idx);
+			assert(fp->idx == TWHEEL_NOIDX);
+			fp->when = 0;
+		}
+		/* Nothing overdue may be left behind */
+		for (v = 0; u % 97 == 0 && v < N; v++)
+			if (ff[v] != NULL && ff[v]->idx != TWHEEL_NOIDX)
+				assert(ff[v]->tick >= floor(now / TICK));
+		v = random() % N;
+		fp = ff[v];
+		if (fp == NULL) {
+			ALLOC_OBJ(fp, FOO_MAGIC);
+			AN(fp);
+			ff[v] = fp;
+		}
+		if (fp->idx == TWHEEL_NOIDX) {
+			fp->when = when(now);
+			fp->tick = fmax(floor(fp->when / TICK),
+			    floor(now / TICK));
+			twheel_insert(tw, fp, fp->when);
+			AN(fp->idx);
+		} else if (random() & 1) {
+			twheel_delete(tw, fp->idx);
+			assert(fp->idx == TWHEEL_NOIDX);
+		} else {
+			fp->when = when(now);
+			fp->tick = fmax(floor(fp->when / TICK),
+			    floor(now / TICK));
+			twheel_reorder(tw, fp->idx, fp->when);
+		}
+		assert(twheel_next(tw) == 0. || twheel_count(tw) > 0);
+	}
+	fprintf(stderr, "%d operations OK, %u left\n", M, twheel_count(tw));
+	return (0);
+}
+#endif
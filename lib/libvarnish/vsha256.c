@@ -43,6 +43,13 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    (__GNUC__ >= 5 || defined(__clang__))
+#  define VSHA256_SHANI
+#  include <cpuid.h>
+#  include <immintrin.h>
+#endif
+
 #include "vas.h"
 #include "vend.h"
 #include "vsha256.h"
@@ -145,8 +152,10 @@ static const uint32_t K[64] = {
  * SHA256 block compression function.  The 256-bit state is transformed via
  * the 512-bit input block to produce a new state.
  */
+typedef void vsha256_transform_f(uint32_t *, const unsigned char [64]);
+
 static void
-VSHA256_Transform(uint32_t * state, const unsigned char block[64])
+vsha256_transform_c(uint32_t * state, const unsigned char block[64])
 {
 	uint32_t W[64];
 	uint32_t S[8];
@@ -202,6 +211,100 @@ VSHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+#ifdef VSHA256_SHANI
+/*
+ * The same compression function using the x86 SHA extensions.
+ * sha256rnds2 does two rounds on the state held as ABEF and CDGH
+ * halves, sha256msg1 and sha256msg2 compute the message schedule
+ * four words at a time.
+ */
+static void __attribute__((target("sha,ssse3,sse4.1")))
+vsha256_transform_shani(uint32_t *state, const unsigned char block[64])
+{
+	const __m128i bswap = _mm_set_epi64x(
+	    0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i s0, s1, abef, cdgh, msg, tmp, m[4];
+	int g;
+
+	tmp = _mm_loadu_si128((const void *)&state[0]);
+	s1 = _mm_loadu_si128((const void *)&state[4]);
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);		/* CDAB */
+	s1 = _mm_shuffle_epi32(s1, 0x1b);		/* EFGH */
+	s0 = _mm_alignr_epi8(tmp, s1, 8);		/* ABEF */
+	s1 = _mm_blend_epi16(s1, tmp, 0xf0);		/* CDGH */
+	abef = s0;
+	cdgh = s1;
+
+	for (g = 0; g < 16; g++) {
+		if (g < 4)
+			m[g] = _mm_shuffle_epi8(
+			    _mm_loadu_si128((const void *)(block + 16 * g)),
+			    bswap);
+		msg = _mm_add_epi32(m[g & 3],
+		    _mm_loadu_si128((const void *)&K[4 * g]));
+		s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+		if (g >= 3 && g <= 14) {
+			tmp = _mm_alignr_epi8(m[g & 3], m[(g - 1) & 3], 4);
+			m[(g + 1) & 3] = _mm_add_epi32(m[(g + 1) & 3], tmp);
+			m[(g + 1) & 3] =
+			    _mm_sha256msg2_epu32(m[(g + 1) & 3], m[g & 3]);
+		}
+		msg = _mm_shuffle_epi32(msg, 0x0e);
+		s0 = _mm_sha256rnds2_epu32(s0, s1, msg);
+		if (g >= 1 && g <= 12)
+			m[(g - 1) & 3] =
+			    _mm_sha256msg1_epu32(m[(g - 1) & 3], m[g & 3]);
+	}
+
+	s0 = _mm_add_epi32(s0, abef);
+	s1 = _mm_add_epi32(s1, cdgh);
+
+	tmp = _mm_shuffle_epi32(s0, 0x1b);		/* FEBA */
+	s1 = _mm_shuffle_epi32(s1, 0xb1);		/* DCHG */
+	s0 = _mm_blend_epi16(tmp, s1, 0xf0);		/* DCBA */
+	s1 = _mm_alignr_epi8(s1, tmp, 8);		/* HGFE */
+
+	_mm_storeu_si128((void *)&state[0], s0);
+	_mm_storeu_si128((void *)&state[4], s1);
+}
+
+static int
+vsha256_have_shani(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return (0);
+	if (!(c & bit_SSE4_1) || !(c & bit_SSSE3))
+		return (0);
+	if (__get_cpuid_max(0, NULL) < 7)
+		return (0);
+	__cpuid_count(7, 0, a, b, c, d);
+	return ((b >> 29) & 1);
+}
+#endif
+
+/*
+ * The first call picks the fastest implementation the CPU has, which
+ * is then called directly.  Racing first calls all store the same
+ * pointer.
+ */
+static vsha256_transform_f vsha256_transform_pick;
+static vsha256_transform_f *VSHA256_Transform = vsha256_transform_pick;
+
+static void
+vsha256_transform_pick(uint32_t *state, const unsigned char block[64])
+{
+	vsha256_transform_f *f = vsha256_transform_c;
+
+#ifdef VSHA256_SHANI
+	if (vsha256_have_shani())
+		f = vsha256_transform_shani;
+#endif
+	VSHA256_Transform = f;
+	f(state, block);
+}
+
 static const unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -354,3 +457,119 @@ VSHA256_Test(void)
 		AZ(memcmp(o, p->output, 32));
 	}
 }
+
+#ifdef VSHA256_TEST
+/*
+ * Check every implementation the CPU supports against the test-vectors
+ * and the portable one.  Built with VSHA256_BENCH as well, it then
+ * times them on a few message sizes, pass a number of seconds as
+ * argument for longer runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const struct vsha256_impl {
+	const char		*name;
+	vsha256_transform_f	*func;
+} vsha256_impl[] = {
+	{ "portable",	vsha256_transform_c },
+#ifdef VSHA256_SHANI
+	{ "sha-ni",	vsha256_transform_shani },
+#endif
+	{ NULL,		NULL }
+};
+
+static int
+vsha256_usable(const struct vsha256_impl *vi)
+{
+
+#ifdef VSHA256_SHANI
+	if (vi->func == vsha256_transform_shani)
+		return (vsha256_have_shani());
+#endif
+	return (vi->func != NULL);
+}
+
+static void
+vsha256_digest(unsigned char *o, const unsigned char *p, size_t l)
+{
+	struct VSHA256Context c;
+
+	VSHA256_Init(&c);
+	VSHA256_Update(&c, p, l);
+	VSHA256_Final(o, &c);
+}
+
+#ifdef VSHA256_BENCH
+#include "vtim.h"
+
+static void
+vsha256_bench(const struct vsha256_impl *vi, const unsigned char *buf,
+    double dur)
+{
+	static const size_t sizes[] = { 16, 64, 256, 1024, 16384, 0 };
+	unsigned char o[32];
+	const size_t *sz;
+	double t0, t1;
+	uintmax_t n;
+	size_t l;
+
+	VSHA256_Transform = vi->func;
+	for (sz = sizes; *sz != 0; sz++) {
+		n = 0;
+		t0 = VTIM_mono();
+		do {
+			for (l = 0; l < 256; l++)
+				vsha256_digest(o, buf, *sz);
+			n += 256;
+			t1 = VTIM_mono();
+		} while (t1 - t0 < dur);
+		printf("%-10s %6zu bytes %10.0f hash/s %8.1f MB/s\n",
+		    vi->name, *sz, n / (t1 - t0),
+		    (n * *sz) / (t1 - t0) * 1e-6);
+	}
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+	const struct vsha256_impl *vi;
+	unsigned char buf[16384], ref[32], o[32];
+	size_t l;
+#ifdef VSHA256_BENCH
+	double dur = .2;
+
+	if (argc > 1)
+		dur = strtod(argv[1], NULL);
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	for (l = 0; l < sizeof buf; l++)
+		buf[l] = (unsigned char)(l * 7 + (l >> 8));
+
+	for (vi = vsha256_impl; vi->name != NULL; vi++) {
+		if (!vsha256_usable(vi)) {
+			printf("%-10s not supported by this CPU\n", vi->name);
+			continue;
+		}
+		for (l = 0; l <= sizeof buf; l += 1 + l / 3) {
+			VSHA256_Transform = vsha256_transform_c;
+			vsha256_digest(ref, buf, l);
+			VSHA256_Transform = vi->func;
+			vsha256_digest(o, buf, l);
+			AZ(memcmp(o, ref, sizeof o));
+		}
+		VSHA256_Transform = vi->func;
+		VSHA256_Test();
+		printf("%-10s ok\n", vi->name);
+#ifdef VSHA256_BENCH
+		vsha256_bench(vi, buf, dur);
+#endif
+	}
+	return (0);
+}
+#endif